@@ -1,14 +1,25 @@
 #include"app.h"
+#include<algorithm>
 #include<fstream>
 
-app::app(size_t plat_id, size_t dev_id, size_t free_storage) :
-	env(plat_id, dev_id, free_storage) {
-	std::cout << "Initialising...";
+const std::unordered_map<std::string, int> app::transfers = {
+	{"linear", TRANSFER_LINEAR}, {"srgb", TRANSFER_SRGB},
+	{"rec709", TRANSFER_REC709}, {"gamma22", TRANSFER_GAMMA22}
+};
+
+thread_local app::region app::roi;
+
+app::app(size_t plat_id, size_t dev_id, size_t free_storage, cl_command_queue_properties queue_props,
+	cl_device_type dev_type) : env(plat_id, dev_id, free_storage, queue_props, dev_type), tuning(&env, TUNING_FILE) {
+	std::cerr << "Initialising...";
+	/* CPU runtimes emulate image samplers in software, plain loads vectorise better */
+	cl_device_type actual_type = hardware::device_param<cl_device_type>(env.cur_device, CL_DEVICE_TYPE);
+	env.buffers = (actual_type & CL_DEVICE_TYPE_CPU) != 0;
 	this->match_extensions();
 	this->match_kernels();
 	this->compile_kernels();
 	this->init_executors();
-	std::cout << " Ready" << std::endl;
+	std::cerr << " Ready" << std::endl;
 }
 
 app::~app() {
@@ -18,43 +29,36 @@ app::~app() {
 	delete filter_ptr;
 	delete wavelet_ptr;
 	delete contraster_ptr;
+	delete grader_ptr;
+	delete morpher_ptr;
+	delete fourier_ptr;
+	delete integrator_ptr;
+	delete assessor_ptr;
 
+	for (auto& prog : prog_tree) { prog.second.release(); }
 	for (cl_program program : prog_objects) { clReleaseProgram(program); }
-	for (auto prog : prog_tree) {
-		for (auto kern : prog.second) { clReleaseKernel(kern.second); }
-	}
 }
 
 void app::compile_kernels() {
 	for (auto prog_it = prog_tree.begin(); prog_it != prog_tree.end(); ++prog_it) {
 		std::ifstream src_file(prog_it->first);
 		std::string src_program(std::istreambuf_iterator<char>(src_file), (std::istreambuf_iterator<char>()));
-		const char* src = src_program.c_str();
-		size_t length = src_program.length();
-
-		prog_objects.push_back(clCreateProgramWithSource(env.context, 1, &src, &length, NULL));
-		cl_int ret_code = clBuildProgram(prog_objects.back(), 1, &env.cur_device, "-I.", NULL, NULL);
-		if (ret_code != CL_SUCCESS) {
-			char* log_str = new char[50000]; cl_uint ret_size;
-			clGetProgramBuildInfo(prog_objects.back(), env.cur_device, CL_PROGRAM_BUILD_LOG, 50000, log_str, &ret_size);
-			std::string build_log(log_str, ret_size); delete[] log_str;
-			throw std::runtime_error(build_log);
-		}
-		for (auto kern_it = prog_it->second.begin();
-			kern_it != prog_it->second.end(); ++kern_it) {
-			kern_it->second = clCreateKernel(prog_objects.back(),
-				kern_it->first.c_str(), &ret_code);
-			util::assert_success(ret_code, "Failed to create kernel " + kern_it->first);
-		}
+		prog_objects.push_back(env.build_program(src_program));
+		prog_it->second.program = prog_objects.back();
+		prog_it->second.source = src_program;
+		prog_it->second.env = &env;
+		for (const std::string& name : prog_it->second.names) { prog_it->second.at(name); }
 	}
 }
 
 void app::match_kernels() {
-	prog_tree.emplace("zoomer.cl", util::map_of({ "lanczos", "bilinear", "splines", "precise" }));
+	prog_tree.emplace("zoomer.cl", util::map_of({ "lanczos", "bilinear", "splines", "precise",
+		"lanczos_buf", "bilinear_buf" }));
 
 	prog_tree.emplace("rotator.cl", util::map_of({ "clockwise", "counter_clockwise", "shear", "map" }));
 
-	prog_tree.emplace("filter.cl", util::map_of({ "horizontal_conv", "vertical_conv", "conv_2D" }));
+	prog_tree.emplace("filter.cl", util::map_of({ "horizontal_conv", "vertical_conv", "conv_2D", "conv_2D_buf",
+		"median_3x3", "median_5x5", "median_hist", "bilateral", "guided_coeffs", "guided_apply" }));
 
 	//prog_tree.emplace("wavelet.cl", util::map_of({ "horizontal_haar", "vertical_haar", "soft_threshold" }));
 
@@ -63,16 +67,34 @@ void app::match_kernels() {
 		"srgb_to_ciexyz", "ciexyz_to_srgb", "ciexyz_to_cielab", "cielab_to_ciexyz" 
 		}));
 
-	prog_tree.emplace("contraster.cl", util::map_of({ "exclusive_hist", "adaptive_hist", "manual"  }));
+	prog_tree.emplace("contraster.cl", util::map_of({ "exclusive_hist", "adaptive_hist", "manual",
+		"manual_buf", "exclusive_hist_buf", "histogram", "histogram_buf", "hist_lut", "map_lut", "map_lut_buf" }));
+
+	prog_tree.emplace("grader.cl", util::map_of({ "trilinear", "tetrahedral", "identity_lattice" }));
+
+	prog_tree.emplace("morpher.cl", util::map_of({ "vhgw_blocks", "vhgw_merge", "difference" }));
+
+	prog_tree.emplace("fourier.cl", util::map_of({ "pack_planes", "unpack_planes", "fft_pass", "wrap_kernel",
+		"multiply_spectra", "notch_mask" }));
+
+	prog_tree.emplace("integrator.cl", util::map_of({ "scan_rows", "scan_totals", "add_totals", "scan_cols",
+		"box_mean", "local_normalise" }));
+
+	prog_tree.emplace("assessor.cl", util::map_of({ "abs_error", "ssim_rows", "ssim_cols", "halve" }));
 
-	prog_tree.emplace("utils.cl", util::map_of({ "denormalise",  "normalise", "split_channels" }));
+	prog_tree.emplace("utils.cl", util::map_of({ "denormalise",  "normalise", "normalise_any", "denormalise_any",
+		"split_planes", "merge_planes", "normalise_buf", "denormalise_buf", "stat_partial", "stat_final", "paste_region" }));
 
 }
 
 
 void app::match_extensions() {
-	loader.emplace(".pnm", io_manager::load_pnm);
-	writer.emplace(".pnm", io_manager::write_pnm);
+	for (const char* ext : { ".pnm", ".pgm", ".ppm", ".pam" }) {
+		loader.emplace(ext, io_manager::load_pnm);
+		sizer.emplace(ext, io_manager::size_pnm);
+	}
+	for (const char* ext : { ".pnm", ".pgm", ".ppm" }) { writer.emplace(ext, io_manager::write_pnm); }
+	writer.emplace(".pam", io_manager::write_pam);
 }
 
 void app::init_executors() {
@@ -81,8 +103,16 @@ void app::init_executors() {
 	rotator_ptr = new rotator(&env, &prog_tree.at("rotator.cl"));
 	contraster_ptr = new contraster(&env, &prog_tree.at("contraster.cl"));
 	filter_ptr = new filter(&env, &prog_tree.at("filter.cl"));
+	grader_ptr = new grader(&env, &prog_tree.at("grader.cl"));
+	morpher_ptr = new morpher(&env, &prog_tree.at("morpher.cl"));
+	fourier_ptr = new fourier(&env, &prog_tree.at("fourier.cl"));
+	filter_ptr->spectral = fourier_ptr;
+	integrator_ptr = new integrator(&env, &prog_tree.at("integrator.cl"));
+	filter_ptr->integral = integrator_ptr;
+	assessor_ptr = new assessor(&env, &prog_tree.at("assessor.cl"));
 	//wavelet_ptr = new wavelet(&env, &prog_tree.at("wavelet.cl"));
-	util::kernels = &prog_tree.at("utils.cl");
+	env.utils = &prog_tree.at("utils.cl");
+	env.tuning = &tuning;
 }
 
 
@@ -106,10 +136,56 @@ void app::env_info() {
 	delete[] log_str;
 }
 
-im_ptr app::get_im(const std::string& filename, int gamma) {
-	return loader.at(util::file_ext(filename))(&env, filename, gamma);
+im_ptr app::get_im(const std::string& filename, int gamma, cl_channel_type format) {
+	std::string ext = util::file_ext(filename);
+	cl_int4 whole = { { 0, 0, 0, 0 } };
+	if (roi.rect.s[2] == 0 || roi.rect.s[3] == 0) { return loader.at(ext)(&env, filename, gamma, format, whole); }
+	cl_int2 size = sizer.at(ext)(filename);
+	if (roi.full.s[0] == 0) {
+		const cl_int4& rect = roi.rect;
+		if (rect.s[0] < 0 || rect.s[1] < 0 || rect.s[2] < 0 || rect.s[3] < 0 ||
+			rect.s[0] + rect.s[2] > size.x || rect.s[1] + rect.s[3] > size.y) {
+			throw std::runtime_error("Region is outside of " + filename);
+		}
+		int left = std::max(rect.s[0] - roi.halo, 0), top = std::max(rect.s[1] - roi.halo, 0);
+		int right = std::min(rect.s[0] + rect.s[2] + roi.halo, size.x);
+		int bottom = std::min(rect.s[1] + rect.s[3] + roi.halo, size.y);
+		roi.loaded = { { left, top, right - left, bottom - top } };
+		roi.full = size;
+		/* Composite output is the whole image, so it has to be loaded whole once */
+		if (roi.composite) {
+			roi.base = loader.at(ext)(&env, filename, gamma, format, whole);
+			return roi.base->crop(roi.loaded);
+		}
+	}
+	/* Further inputs of other sizes, e.g. references, stay whole */
+	else if (size.x != roi.full.s[0] || size.y != roi.full.s[1]) { return loader.at(ext)(&env, filename, gamma, format, whole); }
+	return loader.at(ext)(&env, filename, gamma, format, roi.loaded);
+}
+
+cl_channel_type app::storage_for(int gamma, size_t passes) {
+	cl_channel_type format = (gamma == GAMMA_CORRECTION_OFF && passes == 1) ? CL_UNORM_INT8 : CL_HALF_FLOAT;
+	return env.supports(CL_RGBA, format) ? format : CL_FLOAT;
+}
+
+void app::set_profiling(bool enabled) {
+	profile.clear();
+	profile.enabled = enabled;
+	cl_command_queue_properties props = env.queue_props;
+	props = enabled ? (props | CL_QUEUE_PROFILING_ENABLE) : (props & ~CL_QUEUE_PROFILING_ENABLE);
+	if (props != env.queue_props) { env.reset_queue(props); }
 }
 
 void app::put_im(const std::string& filename, im_ptr& im, int inverse_gamma) {
-	writer.at(util::file_ext(filename))(im, filename, inverse_gamma);
+	im_ptr out = im;
+	/* Results of other sizes, e.g. of zoom, are written as they are */
+	if (roi.full.s[0] != 0 && im->size.x == roi.loaded.s[2] && im->size.y == roi.loaded.s[3]) {
+		cl_int4 inner = { { roi.rect.s[0] - roi.loaded.s[0], roi.rect.s[1] - roi.loaded.s[1], roi.rect.s[2], roi.rect.s[3] } };
+		if (roi.composite) {
+			roi.base->paste(*im, inner, { roi.rect.s[0], roi.rect.s[1] });
+			out = roi.base;
+		}
+		else if (inner.s[2] != im->size.x || inner.s[3] != im->size.y) { out = im->crop(inner); }
+	}
+	writer.at(util::file_ext(filename))(out, filename, inverse_gamma);
 }
\ No newline at end of file
@@ -3,18 +3,26 @@
 #include"hardware.h"
 #include"im_executors.h"
 #include"io_manager.h"
+#include"profiler.h"
+#include"tuner.h"
 
 #include<string>
 #include<type_traits>
 #include<unordered_map>
 
-using load_fun = im_ptr(*) (hardware*, const std::string&, int);
+#define TUNING_FILE "im_cl.tuning"
+
+using load_fun = im_ptr(*) (hardware*, const std::string&, int, cl_channel_type, cl_int4);
+using size_fun = cl_int2(*) (const std::string&);
 using write_fun = void (*) (im_ptr&, const std::string&, int);
 
 struct app {
 	/* OpenCL environment */
 	hardware env;
 
+	/* Work-group sizes, persisted in TUNING_FILE */
+	tuner tuning;
+
 	/* Gather all program objects into one vector */
 	std::vector<cl_program> prog_objects;
 
@@ -28,15 +36,57 @@ struct app {
 	filter* filter_ptr;
 	wavelet* wavelet_ptr;
 	contraster* contraster_ptr;
+	grader* grader_ptr;
+	morpher* morpher_ptr;
+	fourier* fourier_ptr;
+	integrator* integrator_ptr;
+	assessor* assessor_ptr;
+
+	/* Device timings of REPL commands */
+	profiler profile;
+
+	/* Transfer function linearising images for resampling and filtering */
+	int transfer = TRANSFER_SRGB;
+	static const std::unordered_map<std::string, int> transfers;
+
+	/* Region of interest of the running command, get_im crops to it and put_im writes it */
+	struct region {
+		/* x, y, width, height; empty for whole images */
+		cl_int4 rect = { { 0, 0, 0, 0 } };
+
+		/* Context loaded around rect for neighbourhood filters, cut off on output */
+		int halo = 0;
+
+		/* Output is the first loaded image with result pasted over rect, otherwise rect alone */
+		bool composite = false;
+
+		/* Size of the first image of the command and its part handed out, zero until it is loaded */
+		cl_int2 full = { { 0, 0 } };
+		cl_int4 loaded = { { 0, 0, 0, 0 } };
+
+		/* Whole first image, kept for composite output only */
+		im_ptr base = nullptr;
+	};
+	static thread_local region roi;
 	
 
-	app(size_t plat_id, size_t dev_id, size_t free_storage = 0);
+	app(size_t plat_id, size_t dev_id, size_t free_storage = 0, cl_command_queue_properties queue_props = 0,
+		cl_device_type dev_type = CL_DEVICE_TYPE_GPU);
 	void env_info();
 
-	/* Given filename, creates ready for use read-only im_object */
-	im_ptr get_im(const std::string& filename, int gamma = GAMMA_CORRECTION_ON);
+	/* Given filename, creates ready for use read-only im_object, part of it around roi if set */
+	im_ptr get_im(const std::string& filename, int gamma = GAMMA_CORRECTION_ON, cl_channel_type format = CL_FLOAT);
+
+	/*
+	*  Most compact device format keeping 8-bit output exact for a chain of given length:
+	*  unorm8 for a single pass over gamma-encoded data, half otherwise, float if unsupported
+	*/
+	cl_channel_type storage_for(int gamma, size_t passes);
+
+	/* Recreate queue with or without profiling, drops collected timings */
+	void set_profiling(bool enabled);
 
-	/* Puts im_object.host_ptr into file */
+	/* Puts im_object.host_ptr into file, roi of results of the loaded part */
 	void put_im(const std::string& filename, im_ptr& im, int inverse_gamma = GAMMA_CORRECTION_ON);
 
 	~app();
@@ -48,5 +98,6 @@ private:
 	void init_executors();
 
 	std::unordered_map<std::string, load_fun> loader;
+	std::unordered_map<std::string, size_fun> sizer;
 	std::unordered_map<std::string, write_fun> writer;
 };
\ No newline at end of file
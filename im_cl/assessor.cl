@@ -0,0 +1,66 @@
+#include "bounds.cl"
+
+/*
+*	Full-reference quality: absolute errors, SSIM of Wang et al. with Gaussian window,
+*	contrast-structure term for MS-SSIM. Values in [0, 1], so dynamic range L = 1
+*/
+#define SSIM_C1 (0.01f * 0.01f)
+#define SSIM_C2 (0.03f * 0.03f)
+
+__kernel void abs_error(__read_only image2d_t src_a, __read_only image2d_t src_b, sampler_t sampler,
+	__write_only image2d_t dst) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	write_imagef(dst, cd, fabs(read_imagef(src_a, sampler, cd) - read_imagef(src_b, sampler, cd)));
+}
+
+/* Horizontal Gaussian sums of a, b, a^2, b^2, a * b */
+__kernel void ssim_rows(__read_only image2d_t src_a, __read_only image2d_t src_b, sampler_t sampler,
+	__constant float* weights, int radius, __write_only image2d_t mean_a, __write_only image2d_t mean_b,
+	__write_only image2d_t mean_aa, __write_only image2d_t mean_bb, __write_only image2d_t mean_ab) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(mean_a, cd)) { return; }
+	float4 sum_a = (float4)(0.0f), sum_b = (float4)(0.0f);
+	float4 sum_aa = (float4)(0.0f), sum_bb = (float4)(0.0f), sum_ab = (float4)(0.0f);
+	for (int dx = -radius; dx <= radius; ++dx) {
+		float w = weights[dx + radius];
+		float4 a = read_imagef(src_a, sampler, cd + (int2)(dx, 0));
+		float4 b = read_imagef(src_b, sampler, cd + (int2)(dx, 0));
+		sum_a += w * a; sum_b += w * b;
+		sum_aa += w * a * a; sum_bb += w * b * b; sum_ab += w * a * b;
+	}
+	write_imagef(mean_a, cd, sum_a); write_imagef(mean_b, cd, sum_b);
+	write_imagef(mean_aa, cd, sum_aa); write_imagef(mean_bb, cd, sum_bb); write_imagef(mean_ab, cd, sum_ab);
+}
+
+#define VERT_SUM(img) { float4 acc = (float4)(0.0f); \
+	for (int dy = -radius; dy <= radius; ++dy) { acc += weights[dy + radius] * read_imagef(img, sampler, cd + (int2)(0, dy)); } \
+	img##_val = acc; }
+
+/* Vertical pass of the same sums, SSIM and contrast-structure maps */
+__kernel void ssim_cols(__read_only image2d_t mean_a, __read_only image2d_t mean_b, __read_only image2d_t mean_aa,
+	__read_only image2d_t mean_bb, __read_only image2d_t mean_ab, sampler_t sampler, __constant float* weights, int radius,
+	__write_only image2d_t ssim_map, __write_only image2d_t cs_map) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(ssim_map, cd)) { return; }
+	float4 mean_a_val, mean_b_val, mean_aa_val, mean_bb_val, mean_ab_val;
+	VERT_SUM(mean_a) VERT_SUM(mean_b) VERT_SUM(mean_aa) VERT_SUM(mean_bb) VERT_SUM(mean_ab)
+	float4 var_a = mean_aa_val - mean_a_val * mean_a_val;
+	float4 var_b = mean_bb_val - mean_b_val * mean_b_val;
+	float4 covar = mean_ab_val - mean_a_val * mean_b_val;
+	float4 cs = (2.0f * covar + SSIM_C2) / (var_a + var_b + SSIM_C2);
+	float4 luminance = (2.0f * mean_a_val * mean_b_val + SSIM_C1) /
+		(mean_a_val * mean_a_val + mean_b_val * mean_b_val + SSIM_C1);
+	write_imagef(ssim_map, cd, luminance * cs);
+	write_imagef(cs_map, cd, cs);
+}
+
+/* 2x2 average, next scale of MS-SSIM */
+__kernel void halve(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	int2 base = 2 * cd;
+	float4 sum = read_imagef(src, sampler, base) + read_imagef(src, sampler, base + (int2)(1, 0)) +
+		read_imagef(src, sampler, base + (int2)(0, 1)) + read_imagef(src, sampler, base + (int2)(1, 1));
+	write_imagef(dst, cd, 0.25f * sum);
+}
@@ -0,0 +1,118 @@
+#include"im_executors.h"
+#include<cmath>
+#include<limits>
+
+/* Gaussian window of SSIM: sigma 1.5, 11 taps */
+#define SSIM_RADIUS 5
+#define SSIM_SIGMA 1.5f
+
+/* Scale weights of MS-SSIM, finest first */
+#define MS_SSIM_SCALES 5
+static const float ms_ssim_weights[MS_SSIM_SCALES] = { 0.0448f, 0.2856f, 0.3001f, 0.2363f, 0.1333f };
+
+assessor::assessor(hardware* env, functions* kernels) : executor(env, kernels) {
+	std::vector<float> taps(2 * SSIM_RADIUS + 1);
+	float norm = 0.0f;
+	for (int x = -SSIM_RADIUS; x <= SSIM_RADIUS; ++x) {
+		taps[x + SSIM_RADIUS] = expf(-(x * x) / (2.0f * SSIM_SIGMA * SSIM_SIGMA));
+		norm += taps[x + SSIM_RADIUS];
+	}
+	for (float& tap : taps) { tap /= norm; }
+	weights = env->alloc_buf(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * taps.size(), taps.data());
+}
+
+assessor::~assessor() { clReleaseMemObject(weights); }
+
+assessor::quality assessor::compare(im_ptr& a, im_ptr& b, bool maps) {
+	if (a->size.x != b->size.x || a->size.y != b->size.y) { throw std::runtime_error("Compared images differ in size"); }
+	im_ptr lhs = a->planar() ? a->merge() : a, rhs = b->planar() ? b->merge() : b;
+	lhs->make_image(); rhs->make_image();
+	quality result;
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST });
+
+	/* E[d^2] = Var|d| + E[|d|]^2, both terms positive */
+	result.error_map = std::make_shared<im_object>(lhs->size, env);
+	cl_kernel kern = kernels->at("abs_error");
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &lhs->cl_storage);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_mem), &rhs->cl_storage);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_sampler), &sampler);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_mem), &result.error_map->cl_storage);
+	util::assert_success(ret_code, "Failed to set error args");
+	run_blocking(kern, lhs->size, LAUNCH_PURE | LAUNCH_GUARDED);
+	im_stats errors = result.error_map->stat();
+	for (int ch = 0; ch < 4; ++ch) {
+		result.mse.s[ch] = errors.variance.s[ch] + errors.mean.s[ch] * errors.mean.s[ch];
+		result.psnr.s[ch] = (result.mse.s[ch] > 0.0f) ? -10.0f * log10f(result.mse.s[ch]) : std::numeric_limits<float>::infinity();
+	}
+
+	/* Scales while the window still fits, weights of the dropped coarse ones are left out and the rest renormalised */
+	int scales = 0;
+	while (scales < MS_SSIM_SCALES && std::min(lhs->size.x, lhs->size.y) >> scales >= 2 * SSIM_RADIUS + 1) { ++scales; }
+	if (scales == 0) { throw std::runtime_error("Images are too small for SSIM window"); }
+	float weight_sum = 0.0f;
+	for (int s = 0; s < scales; ++s) { weight_sum += ms_ssim_weights[s]; }
+	for (int ch = 0; ch < 4; ++ch) { result.ms_ssim.s[ch] = 1.0f; }
+
+	im_ptr cur_a = lhs, cur_b = rhs;
+	for (int s = 0; s < scales; ++s) {
+		std::pair<im_ptr, im_ptr> scale_maps = ssim_maps(cur_a, cur_b);
+		im_stats ssim_stats = scale_maps.first->stat(), cs_stats = scale_maps.second->stat();
+		float weight = ms_ssim_weights[s] / weight_sum;
+		for (int ch = 0; ch < 4; ++ch) {
+			float term = (s + 1 == scales) ? ssim_stats.mean.s[ch] : cs_stats.mean.s[ch];
+			result.ms_ssim.s[ch] *= powf(std::max(term, 0.0f), weight);
+		}
+		if (s == 0) {
+			result.ssim = ssim_stats.mean;
+			if (maps) { result.ssim_map = scale_maps.first; }
+		}
+		if (s + 1 < scales) {
+			im_ptr next_a = halve(cur_a), next_b = halve(cur_b);
+			cur_a.swap(next_a); cur_b.swap(next_b);
+		}
+	}
+	if (!maps) { result.error_map = nullptr; }
+	return result;
+}
+
+std::pair<im_ptr, im_ptr> assessor::ssim_maps(im_ptr& a, im_ptr& b) {
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST });
+	cl_int radius = SSIM_RADIUS;
+	cl_mem sums[5];
+	for (cl_mem& sum : sums) { sum = env->alloc_im(a->size); }
+	cl_kernel kern = kernels->at("ssim_rows");
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &a->cl_storage);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_mem), &b->cl_storage);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_sampler), &sampler);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_mem), &weights);
+	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_int), &radius);
+	for (cl_uint s = 0; s < 5; ++s) { ret_code |= clSetKernelArg(kern, 5 + s, sizeof(cl_mem), &sums[s]); }
+	util::assert_success(ret_code, "Failed to set SSIM args");
+	run_blocking(kern, a->size, LAUNCH_PURE | LAUNCH_GUARDED);
+
+	im_ptr ssim_map = std::make_shared<im_object>(a->size, env);
+	im_ptr cs_map = std::make_shared<im_object>(a->size, env);
+	kern = kernels->at("ssim_cols");
+	ret_code = CL_SUCCESS;
+	for (cl_uint s = 0; s < 5; ++s) { ret_code |= clSetKernelArg(kern, s, sizeof(cl_mem), &sums[s]); }
+	ret_code |= clSetKernelArg(kern, 5, sizeof(cl_sampler), &sampler);
+	ret_code |= clSetKernelArg(kern, 6, sizeof(cl_mem), &weights);
+	ret_code |= clSetKernelArg(kern, 7, sizeof(cl_int), &radius);
+	ret_code |= clSetKernelArg(kern, 8, sizeof(cl_mem), &ssim_map->cl_storage);
+	ret_code |= clSetKernelArg(kern, 9, sizeof(cl_mem), &cs_map->cl_storage);
+	util::assert_success(ret_code, "Failed to set SSIM args");
+	run_blocking(kern, a->size, LAUNCH_PURE | LAUNCH_GUARDED);
+	for (cl_mem sum : sums) { clReleaseMemObject(sum); }
+	return { ssim_map, cs_map };
+}
+
+im_ptr assessor::halve(im_ptr& src) {
+	cl_int2 half_size = { src->size.x / 2, src->size.y / 2 };
+	im_ptr dst = std::make_shared<im_object>(half_size, env);
+	cl_kernel kern = kernels->at("halve");
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST });
+	cl_int ret_code = set_common_args(kern, src->cl_storage, sampler, dst->cl_storage);
+	util::assert_success(ret_code, "Failed to set halve args");
+	run_blocking(kern, half_size, LAUNCH_PURE | LAUNCH_GUARDED);
+	return std::move(dst);
+}
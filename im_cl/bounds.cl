@@ -0,0 +1,25 @@
+/*
+*	Global size may be padded up to a multiple of the tuned work-group size,
+*	items past the output image return without touching it
+*/
+#ifndef BOUNDS_CL
+#define BOUNDS_CL
+
+#define OUTSIDE(img, cd) ((cd).x >= get_image_width(img) || (cd).y >= get_image_height(img))
+
+/*
+*	Buffer-backed images: row-major float4 pixels without padding.
+*	Reads clamp to edge the way CL_ADDRESS_CLAMP_TO_EDGE samplers do
+*/
+#define OUTSIDE_BUF(size, cd) ((cd).x >= (size).x || (cd).y >= (size).y)
+
+float4 load_px(__global const float* src, int2 size, int2 cd) {
+	int2 edge = clamp(cd, (int2)(0), size - 1);
+	return vload4(edge.x + size.x * edge.y, src);
+}
+
+void store_px(__global float* dst, int2 size, int2 cd, float4 val) {
+	vstore4(val, cd.x + size.x * cd.y, dst);
+}
+
+#endif
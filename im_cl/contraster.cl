@@ -1,7 +1,9 @@
+#include "bounds.cl"
 
 __kernel void manual(__read_only image2d_t src, sampler_t sampler,
 	__write_only image2d_t dst, float4 factor) {
 	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
 	float4 out_val = factor * (read_imagef(src, sampler, cd) - 0.5f) + 0.5f;
 	write_imagef(dst, cd, fmax((float4)0.0f, fmin(1.0f, out_val)));
 }
@@ -9,15 +11,34 @@ __kernel void manual(__read_only image2d_t src, sampler_t sampler,
 __kernel void exclusive_hist(__read_only image2d_t src, sampler_t sampler,
 	__write_only image2d_t dst, float4 off, float4 norm) {
 	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
 	float4 out_val = (read_imagef(src, sampler, cd) - off) / norm;
 	write_imagef(dst, cd, fmax((float4)0.0f, fmin(1.0f, out_val)));
 }
 
+/* Buffer-backed images, size takes the place of sampler */
+__kernel void manual_buf(__global const float* src, int2 size,
+	__global float* dst, float4 factor) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE_BUF(size, cd)) { return; }
+	float4 out_val = factor * (load_px(src, size, cd) - 0.5f) + 0.5f;
+	store_px(dst, size, cd, fmax((float4)0.0f, fmin(1.0f, out_val)));
+}
+
+__kernel void exclusive_hist_buf(__global const float* src, int2 size,
+	__global float* dst, float4 off, float4 norm) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE_BUF(size, cd)) { return; }
+	float4 out_val = (load_px(src, size, cd) - off) / norm;
+	store_px(dst, size, cd, fmax((float4)0.0f, fmin(1.0f, out_val)));
+}
+
 
 #define ADAPTIVE_EPS 1e-5f
 
+/* channels: 3 for packed images, 1 for a single CL_R plane */
 __kernel void adaptive_hist(__read_only image2d_t src, sampler_t sampler,
-	__write_only image2d_t dst, int2 sz, int2 radius, int exclude) {
+	__write_only image2d_t dst, int2 sz, int2 radius, int exclude, int channels) {
 	int2 offset = (int2) (get_global_id(0), get_global_id(1)) * radius;
 	short local_hist[256];
 	for (int i = 0; i < 256; ++i) { local_hist[i] = 0; }
@@ -27,8 +48,10 @@ __kernel void adaptive_hist(__read_only image2d_t src, sampler_t sampler,
 			float4 cur_val = read_imagef(src, sampler, cur_cd);
 			int4 int_val = convert_int4(cur_val * 255.0f);
 			local_hist[int_val.x]++;
-			local_hist[int_val.y]++;
-			local_hist[int_val.z]++;
+			if (channels == 3) {
+				local_hist[int_val.y]++;
+				local_hist[int_val.z]++;
+			}
 		}
 	}
 	int min_val = 0, max_val = 255;
@@ -50,3 +73,128 @@ __kernel void adaptive_hist(__read_only image2d_t src, sampler_t sampler,
 		}
 	}
 }
+
+
+/*
+*	Histogram equalisation and matching: per-group histograms of 8-bit bins,
+*	CDFs scanned by one work-group per channel, mapping applied as a 256-entry table per channel.
+*	channels: 3 for packed images, 1 maps only the first channel (luma of planar images)
+*/
+#define HIST_BINS 256
+
+void clear_hist(__local uint* hist) {
+	for (int i = get_local_id(0); i < 3 * HIST_BINS; i += get_local_size(0)) { hist[i] = 0; }
+	barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+void count_px(__local uint* hist, float4 val, int channels) {
+	int4 bin = clamp(convert_int4_rte(val * (HIST_BINS - 1)), 0, HIST_BINS - 1);
+	atomic_inc(hist + bin.x);
+	if (channels == 3) {
+		atomic_inc(hist + HIST_BINS + bin.y);
+		atomic_inc(hist + 2 * HIST_BINS + bin.z);
+	}
+}
+
+/* partials: 3 * HIST_BINS counts per work-group */
+void flush_hist(__local uint* hist, __global uint* partials) {
+	barrier(CLK_LOCAL_MEM_FENCE);
+	__global uint* group_hist = partials + get_group_id(0) * 3 * HIST_BINS;
+	for (int i = get_local_id(0); i < 3 * HIST_BINS; i += get_local_size(0)) { group_hist[i] = hist[i]; }
+}
+
+__kernel void histogram(__read_only image2d_t src, sampler_t sampler, int2 size, int channels, __global uint* partials) {
+	__local uint hist[3 * HIST_BINS];
+	clear_hist(hist);
+	for (int p = get_global_id(0); p < size.x * size.y; p += get_global_size(0)) {
+		count_px(hist, read_imagef(src, sampler, (int2)(p % size.x, p / size.x)), channels);
+	}
+	flush_hist(hist, partials);
+}
+
+__kernel void histogram_buf(__global const float* src, int2 size, int channels, __global uint* partials) {
+	__local uint hist[3 * HIST_BINS];
+	clear_hist(hist);
+	for (int p = get_global_id(0); p < size.x * size.y; p += get_global_size(0)) {
+		count_px(hist, load_px(src, size, (int2)(p % size.x, p / size.x)), channels);
+	}
+	flush_hist(hist, partials);
+}
+
+/* Inclusive scan of HIST_BINS counts, one per work-item */
+void scan_bins(__local uint* cdf) {
+	int lid = get_local_id(0);
+	for (int offset = 1; offset < HIST_BINS; offset <<= 1) {
+		uint add = (lid >= offset) ? cdf[lid - offset] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		cdf[lid] += add;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+}
+
+/*
+*	Work-group of HIST_BINS items per channel, item per bin. Equalisation spreads the CDF over [0, 1]
+*	from its first occupied bin; matching takes the first reference bin whose CDF reaches the source one
+*/
+__kernel void hist_lut(__global const uint* partials, int groups,
+	__global const uint* ref_partials, int ref_groups, int match, __global float* lut) {
+	__local uint cdf[HIST_BINS], ref_cdf[HIST_BINS];
+	int bin = get_local_id(0), ch = get_group_id(0);
+	uint count = 0, ref_count = 0;
+	for (int g = 0; g < groups; ++g) { count += partials[(g * 3 + ch) * HIST_BINS + bin]; }
+	for (int g = 0; g < ref_groups; ++g) { ref_count += ref_partials[(g * 3 + ch) * HIST_BINS + bin]; }
+	cdf[bin] = count;
+	ref_cdf[bin] = ref_count;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	scan_bins(cdf);
+	scan_bins(ref_cdf);
+
+	uint total = cdf[HIST_BINS - 1];
+	float mapped = bin / (float)(HIST_BINS - 1);
+	if (!match) {
+		/* Smallest non-zero CDF value belongs to the first occupied bin */
+		uint cdf_min = total;
+		for (int b = 0; b < HIST_BINS; ++b) { if (cdf[b] != 0) { cdf_min = cdf[b]; break; } }
+		if (total > cdf_min) { mapped = (cdf[bin] > cdf_min) ? (float)(cdf[bin] - cdf_min) / (float)(total - cdf_min) : 0.0f; }
+	}
+	else if (ref_cdf[HIST_BINS - 1] != 0 && total != 0) {
+		float level = (float)cdf[bin] / (float)total, ref_total = (float)ref_cdf[HIST_BINS - 1];
+		int lo = 0, hi = HIST_BINS - 1;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if ((float)ref_cdf[mid] / ref_total >= level) { hi = mid; }
+			else { lo = mid + 1; }
+		}
+		mapped = lo / (float)(HIST_BINS - 1);
+	}
+	lut[ch * HIST_BINS + bin] = mapped;
+}
+
+float map_val(float val, __global const float* table) {
+	float pos = clamp(val, 0.0f, 1.0f) * (HIST_BINS - 1);
+	int node = min((int)pos, HIST_BINS - 2);
+	return mix(table[node], table[node + 1], pos - node);
+}
+
+float4 map_px(float4 val, __global const float* lut, int channels) {
+	val.x = map_val(val.x, lut);
+	if (channels == 3) {
+		val.y = map_val(val.y, lut + HIST_BINS);
+		val.z = map_val(val.z, lut + 2 * HIST_BINS);
+	}
+	return val;
+}
+
+__kernel void map_lut(__read_only image2d_t src, sampler_t sampler,
+	__write_only image2d_t dst, __global const float* lut, int channels) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	write_imagef(dst, cd, map_px(read_imagef(src, sampler, cd), lut, channels));
+}
+
+__kernel void map_lut_buf(__global const float* src, int2 size,
+	__global float* dst, __global const float* lut, int channels) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE_BUF(size, cd)) { return; }
+	store_px(dst, size, cd, map_px(load_px(src, size, cd), lut, channels));
+}
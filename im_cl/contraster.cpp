@@ -1,12 +1,43 @@
 #include"im_executors.h"
+#include<algorithm>
 
+/* Bins per channel and work-group of histogram kernels, must match contraster.cl */
+#define HIST_BINS 256
+
+/* Cap on per-group histograms summed by hist_lut */
+#define HIST_GROUPS 64
 
 contraster::contraster(hardware* env, functions* kernels) : executor(env, kernels) {}
 
 void contraster::set_args(cl_kernel kern, const im_ptr& src, im_ptr& dst) {
-	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), src->cl_storage);
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &src->cl_storage);
 	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_int2), &src->size);
-	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), dst->cl_storage);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &dst->cl_storage);
+	util::assert_success(ret_code, "Failed to set contrast args");
+}
+
+
+im_ptr contraster::apply(cl_kernel kern, cl_sampler sampler, im_ptr& src, int channel_mode, cl_int2 global, int launch) {
+	if (!src->planar()) {
+		im_ptr dst = src->blank(src->size);
+		if (src->buffered) { set_args(kern, src, dst); }
+		else {
+			cl_int ret_code = set_common_args(kern, src->cl_storage, sampler, dst->cl_storage);
+			util::assert_success(ret_code, "Failed to set contrast args");
+		}
+		run_blocking(kern, global, launch);
+		return std::move(dst);
+	}
+	plane_set planes = src->planes;
+	size_t touched = (channel_mode == all_channels) ? 3 : 1;
+	for (size_t p = 0; p < 3; ++p) {
+		if (p >= touched) { clRetainMemObject(planes[p]); continue; }
+		planes[p] = env->alloc_im(src->size, nullptr, CL_R, src->format);
+		cl_int ret_code = set_common_args(kern, src->planes[p], sampler, planes[p]);
+		util::assert_success(ret_code, "Failed to set contrast args");
+		run_blocking(kern, global, launch);
+	}
+	return std::make_shared<im_object>(src->size, env, planes, src->format);
 }
 
 
@@ -20,13 +51,10 @@ im_ptr contraster::manual(im_ptr& src, float contrast, int channel_mode) {
 	if (channel_mode == all_channels) {
 		contrast_vec.y = c_val, contrast_vec.z = c_val;
 	}
-	cl_kernel kern = kernels->at("manual");
-	im_ptr dst = std::make_shared<im_object>(src->size, env);
+	cl_kernel kern = kernels->at(src->buffered ? "manual_buf" : "manual");
 	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
-	cl_int ret_code = set_common_args(kern, src->cl_storage, sampler, dst->cl_storage);
-	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_float4), &contrast_vec);
-	run_blocking(kern, src->size);
-	return std::move(dst);
+	clSetKernelArg(kern, 3, sizeof(cl_float4), &contrast_vec);
+	return apply(kern, sampler, src, channel_mode, src->size, LAUNCH_PURE | LAUNCH_GUARDED);
 }
 
 
@@ -50,14 +78,11 @@ im_ptr contraster::exclusive_hist(im_ptr& src, float exclusive, int channel_mode
 		norm_vec.y = 1.0f, norm_vec.z = 1.0f;
 	}
 
-	cl_kernel kern = kernels->at("exclusive_hist");
-	im_ptr dst = std::make_shared<im_object>(src->size, env);
+	cl_kernel kern = kernels->at(src->buffered ? "exclusive_hist_buf" : "exclusive_hist");
 	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
-	cl_int ret_code = set_common_args(kern, src->cl_storage, sampler, dst->cl_storage);
-	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_float4), &off_vec);
+	cl_int ret_code = clSetKernelArg(kern, 3, sizeof(cl_float4), &off_vec);
 	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_float4), &norm_vec);
-	run_blocking(kern, dst->size);
-	return std::move(dst);
+	return apply(kern, sampler, src, channel_mode, src->size, LAUNCH_PURE | LAUNCH_GUARDED);
 }
 
 
@@ -65,15 +90,97 @@ im_ptr contraster::adaptive_hist(im_ptr& src, cl_int2 region, int exclude, int c
 	if (2 * exclude >= region.x * region.y) { 
 		throw std::runtime_error("To big exclusion for given region");
 	}
+	src->make_image();
 	cl_kernel kern = kernels->at("adaptive_hist");
-	im_ptr dst = std::make_shared<im_object>(src->size, env);
 	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST });
-	cl_int ret_code = set_common_args(kern, src->cl_storage, sampler, dst->cl_storage);
-	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int2), &src->size);
+	int counted = src->planar() ? 1 : 3;
+	cl_int ret_code = clSetKernelArg(kern, 3, sizeof(cl_int2), &src->size);
 	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_int2), &region);
 	ret_code |= clSetKernelArg(kern, 5, sizeof(int), &exclude);
-	int x_region = src->size.x / region.x + (src->size.x % region.x == 0) ? 0 : 1;
-	int y_region = src->size.y / region.y + (src->size.y % region.y == 0) ? 0 : 1;
-	run_blocking(kern, { x_region, y_region });
-	return dst;
-}
\ No newline at end of file
+	ret_code |= clSetKernelArg(kern, 6, sizeof(int), &counted);
+	int x_region = src->size.x / region.x + ((src->size.x % region.x == 0) ? 0 : 1);
+	int y_region = src->size.y / region.y + ((src->size.y % region.y == 0) ? 0 : 1);
+	return apply(kern, sampler, src, channel_mode, { x_region, y_region }, LAUNCH_PURE);
+}
+
+
+cl_mem contraster::histograms(im_ptr& src, int channels, cl_int& groups) {
+	cl_mem plane = src->planar() ? src->planes[0] : src->cl_storage;
+	size_t pixels = static_cast<size_t>(src->size.x) * src->size.y;
+	size_t items = HIST_BINS;
+	groups = static_cast<cl_int>(std::min<size_t>((pixels + items - 1) / items, HIST_GROUPS));
+	cl_mem partials = env->alloc_buf(CL_MEM_READ_WRITE, groups * 3 * HIST_BINS * sizeof(cl_uint), nullptr);
+
+	cl_kernel kern = kernels->at(src->buffered ? "histogram_buf" : "histogram");
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
+	cl_uint arg = 0;
+	cl_int ret_code = clSetKernelArg(kern, arg++, sizeof(cl_mem), &plane);
+	if (!src->buffered) { ret_code |= clSetKernelArg(kern, arg++, sizeof(cl_sampler), &sampler); }
+	ret_code |= clSetKernelArg(kern, arg++, sizeof(cl_int2), &src->size);
+	ret_code |= clSetKernelArg(kern, arg++, sizeof(cl_int), &channels);
+	ret_code |= clSetKernelArg(kern, arg++, sizeof(cl_mem), &partials);
+	util::assert_success(ret_code, "Failed to set histogram args");
+
+	size_t global_size = groups * items;
+	cl_event kern_event = nullptr;
+	ret_code = clEnqueueNDRangeKernel(env->queue(), kern, 1, NULL, &global_size, &items,
+		0, NULL, env->log_slot(&kern_event));
+	ret_code |= clFinish(env->queue());
+	util::assert_success(ret_code, "Failed to count histogram");
+	if (kern_event != nullptr) {
+		env->log_event(kern_event, "histogram");
+		clReleaseEvent(kern_event);
+	}
+	return partials;
+}
+
+
+im_ptr contraster::remap(im_ptr& src, im_ptr* reference, int channel_mode) {
+	/* Per-channel tables read all three channels of one pixel */
+	im_ptr packed = (src->planar() && channel_mode == all_channels) ? src->merge() : src;
+	cl_int channels = (channel_mode == all_channels) ? 3 : 1;
+	cl_int groups = 0, ref_groups = 0, match = (reference != nullptr) ? 1 : 0;
+	cl_mem partials = histograms(packed, channels, groups);
+	cl_mem ref_partials = partials;
+	if (reference != nullptr) {
+		im_ptr ref_packed = ((*reference)->planar() && channel_mode == all_channels) ? (*reference)->merge() : *reference;
+		ref_partials = histograms(ref_packed, channels, ref_groups);
+	}
+	cl_mem lut = env->alloc_buf(CL_MEM_READ_WRITE, 3 * HIST_BINS * sizeof(cl_float), nullptr);
+
+	cl_kernel kern = kernels->at("hist_lut");
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &partials);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_int), &groups);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &ref_partials);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int), &ref_groups);
+	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_int), &match);
+	ret_code |= clSetKernelArg(kern, 5, sizeof(cl_mem), &lut);
+	util::assert_success(ret_code, "Failed to set histogram args");
+	size_t global_size = channels * HIST_BINS, local_size = HIST_BINS;
+	cl_event kern_event = nullptr;
+	ret_code = clEnqueueNDRangeKernel(env->queue(), kern, 1, NULL, &global_size, &local_size,
+		0, NULL, env->log_slot(&kern_event));
+	ret_code |= clFinish(env->queue());
+	clReleaseMemObject(partials);
+	if (reference != nullptr) { clReleaseMemObject(ref_partials); }
+	util::assert_success(ret_code, "Failed to build histogram mapping");
+	if (kern_event != nullptr) {
+		env->log_event(kern_event, "hist_lut");
+		clReleaseEvent(kern_event);
+	}
+
+	kern = kernels->at(packed->buffered ? "map_lut_buf" : "map_lut");
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
+	ret_code = clSetKernelArg(kern, 3, sizeof(cl_mem), &lut);
+	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_int), &channels);
+	util::assert_success(ret_code, "Failed to set histogram args");
+	im_ptr result = apply(kern, sampler, packed, channel_mode, packed->size, LAUNCH_PURE | LAUNCH_GUARDED);
+	clReleaseMemObject(lut);
+	return std::move(result);
+}
+
+
+im_ptr contraster::equalise(im_ptr& src, int channel_mode) { return remap(src, nullptr, channel_mode); }
+
+
+im_ptr contraster::match(im_ptr& src, im_ptr& reference, int channel_mode) { return remap(src, &reference, channel_mode); }
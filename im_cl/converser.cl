@@ -1,3 +1,12 @@
+#include "bounds.cl"
+
+/*
+*  Every conversion is a per-pixel function <from>_to_<to>_px with a thin kernel wrapper.
+*  Multi-hop conversions are compiled by converser into one kernel calling the _px chain.
+*/
+
+#define CLAMP_COL(val) fmax((float4)0.0f, fmin(1.0f, val))
+
 
 /* --- YCbCr conversions ---
 
@@ -5,28 +14,36 @@
    16..235 , 16..240, 16..240
 */
 
-__kernel void srgb_to_ycbcr(__read_only image2d_t src, sampler_t sampler,
-	__write_only image2d_t dst, float3 params) {
-	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float4 in_val = read_imagef(src, sampler, coord);
+float4 srgb_to_ycbcr_px(float4 in_val, float3 params) {
 	float4 out_val = 0.0f;
 	out_val.x = in_val.x * params.x + in_val.y * params.y + in_val.z * params.z;
 	out_val.y = (in_val.z - out_val.x) / (2 - 2 * params.z) + 0.5f;
 	out_val.z = (in_val.x - out_val.x) / (2 - 2 * params.x) + 0.5f;
-	write_imagef(dst, coord, fmax((float4)0.0f, fmin(1.0f, out_val)));
+	return CLAMP_COL(out_val);
 }
 
-__kernel void ycbcr_to_srgb(__read_only image2d_t src, sampler_t sampler,
-	__write_only image2d_t dst, float3 params) {
-	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float4 in_val = read_imagef(src, sampler, coord);
+float4 ycbcr_to_srgb_px(float4 in_val, float3 params) {
 	in_val.yz -= 0.5f;
 	float3 mul = 2.0f - 2.0f * params;
 	float4 out_val = (float4)(in_val.x);
 	out_val.x += mul.x * in_val.z;
 	out_val.y += (params.z / params.y) * mul.z * in_val.y + (params.x / params.y) * mul.x * in_val.z;
 	out_val.z += mul.z * in_val.y;
-	write_imagef(dst, coord, fmax((float4)0.0f, fmin(1.0f, out_val)));
+	return CLAMP_COL(out_val);
+}
+
+__kernel void srgb_to_ycbcr(__read_only image2d_t src, sampler_t sampler,
+	__write_only image2d_t dst, float3 params) {
+	int2 coord = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, coord)) { return; }
+	write_imagef(dst, coord, srgb_to_ycbcr_px(read_imagef(src, sampler, coord), params));
+}
+
+__kernel void ycbcr_to_srgb(__read_only image2d_t src, sampler_t sampler,
+	__write_only image2d_t dst, float3 params) {
+	int2 coord = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, coord)) { return; }
+	write_imagef(dst, coord, ycbcr_to_srgb_px(read_imagef(src, sampler, coord), params));
 }
 
 
@@ -37,9 +54,7 @@ __kernel void ycbcr_to_srgb(__read_only image2d_t src, sampler_t sampler,
    0..360, 0..1, 0..1
 */
 
-__kernel void srgb_to_hsv(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
-	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float4 in_val = read_imagef(src, sampler, coord);
+float4 srgb_to_hsv_px(float4 in_val) {
 	float4 out_val = 0.0f;
 	float maximal = fmax(in_val.x, fmax(in_val.y, in_val.z));
 	float chroma = maximal - fmin(in_val.x, fmin(in_val.y, in_val.z));
@@ -51,23 +66,19 @@ __kernel void srgb_to_hsv(__read_only image2d_t src, sampler_t sampler, __write_
 	}
 	out_val.y = (maximal == 0.0f) ? 0.0f : chroma / maximal;
 	out_val.z = maximal;
-	write_imagef(dst, coord, fmax((float4)0.0f, fmin(1.0f, out_val)));
+	return CLAMP_COL(out_val);
 }
 
-__kernel void hsv_to_srgb(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
-	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float4 in_val = read_imagef(src, sampler, coord);
+float4 hsv_to_srgb_px(float4 in_val) {
 	in_val.x *= 360.0f;
 	float4 col_args = (float4)(5.0f, 3.0f, 1.0f, 0.0f);
 	float4 k = fmod(col_args + (float4)(in_val.x / 60.0f), (float4)(6.0f));
 	float4 t = fmin(k, fmin((float4)(4.0f) - k, (float4)(1.0f)));
 	float4 out_val = (float4)(in_val.z) - in_val.z * in_val.y * fmax((float4)(0.0f), t);
-	write_imagef(dst, coord, fmax((float4)0.0f, fmin(1.0f, out_val)));
+	return CLAMP_COL(out_val);
 }
 
-__kernel void srgb_to_hsl(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
-	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float4 in_val = read_imagef(src, sampler, coord);
+float4 srgb_to_hsl_px(float4 in_val) {
 	float4 out_val = 0.0f;
 	float maximal = fmax(in_val.x, fmax(in_val.y, in_val.z));
 	float minimal = fmin(in_val.x, fmin(in_val.y, in_val.z));
@@ -81,41 +92,71 @@ __kernel void srgb_to_hsl(__read_only image2d_t src, sampler_t sampler, __write_
 	}
 	if (light != 0.0f && light != 1.0f) { out_val.y = (maximal - light) / fmin(light, 1.0f - light); }
 	out_val.z = light;
-	write_imagef(dst, coord, fmax((float4)0.0f, fmin(1.0f, out_val)));
+	return CLAMP_COL(out_val);
 }
 
-__kernel void hsl_to_srgb(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
-	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float4 in_val = read_imagef(src, sampler, coord);
+float4 hsl_to_srgb_px(float4 in_val) {
 	in_val.x *= 360.0f;
 	float4 col_args = (float4)(0.0f, 8.0f, 4.0f, 4.0f);
 	float4 k = fmod(col_args + (float4)(in_val.x / 30.0f), (float4)(12.0f));
 	float4 a = (float4)(in_val.y) * fmin(in_val.z, 1.0f - in_val.z);
 	float4 t = fmin(k - (float4)(3.0f), fmin((float4)(9.0f) - k, (float4)(1.0f)));
 	float4 out_val = (float4)(in_val.z) - a * fmax((float4)(-1.0f), t);
-	write_imagef(dst, coord, fmax((float4)0.0f, fmin(1.0f, out_val)));
+	return CLAMP_COL(out_val);
 }
 
-__kernel void hsl_to_hsv(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
-	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float4 in_val = read_imagef(src, sampler, coord);
+float4 hsl_to_hsv_px(float4 in_val) {
 	float4 out_val = 0.0f;
 	out_val.x = in_val.x;
 	out_val.z = in_val.z + in_val.y * fmin(in_val.z, 1.0f - in_val.z);
 	if (out_val.z != 0.0f) { out_val.y = 2 * (1.0f - in_val.z / out_val.z); }
-	write_imagef(dst, coord, fmax((float4)0.0f, fmin(1.0f, out_val)));
+	return CLAMP_COL(out_val);
 }
 
-__kernel void hsv_to_hsl(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
-	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float4 in_val = read_imagef(src, sampler, coord);
+float4 hsv_to_hsl_px(float4 in_val) {
 	float4 out_val = 0.0f;
 	out_val.x = in_val.x;
 	out_val.z = in_val.z * (1.0f - in_val.y / 2.0f);
-	if (out_val.z != 0.0f && out_val.z != 1.0f) { 
+	if (out_val.z != 0.0f && out_val.z != 1.0f) {
 		out_val.y = (in_val.z - out_val.z) / fmin(1.0f - out_val.z, out_val.z);
 	}
-	write_imagef(dst, coord, fmax((float4)0.0f, fmin(1.0f, out_val)));
+	return CLAMP_COL(out_val);
+}
+
+__kernel void srgb_to_hsv(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
+	int2 coord = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, coord)) { return; }
+	write_imagef(dst, coord, srgb_to_hsv_px(read_imagef(src, sampler, coord)));
+}
+
+__kernel void hsv_to_srgb(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
+	int2 coord = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, coord)) { return; }
+	write_imagef(dst, coord, hsv_to_srgb_px(read_imagef(src, sampler, coord)));
+}
+
+__kernel void srgb_to_hsl(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
+	int2 coord = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, coord)) { return; }
+	write_imagef(dst, coord, srgb_to_hsl_px(read_imagef(src, sampler, coord)));
+}
+
+__kernel void hsl_to_srgb(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
+	int2 coord = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, coord)) { return; }
+	write_imagef(dst, coord, hsl_to_srgb_px(read_imagef(src, sampler, coord)));
+}
+
+__kernel void hsl_to_hsv(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
+	int2 coord = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, coord)) { return; }
+	write_imagef(dst, coord, hsl_to_hsv_px(read_imagef(src, sampler, coord)));
+}
+
+__kernel void hsv_to_hsl(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
+	int2 coord = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, coord)) { return; }
+	write_imagef(dst, coord, hsv_to_hsl_px(read_imagef(src, sampler, coord)));
 }
 
 
@@ -137,17 +178,14 @@ __kernel void hsv_to_hsl(__read_only image2d_t src, sampler_t sampler, __write_o
 #define srgb_z (float4)(0.1805f, 0.0722f, 0.9505f, 0.0f)
 #define XYZ_BOARD 0.04045f
 
-__kernel void srgb_to_ciexyz(__read_only image2d_t src,
-	sampler_t sampler, __write_only image2d_t dst) {
-	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float4 in_val = read_imagef(src, sampler, coord);
+float4 srgb_to_ciexyz_px(float4 in_val) {
 	float4 linear = (float4)(LESS(in_val.x, XYZ_BOARD),
 		LESS(in_val.y, XYZ_BOARD), LESS(in_val.z, XYZ_BOARD), 0.0f);
 	float4 non_linear = (float4)1.0f - linear;
 	float4 lin_val = non_linear * pow((in_val + 0.055f) / 1.055f, 2.4f) + linear * in_val / 12.92f;
 	float4 out_val = lin_val.x * srgb_x + lin_val.y * srgb_y + lin_val.z * srgb_z;
 	out_val.xz /= XYZ_NORM;
-	write_imagef(dst, coord, fmax((float4)0.0f, fmin(1.0f, out_val)));
+	return CLAMP_COL(out_val);
 }
 
 #define xyz_r (float4)(3.2406f, -0.9689f, 0.0557f, 0.0f)
@@ -155,16 +193,14 @@ __kernel void srgb_to_ciexyz(__read_only image2d_t src,
 #define xyz_b (float4)(-0.4986f, 0.0415f, 1.0570f, 0.0f)
 #define SRGB_BOARD 0.0031308f
 
-__kernel void ciexyz_to_srgb(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
-	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float4 in_val = read_imagef(src, sampler, coord);
+float4 ciexyz_to_srgb_px(float4 in_val) {
 	in_val.xz *= XYZ_NORM;
 	float4 out_val = in_val.x * xyz_r + in_val.y * xyz_g + in_val.z * xyz_b;
 	float4 linear = (float4)(LESS(out_val.x, SRGB_BOARD),
 		LESS(out_val.y, SRGB_BOARD), LESS(out_val.z, SRGB_BOARD), 0.0f);
 	float4 non_linear = (float4)1.0f - linear;
 	out_val = non_linear * (1.055f * pow(out_val, 1.0f / 2.4f) - 0.055f) + linear * 12.92f * out_val;
-	write_imagef(dst, coord, fmax((float4)0.0f, fmin(1.0f, out_val)));
+	return CLAMP_COL(out_val);
 }
 
 
@@ -173,9 +209,7 @@ __kernel void ciexyz_to_srgb(__read_only image2d_t src, sampler_t sampler, __wri
 #define DELTA_CUBE 0.00885645167f
 #define _4_div_29 0.13793103448f
 
-__kernel void ciexyz_to_cielab(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
-	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float4 in_val = read_imagef(src, sampler, coord);
+float4 ciexyz_to_cielab_px(float4 in_val) {
 	float4 out_val = 0.0f;
 	float4 linear = (float4)(in_val.x < DELTA_CUBE, in_val.y < DELTA_CUBE, in_val.z < DELTA_CUBE, 0.0f);
 	float4 f_val =  (1.0f - linear) * cbrt(in_val) + linear * (in_val / _3_mul_DELTA_SQR + _4_div_29);
@@ -183,16 +217,39 @@ __kernel void ciexyz_to_cielab(__read_only image2d_t src, sampler_t sampler, __w
 	out_val.y = f_val.x - f_val.y; // origin: 500 * f(x_norm - y_norm)
 	out_val.z = f_val.y - f_val.z; // origin: 200 * f(y_norm - z_norm)
 	out_val.yz = 0.5f * out_val.yz + 0.5f;
-	write_imagef(dst, coord, fmax((float4)0.0f, fmin(1.0f, out_val)));
+	return CLAMP_COL(out_val);
 }
 
-__kernel void cielab_to_ciexyz(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
-	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float4 in_val = read_imagef(src, sampler, coord);
+float4 cielab_to_ciexyz_px(float4 in_val) {
 	float4 off_val = (float4)(0.0f, (in_val.x + 0.16) / 1.16f, 0.0f, 0.0f); // origin: (L* + 16) / 116
 	off_val.x = off_val.y + 2.0f * (in_val.y - 0.5f); // origin : (L* + 16) / 116 + a* / 500
 	off_val.z = off_val.y - 2.0f * (in_val.z - 0.5f); // origin :  (L* + 16) / 116 = b* / 200
 	float4 linear = (float4)(off_val.x < DELTA_CUBE, off_val.y < DELTA_CUBE, off_val.z < DELTA_CUBE, 0.0f);
 	float4 out_val = (1.0f - linear) * off_val * off_val * off_val + linear * (_3_mul_DELTA_SQR * (off_val - _4_div_29));
-	write_imagef(dst, coord, fmax((float4)0.0f, fmin(1.0f, out_val)));
+	return CLAMP_COL(out_val);
+}
+
+__kernel void srgb_to_ciexyz(__read_only image2d_t src,
+	sampler_t sampler, __write_only image2d_t dst) {
+	int2 coord = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, coord)) { return; }
+	write_imagef(dst, coord, srgb_to_ciexyz_px(read_imagef(src, sampler, coord)));
+}
+
+__kernel void ciexyz_to_srgb(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
+	int2 coord = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, coord)) { return; }
+	write_imagef(dst, coord, ciexyz_to_srgb_px(read_imagef(src, sampler, coord)));
+}
+
+__kernel void ciexyz_to_cielab(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
+	int2 coord = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, coord)) { return; }
+	write_imagef(dst, coord, ciexyz_to_cielab_px(read_imagef(src, sampler, coord)));
+}
+
+__kernel void cielab_to_ciexyz(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
+	int2 coord = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, coord)) { return; }
+	write_imagef(dst, coord, cielab_to_ciexyz_px(read_imagef(src, sampler, coord)));
 }
@@ -1,4 +1,6 @@
 #include"im_executors.h"
+#include<algorithm>
+#include<iomanip>
 
 #define HSx_CONVERTER 1
 #define YCBCR_CONVERTER 2
@@ -19,9 +21,15 @@ std::unordered_map<std::string, cl_float3> converser::ycc_params = {
 	{"ycc2020", { 0.2627f, 0.678f, 0.0593f }},
 };
 
-im_ptr converser::run(col_pair colours, im_ptr& src) {
-	auto it_src = conversions.find(colours.first);
-	if (it_src == conversions.end()) { 
+converser::~converser() {
+	for (auto& kern : fused) {
+		kern.second.release();
+		clReleaseProgram(kern.second.program);
+	}
+}
+
+std::vector<std::string> converser::find_path(const col_pair& colours) {
+	if (conversions.find(colours.first) == conversions.end()) {
 		std::string error_message = "Unknown input colour space: "
 			+ colours.first + "\nAvaliable:";
 		for (const auto& x : conversions) { 
@@ -29,15 +37,57 @@ im_ptr converser::run(col_pair colours, im_ptr& src) {
 		}
 		throw std::runtime_error(error_message);
 	}
-	auto it_dst = it_src->second.find(colours.second);
-	if (it_dst == it_src->second.end()) {
+	if (conversions.find(colours.second) == conversions.end()) {
 		std::string error_message = "Unknown output colour space: "
 			+ colours.second + "\nAvaliable:";
-		for (const auto& x : it_src->second) { 
-			error_message.append(" ").append(x);
+		for (const auto& x : conversions) { 
+			error_message.append(" ").append(x.first);
 		}
 		throw std::runtime_error(error_message);
 	}
+	if (colours.first == colours.second) {
+		throw std::runtime_error("Nothing to converse: " + colours.first);
+	}
+
+	/* Breadth-first search, previous space of each visited one */
+	std::unordered_map<std::string, std::string> previous = { { colours.first, "" } };
+	std::vector<std::string> front = { colours.first };
+	for (size_t pos = 0; pos < front.size(); ++pos) {
+		for (const std::string& next : conversions.at(front[pos])) {
+			if (previous.emplace(next, front[pos]).second) { front.push_back(next); }
+		}
+	}
+	auto it = previous.find(colours.second);
+	if (it == previous.end()) {
+		throw std::runtime_error("No conversion from " + colours.first + " to " + colours.second);
+	}
+	std::vector<std::string> path;
+	for (std::string cur = colours.second; !cur.empty(); cur = previous.at(cur)) {
+		path.push_back(cur);
+	}
+	std::reverse(path.begin(), path.end());
+	return path;
+}
+
+im_ptr converser::run(col_pair colours, im_ptr& src, bool planar_out) {
+	std::vector<std::string> path = find_path(colours);
+	im_ptr dst = nullptr;
+	if (planar_out) {
+		cl_channel_type format = im_object::plane_format(env, src->format);
+		plane_set planes;
+		for (cl_mem& plane : planes) { plane = env->alloc_im(src->size, nullptr, CL_R, format); }
+		dst = std::make_shared<im_object>(src->size, env, planes, format);
+	}
+	else if (src->buffered) { dst = src->blank(src->size); }
+	else { dst = std::make_shared<im_object>(src->size, env, nullptr, src->format); }
+
+	/* Single-hop kernels read images only, buffer-backed sources always go through the generator */
+	if (path.size() > 2 || src->planar() || planar_out || src->buffered) {
+		cl_kernel kern = fuse(path, src->planar(), planar_out, src->buffered);
+		set_args(kern, src, dst);
+		run_blocking(kern, src->size, LAUNCH_PURE | LAUNCH_GUARDED);
+		return std::move(dst);
+	}
 
 	bool set_extra_args = false;
 	auto ycc_it = ycc_params.find(colours.first);
@@ -53,16 +103,81 @@ im_ptr converser::run(col_pair colours, im_ptr& src) {
 		colours.first = "ycbcr";
 	}
 	cl_kernel kern = kernels->at(colours.first + "_to_" + colours.second);
-	im_ptr dst = std::make_shared<im_object>(src->size, env);
 	set_args(kern, src, dst);
 	if (set_extra_args) { clSetKernelArg(kern, 3, sizeof(cl_float3), &ycc_it->second); }
-	run_blocking(kern, src->size);
+	run_blocking(kern, src->size, LAUNCH_PURE | LAUNCH_GUARDED);
 	return std::move(dst);
 }
 
+cl_kernel converser::fuse(const std::vector<std::string>& path, bool planar_in, bool planar_out, bool buffered) {
+	bool buffered_out = buffered && !planar_out;
+	std::string key;
+	for (const std::string& space : path) { key.append(key.empty() ? "" : "->").append(space); }
+	if (planar_in) { key.insert(0, "planes:"); }
+	if (buffered) { key.insert(0, "buffer:"); }
+	if (planar_out) { key.append(":planes"); }
+	std::lock_guard<std::mutex> guard(fusing);
+	auto cached = fused.find(key);
+	if (cached != fused.end()) { return cached->second.at("fused"); }
+
+	std::ostringstream src;
+	src << std::setprecision(9) << std::fixed;
+	src << "#include \"converser.cl\"\n\n";
+	src << "__kernel void fused(";
+	if (buffered) { src << "__global const float* src, int2 size, "; }
+	else {
+		src << (planar_in ? "__read_only image2d_t src_0, __read_only image2d_t src_1, __read_only image2d_t src_2"
+			: "__read_only image2d_t src") << ", sampler_t sampler, ";
+	}
+	src << (planar_out ? "__write_only image2d_t dst_0, __write_only image2d_t dst_1, __write_only image2d_t dst_2"
+		: buffered_out ? "__global float* dst" : "__write_only image2d_t dst") << ") {\n";
+	src << "\tint2 coord = (int2)(get_global_id(0), get_global_id(1));\n";
+	if (buffered) { src << "\tif (OUTSIDE_BUF(size, coord)) { return; }\n"; }
+	else { src << "\tif (OUTSIDE(" << (planar_out ? "dst_0" : "dst") << ", coord)) { return; }\n"; }
+	if (buffered) { src << "\tfloat4 val = load_px(src, size, coord);\n"; }
+	else if (planar_in) {
+		src << "\tfloat4 val = (float4)(read_imagef(src_0, sampler, coord).x, read_imagef(src_1, sampler, coord).x,"
+			" read_imagef(src_2, sampler, coord).x, 0.0f);\n";
+	}
+	else { src << "\tfloat4 val = read_imagef(src, sampler, coord);\n"; }
+	for (size_t hop = 1; hop < path.size(); ++hop) {
+		std::string from = path[hop - 1], to = path[hop], params;
+		auto ycc_it = ycc_params.find(from);
+		if (ycc_it != ycc_params.end()) { from = "ycbcr"; }
+		else if ((ycc_it = ycc_params.find(to)) != ycc_params.end()) { to = "ycbcr"; }
+		if (ycc_it != ycc_params.end()) {
+			const cl_float3& p = ycc_it->second;
+			std::ostringstream vec;
+			vec << std::setprecision(9) << std::fixed;
+			vec << ", (float3)(" << p.x << "f, " << p.y << "f, " << p.z << "f)";
+			params = vec.str();
+		}
+		src << "\tval = " << from << "_to_" << to << "_px(val" << params << ");\n";
+	}
+	if (planar_out) {
+		src << "\twrite_imagef(dst_0, coord, (float4)(val.x));\n";
+		src << "\twrite_imagef(dst_1, coord, (float4)(val.y));\n";
+		src << "\twrite_imagef(dst_2, coord, (float4)(val.z));\n}\n";
+	}
+	else if (buffered_out) { src << "\tstore_px(dst, size, coord, val);\n}\n"; }
+	else { src << "\twrite_imagef(dst, coord, val);\n}\n"; }
+
+	functions built = util::map_of({ "fused" });
+	built.program = env->build_program(src.str());
+	return fused.emplace(key, std::move(built)).first->second.at("fused");
+}
+
 void converser::set_args(cl_kernel kern, im_ptr& src, im_ptr& dst) {
 	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
-	clSetKernelArg(kern, 0, sizeof(cl_mem), &src->cl_storage);
-	clSetKernelArg(kern, 1, sizeof(cl_sampler), &sampler);
-	clSetKernelArg(kern, 2, sizeof(cl_mem), &dst->cl_storage);
-}
\ No newline at end of file
+	cl_uint arg = 0;
+	if (src->planar()) {
+		for (cl_mem& plane : src->planes) { clSetKernelArg(kern, arg++, sizeof(cl_mem), &plane); }
+	}
+	else { clSetKernelArg(kern, arg++, sizeof(cl_mem), &src->cl_storage); }
+	if (src->buffered) { clSetKernelArg(kern, arg++, sizeof(cl_int2), &src->size); }
+	else { clSetKernelArg(kern, arg++, sizeof(cl_sampler), &sampler); }
+	if (dst->planar()) {
+		for (cl_mem& plane : dst->planes) { clSetKernelArg(kern, arg++, sizeof(cl_mem), &plane); }
+	}
+	else { clSetKernelArg(kern, arg++, sizeof(cl_mem), &dst->cl_storage); }
+}
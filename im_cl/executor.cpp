@@ -9,21 +9,22 @@ cl_int executor::set_common_args(cl_kernel kern, cl_mem src, cl_sampler sampler,
 	return ret_code;
 }
 
-void executor::run_blocking(cl_kernel kern, cl_int2 size, cl_event* prev_event) {
-	size_t global_size[2] = { (size_t)size.x, (size_t)size.y };
-	cl_int ret_code = (prev_event == nullptr) ?
-		clEnqueueNDRangeKernel(env->queue, kern, 2, NULL, global_size, NULL, 0, NULL, NULL) :
-		clEnqueueNDRangeKernel(env->queue, kern, 2, NULL, global_size, NULL, 1, prev_event, NULL);
-	ret_code |= clFinish(env->queue);
+void executor::run_blocking(cl_kernel kern, cl_int2 size, int launch, cl_event* prev_event) {
+	cl_event kern_event = nullptr;
+	cl_int ret_code = env->enqueue_kernel(kern, size, launch, (prev_event == nullptr) ? 0 : 1, prev_event, env->log_slot(&kern_event));
+	ret_code |= clFinish(env->queue());
 	util::assert_success(ret_code, "Failed to enqueue blocking kernel execution");
+	if (kern_event != nullptr) {
+		env->log_event(kern_event, hardware::kernel_name(kern));
+		clReleaseEvent(kern_event);
+	}
 }
 
 
-cl_event executor::run_with_event(cl_kernel kern, cl_int2 size, cl_event* prev_event) {
-	size_t global_size[2] = { (size_t)size.x, (size_t)size.y }; cl_event next_event;
-	cl_int ret_code = (prev_event == nullptr) ?
-		clEnqueueNDRangeKernel(env->queue, kern, 2, NULL, global_size, NULL, 0, NULL, &next_event) :
-		clEnqueueNDRangeKernel(env->queue, kern, 2, NULL, global_size, NULL, 1, prev_event, &next_event);
+cl_event executor::run_with_event(cl_kernel kern, cl_int2 size, int launch, cl_event* prev_event) {
+	cl_event next_event;
+	cl_int ret_code = env->enqueue_kernel(kern, size, launch, (prev_event == nullptr) ? 0 : 1, prev_event, &next_event);
 	util::assert_success(ret_code, "Failed to enqueue async kernel execution");
+	env->log_event(next_event, hardware::kernel_name(kern));
 	return next_event;
 }
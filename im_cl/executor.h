@@ -13,11 +13,14 @@ struct executor {
 
 	cl_int set_common_args(cl_kernel kern, cl_mem src, cl_sampler sampler, cl_mem dst);
 
-	/* Run kernel and immediately call clFinish(). If prev_event != nullptr, waits for its finish before execution */
-	virtual void run_blocking(cl_kernel kern, cl_int2 size, cl_event* prev_event = nullptr);
+	/*
+	*  Run kernel and immediately call clFinish(). If prev_event != nullptr, waits for its finish before execution.
+	*  Launch is a set of LAUNCH_* flags telling whether kernel may be tuned and padded
+	*/
+	virtual void run_blocking(cl_kernel kern, cl_int2 size, int launch, cl_event* prev_event = nullptr);
 
 	/* Run kernel and immediately returns with created event. If prev_event != nullptr, waits for its finish before execution */
-	virtual cl_event run_with_event(cl_kernel kern, cl_int2 size, cl_event* prev_event = nullptr);
+	virtual cl_event run_with_event(cl_kernel kern, cl_int2 size, int launch, cl_event* prev_event = nullptr);
 
 	virtual ~executor() = default;
 };
\ No newline at end of file
@@ -1,24 +1,49 @@
+#include "bounds.cl"
+
+/* Variants built with -D CONV_RADIUS=<r> have constant loop bounds and unroll */
+#ifdef CONV_RADIUS
+#define RADIUS CONV_RADIUS
+#else
+#define RADIUS radius
+#endif
 
 __kernel void conv_2D(__read_only image2d_t src, sampler_t sampler,
 	__write_only image2d_t dst, int radius, __read_only image2d_t kern) {
-	int2 cd = (int2) (get_global_id(0), get_global_id(1));
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
 	float4 out_val = (float4)(0.0f);
-	for (int y = -radius; y <= radius; ++y) {
-		for (int x = -radius; x <= radius; ++x) {
+	for (int y = -RADIUS; y <= RADIUS; ++y) {
+		for (int x = -RADIUS; x <= RADIUS; ++x) {
 			float4 pix = read_imagef(src, sampler, (int2)(cd.x + x, cd.y + y));
-			out_val += pix * read_imagef(kern, sampler, (int2)(x + radius, y + radius)).w;
+			out_val += pix * read_imagef(kern, sampler, (int2)(x + RADIUS, y + RADIUS)).w;
 		}
 	}
 	write_imagef(dst, cd, fmax((float4)0.0f, fmin(1.0f, out_val)));
 }
 
+/* Buffer-backed images, weights row by row */
+__kernel void conv_2D_buf(__global const float* src, int2 size,
+	__global float* dst, int radius, __constant float* kern) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE_BUF(size, cd)) { return; }
+	float4 out_val = (float4)(0.0f);
+	for (int y = -RADIUS; y <= RADIUS; ++y) {
+		for (int x = -RADIUS; x <= RADIUS; ++x) {
+			float4 pix = load_px(src, size, (int2)(cd.x + x, cd.y + y));
+			out_val += pix * kern[(y + RADIUS) * (2 * RADIUS + 1) + x + RADIUS];
+		}
+	}
+	store_px(dst, size, cd, fmax((float4)0.0f, fmin(1.0f, out_val)));
+}
+
 __kernel void horizontal_conv(__read_only image2d_t src, sampler_t sampler,
 	__write_only image2d_t dst, int radius, __constant float* kern) {
 	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
 	float4 out_val = 0.0f;
-	for (int x = -radius; x <= radius; ++x) {
+	for (int x = -RADIUS; x <= RADIUS; ++x) {
 		float4 pix = read_imagef(src, sampler, (int2)(cd.x + x, cd.y));
-		out_val += pix * kern[x + radius];
+		out_val += pix * kern[x + RADIUS];
 	}
 	write_imagef(dst, cd, fmax((float4)0.0f, fmin(1.0f, out_val)));
 }
@@ -26,10 +51,218 @@ __kernel void horizontal_conv(__read_only image2d_t src, sampler_t sampler,
 __kernel void vertical_conv(__read_only image2d_t src, sampler_t sampler,
 	__write_only image2d_t dst, int radius, __constant float* kern) {
 	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
 	float4 out_val = 0.0f;
-	for (int y = -radius; y <= radius; ++y) {
+	for (int y = -RADIUS; y <= RADIUS; ++y) {
 		float4 pix = read_imagef(src, sampler, (int2)(cd.x, cd.y + y));
-		out_val += pix * kern[y + radius];
+		out_val += pix * kern[y + RADIUS];
+	}
+	write_imagef(dst, cd, fmax((float4)0.0f, fmin(1.0f, out_val)));
+}
+
+/*
+*	Median. 3x3 and 5x5 windows go through min/max exchange networks on all channels at once,
+*	larger ones through histograms of 8-bit codes
+*/
+#define EXCHANGE(a, b) { float4 low = fmin(a, b); b = fmax(a, b); a = low; }
+
+/* 19 exchanges, median ends up in p[4] */
+__kernel void median_3x3(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	float4 p[9];
+	for (int y = -1, i = 0; y <= 1; ++y) {
+		for (int x = -1; x <= 1; ++x, ++i) { p[i] = read_imagef(src, sampler, cd + (int2)(x, y)); }
+	}
+	EXCHANGE(p[1], p[2]); EXCHANGE(p[4], p[5]); EXCHANGE(p[7], p[8]);
+	EXCHANGE(p[0], p[1]); EXCHANGE(p[3], p[4]); EXCHANGE(p[6], p[7]);
+	EXCHANGE(p[1], p[2]); EXCHANGE(p[4], p[5]); EXCHANGE(p[7], p[8]);
+	EXCHANGE(p[0], p[3]); EXCHANGE(p[5], p[8]); EXCHANGE(p[4], p[7]);
+	EXCHANGE(p[3], p[6]); EXCHANGE(p[1], p[4]); EXCHANGE(p[2], p[5]);
+	EXCHANGE(p[4], p[7]); EXCHANGE(p[4], p[2]); EXCHANGE(p[6], p[4]);
+	EXCHANGE(p[4], p[2]);
+	write_imagef(dst, cd, p[4]);
+}
+
+/*
+*	Forgetful selection: keep 14 of 25 values, each round drops the minimum and maximum
+*	and takes the next value in, three candidates are left after all 25 were seen
+*/
+__kernel void median_5x5(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	float4 p[25];
+	for (int y = -2, i = 0; y <= 2; ++y) {
+		for (int x = -2; x <= 2; ++x, ++i) { p[i] = read_imagef(src, sampler, cd + (int2)(x, y)); }
+	}
+	int low = 0, high = 13;
+	for (int next = 14; next < 25; ++next, ++low) {
+		for (int i = low + 1; i <= high; ++i) { EXCHANGE(p[low], p[i]); }
+		for (int i = low + 1; i < high; ++i) { EXCHANGE(p[i], p[high]); }
+		p[high] = p[next];
+	}
+	EXCHANGE(p[low], p[low + 1]); EXCHANGE(p[low + 1], p[low + 2]); EXCHANGE(p[low], p[low + 1]);
+	write_imagef(dst, cd, p[low + 1]);
+}
+
+
+/*
+*	Perreault-Hebert constant-time median. One work-group of MEDIAN_BINS items scans a strip of output
+*	columns top to bottom. Column histograms of the strip (and radius columns at both sides) slide down
+*	by one row per step, the window histogram slides right by adding one column and dropping another,
+*	so the work per pixel does not depend on radius. Item b owns bin b of the window histogram,
+*	the median bin is found by a prefix sum across items.
+*	Layout of cols: [channel][column][bin]. Built with -D GLOBAL_HIST when they do not fit local memory,
+*	then every group takes its own slice of a global scratch buffer
+*/
+#define MEDIAN_BINS 256
+
+#ifdef GLOBAL_HIST
+#define HIST __global
+#else
+#define HIST __local
+#endif
+
+void count_px(HIST ushort* cols, int span, int col, float4 val, int delta) {
+	int3 bin = clamp(convert_int3(rint(val.xyz * 255.0f)), 0, MEDIAN_BINS - 1);
+	cols[col * MEDIAN_BINS + bin.x] += delta;
+	cols[(span + col) * MEDIAN_BINS + bin.y] += delta;
+	cols[(2 * span + col) * MEDIAN_BINS + bin.z] += delta;
+}
+
+uint3 col_bin(HIST ushort* cols, int span, int col, int bin) {
+	return (uint3)(cols[col * MEDIAN_BINS + bin], cols[(span + col) * MEDIAN_BINS + bin],
+		cols[(2 * span + col) * MEDIAN_BINS + bin]);
+}
+
+__kernel void median_hist(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst,
+	int radius, int strip, HIST ushort* cols, __local uint* prefix, __local float* medians) {
+	int bin = get_local_id(0);
+	int x0 = get_group_id(0) * strip, span = strip + 2 * radius;
+	int2 size = get_image_dim(dst);
+	uint need = (uint)((2 * radius + 1) * (2 * radius + 1) / 2 + 1);
+#ifdef GLOBAL_HIST
+	cols += (size_t)get_group_id(0) * 3 * span * MEDIAN_BINS;
+#endif
+	for (int i = bin; i < 3 * span * MEDIAN_BINS; i += MEDIAN_BINS) { cols[i] = 0; }
+	barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+	for (int col = bin; col < span; col += MEDIAN_BINS) {
+		for (int y = -radius; y <= radius; ++y) {
+			count_px(cols, span, col, read_imagef(src, sampler, (int2)(x0 - radius + col, y)), 1);
+		}
+	}
+
+	for (int y = 0; y < size.y; ++y) {
+		/* Column histograms cover rows [y - radius, y + radius] */
+		for (int col = bin; col < span && y > 0; col += MEDIAN_BINS) {
+			int x = x0 - radius + col;
+			count_px(cols, span, col, read_imagef(src, sampler, (int2)(x, y - radius - 1)), -1);
+			count_px(cols, span, col, read_imagef(src, sampler, (int2)(x, y + radius)), 1);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+
+		uint3 window = (uint3)(0);
+		for (int col = 0; col <= 2 * radius; ++col) { window += col_bin(cols, span, col, bin); }
+		for (int x = 0; x < strip && x0 + x < size.x; ++x) {
+			if (x > 0) { window += col_bin(cols, span, x + 2 * radius, bin) - col_bin(cols, span, x - 1, bin); }
+			prefix[bin] = window.x;
+			prefix[MEDIAN_BINS + bin] = window.y;
+			prefix[2 * MEDIAN_BINS + bin] = window.z;
+			barrier(CLK_LOCAL_MEM_FENCE);
+			for (int off = 1; off < MEDIAN_BINS; off <<= 1) {
+				uint3 add = (uint3)(0);
+				if (bin >= off) {
+					add = (uint3)(prefix[bin - off], prefix[MEDIAN_BINS + bin - off], prefix[2 * MEDIAN_BINS + bin - off]);
+				}
+				barrier(CLK_LOCAL_MEM_FENCE);
+				prefix[bin] += add.x;
+				prefix[MEDIAN_BINS + bin] += add.y;
+				prefix[2 * MEDIAN_BINS + bin] += add.z;
+				barrier(CLK_LOCAL_MEM_FENCE);
+			}
+			uint3 upto = (uint3)(prefix[bin], prefix[MEDIAN_BINS + bin], prefix[2 * MEDIAN_BINS + bin]);
+			uint3 before = upto - window;
+			if (upto.x >= need && before.x < need) { medians[0] = bin / 255.0f; }
+			if (upto.y >= need && before.y < need) { medians[1] = bin / 255.0f; }
+			if (upto.z >= need && before.z < need) { medians[2] = bin / 255.0f; }
+			barrier(CLK_LOCAL_MEM_FENCE);
+			if (bin == 0) {
+				int2 cd = (int2)(x0 + x, y);
+				float alpha = read_imagef(src, sampler, cd).w;
+				write_imagef(dst, cd, (float4)(medians[0], medians[1], medians[2], alpha));
+			}
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+	}
+}
+
+
+/*
+*	Bilateral. Every work-group caches its tile with radius apron in local memory,
+*	spatial weights come as a separable table of 2 * radius + 1 entries,
+*	range weights as RANGE_STEPS entries over squared colour distance [0, 3]
+*/
+#define RANGE_STEPS 1024
+#define RANGE_SCALE ((RANGE_STEPS - 1) / 3.0f)
+
+__kernel void bilateral(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst,
+	int radius, __constant float* spatial, __constant float* range, __local float4* tile) {
+	int2 lid = (int2)(get_local_id(0), get_local_id(1));
+	int2 group = (int2)(get_local_size(0), get_local_size(1));
+	int2 origin = (int2)(get_group_id(0), get_group_id(1)) * group - RADIUS;
+	int2 tile_size = group + 2 * RADIUS;
+	for (int ty = lid.y; ty < tile_size.y; ty += group.y) {
+		for (int tx = lid.x; tx < tile_size.x; tx += group.x) {
+			tile[ty * tile_size.x + tx] = read_imagef(src, sampler, origin + (int2)(tx, ty));
+		}
 	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	__local float4* centre_row = tile + (lid.y + RADIUS) * tile_size.x + lid.x + RADIUS;
+	float4 centre = *centre_row;
+	float4 sum = (float4)(0.0f);
+	float norm = 0.0f;
+	for (int y = -RADIUS; y <= RADIUS; ++y) {
+		__local float4* row = centre_row + y * tile_size.x;
+		for (int x = -RADIUS; x <= RADIUS; ++x) {
+			float4 pix = row[x];
+			float3 diff = pix.xyz - centre.xyz;
+			int bin = min((int)(dot(diff, diff) * RANGE_SCALE), RANGE_STEPS - 1);
+			float weight = spatial[x + RADIUS] * spatial[y + RADIUS] * range[bin];
+			sum += pix * weight;
+			norm += weight;
+		}
+	}
+	write_imagef(dst, cd, fmax((float4)0.0f, fmin(1.0f, sum / norm)));
+}
+
+
+/*
+*	Guided filter, image guides itself channel by channel.
+*	Box means come from summed-area tables of integrator.cl, cost per pixel does not depend on radius
+*/
+
+/* mean, mean of squares -> a = var / (var + eps), b = mean - a * mean */
+__kernel void guided_coeffs(__read_only image2d_t mean, __read_only image2d_t mean_sq, sampler_t sampler,
+	__write_only image2d_t dst_a, __write_only image2d_t dst_b, float eps) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst_a, cd)) { return; }
+	float4 m = read_imagef(mean, sampler, cd);
+	float4 var = fmax(read_imagef(mean_sq, sampler, cd) - m * m, 0.0f);
+	float4 a = var / (var + eps);
+	write_imagef(dst_a, cd, a);
+	write_imagef(dst_b, cd, m - a * m);
+}
+
+__kernel void guided_apply(__read_only image2d_t src, __read_only image2d_t mean_a, __read_only image2d_t mean_b,
+	sampler_t sampler, __write_only image2d_t dst) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	float4 in_val = read_imagef(src, sampler, cd);
+	float4 out_val = read_imagef(mean_a, sampler, cd) * in_val + read_imagef(mean_b, sampler, cd);
+	out_val.w = in_val.w;
 	write_imagef(dst, cd, fmax((float4)0.0f, fmin(1.0f, out_val)));
-}
\ No newline at end of file
+}
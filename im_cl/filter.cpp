@@ -1,31 +1,226 @@
 #include"im_executors.h"
+#include<algorithm>
+
+/* Larger windows keep the generic kernel, unrolling them only bloats code */
+#define SPECIALISED_RADIUS 15
+
+/* Work-group of median_hist, one item per bin of 8-bit codes, must match filter.cl */
+#define MEDIAN_BINS 256
+
+/* Output columns per median_hist group; narrower strips waste time on the side columns */
+#define MEDIAN_STRIP 64
+#define MEDIAN_MIN_STRIP 16
+
+/* Range weights of bilateral over squared colour distance [0, 3], must match filter.cl */
+#define RANGE_STEPS 1024
 
 filter::filter(hardware* env, functions* filters) : executor(env, filters) {}
 
-im_ptr filter::gauss(float sigma, int lin_size, im_ptr& src) {
+im_ptr filter::gauss(float sigma, int lin_size, im_ptr& src, const std::string& mode) {
 	float divisor = -2.0f * sigma * sigma;
 	float pi_div = 2.0f * sigma * sigma * CL_M_PI;
 	cl_int radius = (lin_size - 1) / 2;
-	float* conv_kern = new float[lin_size * lin_size];
+	std::vector<float> conv_kern(lin_size * lin_size);
 	for (int y = -radius, p = 0; y <= radius; ++y) {
 		for (int x = -radius; x <= radius; ++x, ++p) {
 			conv_kern[p] = expf((x * x + y * y) / divisor) / pi_div;
 		}
 	}
-	cl_mem im_kernel = env->alloc_im({ lin_size, lin_size }, conv_kern, CL_A);
-	im_ptr result = convolve(im_kernel, src, radius);
-	clReleaseMemObject(im_kernel);
-	delete[] conv_kern;
+	return convolve(conv_kern, { lin_size, lin_size }, src, mode);
+}
+
+im_ptr filter::convolve(const std::vector<float>& weights, cl_int2 kern_size, im_ptr& src, const std::string& mode) {
+	if (kern_size.x < 1 || kern_size.y < 1 || weights.size() != static_cast<size_t>(kern_size.x) * kern_size.y) {
+		throw std::runtime_error("Kernel size does not match number of weights");
+	}
+	if (mode != "auto" && mode != "spatial" && mode != "fft") { throw std::runtime_error("Unknown convolution mode: " + mode); }
+	/* Spatial path takes odd square windows, smaller kernels are padded with zeros */
+	cl_int side = std::max(kern_size.x, kern_size.y) | 1;
+	double spatial_cost = static_cast<double>(src->size.x) * src->size.y * side * side;
+	bool use_fft = (mode == "fft") ||
+		(mode == "auto" && spectral != nullptr && fourier::cost(src->size, kern_size) < spatial_cost);
+	if (use_fft) {
+		if (spectral == nullptr) { throw std::runtime_error("FFT convolution is not available"); }
+		return spectral->convolve(src, weights, kern_size);
+	}
+
+	std::vector<float> square(side * side, 0.0f);
+	cl_int2 shift = { side / 2 - kern_size.x / 2, side / 2 - kern_size.y / 2 };
+	for (int y = 0; y < kern_size.y; ++y) {
+		for (int x = 0; x < kern_size.x; ++x) { square[(y + shift.y) * side + x + shift.x] = weights[y * kern_size.x + x]; }
+	}
+	cl_mem conv_kern = src->buffered ?
+		env->alloc_buf(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * square.size(), square.data()) :
+		env->alloc_im({ side, side }, square.data(), CL_A);
+	im_ptr result = spatial_convolve(conv_kern, src, side / 2);
+	clReleaseMemObject(conv_kern);
+	return std::move(result);
+}
+
+im_ptr filter::spatial_convolve(cl_mem conv_kern, im_ptr& src, cl_int radius) {
+	std::string name = src->buffered ? "conv_2D_buf" : "conv_2D";
+	cl_kernel kern = (radius <= SPECIALISED_RADIUS) ?
+		kernels->at(name, util::defines({ { "CONV_RADIUS", radius } })) : kernels->at(name);
+	im_ptr result = src->blank(src->size);
+	cl_int ret_code = CL_SUCCESS;
+	if (src->buffered) {
+		ret_code |= clSetKernelArg(kern, 0, sizeof(cl_mem), &src->cl_storage);
+		ret_code |= clSetKernelArg(kern, 1, sizeof(cl_int2), &src->size);
+		ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &result->cl_storage);
+	}
+	else {
+		cl_sampler sampler = env->samplers.at({ CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST });
+		ret_code |= set_common_args(kern, src->cl_storage, sampler, result->cl_storage);
+	}
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int), &radius);
+	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_mem), &conv_kern);
+	run_blocking(kern, src->size, LAUNCH_PURE | LAUNCH_GUARDED);
 	return std::move(result);
 }
 
-im_ptr filter::convolve(cl_mem conv_kern, im_ptr& src, cl_int radius) {
-	cl_kernel kern = kernels->at("conv_2D");
-	im_ptr result = std::make_shared<im_object>(src->size, env);
+im_ptr filter::median(int radius, im_ptr& src) {
+	if (radius < 1) { throw std::runtime_error("Median radius must be positive"); }
+	src->make_image();
+	im_ptr result = src->blank(src->size);
 	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST });
+	if (radius <= 2) {
+		cl_kernel kern = kernels->at((radius == 1) ? "median_3x3" : "median_5x5");
+		cl_int ret_code = set_common_args(kern, src->cl_storage, sampler, result->cl_storage);
+		util::assert_success(ret_code, "Failed to set median args");
+		run_blocking(kern, src->size, LAUNCH_PURE | LAUNCH_GUARDED);
+		return std::move(result);
+	}
+
+	/* Column histograms go to local memory if a strip of reasonable width fits there */
+	size_t col_bytes = 3 * MEDIAN_BINS * sizeof(cl_ushort);
+	size_t scan_bytes = 3 * MEDIAN_BINS * sizeof(cl_uint) + 3 * sizeof(cl_float);
+	size_t local_mem = hardware::device_param<cl_ulong>(env->cur_device, CL_DEVICE_LOCAL_MEM_SIZE);
+	int strip = (local_mem > scan_bytes) ? static_cast<int>((local_mem - scan_bytes) / col_bytes) - 2 * radius : 0;
+	bool in_local = strip >= MEDIAN_MIN_STRIP;
+	strip = in_local ? std::min(strip, MEDIAN_STRIP) : std::max(MEDIAN_STRIP, 2 * radius);
+	strip = std::min(strip, static_cast<int>(src->size.x));
+	size_t groups = (src->size.x + strip - 1) / strip;
+	size_t span = strip + 2 * radius;
+
+	cl_kernel kern = in_local ? kernels->at("median_hist") :
+		kernels->at("median_hist", util::defines({ { "GLOBAL_HIST", 1 } }));
+	size_t kern_max = 0;
+	clGetKernelWorkGroupInfo(kern, env->cur_device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kern_max, NULL);
+	if (kern_max < MEDIAN_BINS) { throw std::runtime_error("Device can't run median work-groups, use radius 1 or 2"); }
+	cl_mem scratch = in_local ? nullptr : env->alloc_buf(CL_MEM_READ_WRITE, groups * span * col_bytes, nullptr);
+
 	cl_int ret_code = set_common_args(kern, src->cl_storage, sampler, result->cl_storage);
 	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int), &radius);
-	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_mem), &conv_kern);
-	run_blocking(kern, src->size);
+	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_int), &strip);
+	if (in_local) { ret_code |= clSetKernelArg(kern, 5, span * col_bytes, NULL); }
+	else { ret_code |= clSetKernelArg(kern, 5, sizeof(cl_mem), &scratch); }
+	ret_code |= clSetKernelArg(kern, 6, 3 * MEDIAN_BINS * sizeof(cl_uint), NULL);
+	ret_code |= clSetKernelArg(kern, 7, 3 * sizeof(cl_float), NULL);
+	util::assert_success(ret_code, "Failed to set median args");
+
+	size_t global_size[2] = { groups * MEDIAN_BINS, 1 }, local_size[2] = { MEDIAN_BINS, 1 };
+	cl_event kern_event = nullptr;
+	ret_code = clEnqueueNDRangeKernel(env->queue(), kern, 2, NULL, global_size, local_size,
+		0, NULL, env->log_slot(&kern_event));
+	ret_code |= clFinish(env->queue());
+	if (scratch != nullptr) { clReleaseMemObject(scratch); }
+	util::assert_success(ret_code, "Failed to run median");
+	if (kern_event != nullptr) {
+		env->log_event(kern_event, "median_hist");
+		clReleaseEvent(kern_event);
+	}
+	return std::move(result);
+}
+
+im_ptr filter::bilateral(int radius, float sigma_s, float sigma_r, im_ptr& src) {
+	if (radius < 1) { throw std::runtime_error("Bilateral radius must be positive"); }
+	if (sigma_s <= 0.0f || sigma_r <= 0.0f) { throw std::runtime_error("Bilateral sigmas must be positive"); }
+	src->make_image();
+	std::vector<float> spatial(2 * radius + 1), range(RANGE_STEPS);
+	for (int x = -radius; x <= radius; ++x) { spatial[x + radius] = expf(-(x * x) / (2.0f * sigma_s * sigma_s)); }
+	for (int bin = 0; bin < RANGE_STEPS; ++bin) {
+		float dist_sq = bin * 3.0f / (RANGE_STEPS - 1);
+		range[bin] = expf(-dist_sq / (2.0f * sigma_r * sigma_r));
+	}
+
+	cl_kernel kern = (radius <= SPECIALISED_RADIUS) ?
+		kernels->at("bilateral", util::defines({ { "CONV_RADIUS", radius } })) : kernels->at("bilateral");
+	size_t kern_max = 0;
+	clGetKernelWorkGroupInfo(kern, env->cur_device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kern_max, NULL);
+	size_t side = (kern_max >= 256) ? 16 : 8;
+	size_t tile_bytes = (side + 2 * radius) * (side + 2 * radius) * sizeof(cl_float4);
+	if (tile_bytes > hardware::device_param<cl_ulong>(env->cur_device, CL_DEVICE_LOCAL_MEM_SIZE)) {
+		throw std::runtime_error("Bilateral radius too large for local memory of device");
+	}
+
+	cl_mem spatial_buf = env->alloc_buf(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * spatial.size(), spatial.data());
+	cl_mem range_buf = env->alloc_buf(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * range.size(), range.data());
+	im_ptr result = src->blank(src->size);
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST });
+	cl_int ret_code = set_common_args(kern, src->cl_storage, sampler, result->cl_storage);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int), &radius);
+	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_mem), &spatial_buf);
+	ret_code |= clSetKernelArg(kern, 5, sizeof(cl_mem), &range_buf);
+	ret_code |= clSetKernelArg(kern, 6, tile_bytes, NULL);
+	util::assert_success(ret_code, "Failed to set bilateral args");
+
+	size_t global_size[2] = { (src->size.x + side - 1) / side * side, (src->size.y + side - 1) / side * side };
+	size_t local_size[2] = { side, side };
+	cl_event kern_event = nullptr;
+	ret_code = clEnqueueNDRangeKernel(env->queue(), kern, 2, NULL, global_size, local_size,
+		0, NULL, env->log_slot(&kern_event));
+	ret_code |= clFinish(env->queue());
+	clReleaseMemObject(spatial_buf); clReleaseMemObject(range_buf);
+	util::assert_success(ret_code, "Failed to run bilateral");
+	if (kern_event != nullptr) {
+		env->log_event(kern_event, "bilateral");
+		clReleaseEvent(kern_event);
+	}
+	return std::move(result);
+}
+
+void filter::box_means(cl_mem src_a, cl_mem src_b, bool square_b, cl_mem dst_a, cl_mem dst_b, cl_int2 size, int radius) {
+	if (integral == nullptr) { throw std::runtime_error("Summed-area tables are not available"); }
+	cl_int2 window = { radius, radius };
+	cl_mem table = integral->build(src_a, size, false);
+	integral->box_mean(table, window, dst_a, size);
+	clReleaseMemObject(table);
+	table = integral->build(square_b ? src_a : src_b, size, square_b);
+	integral->box_mean(table, window, dst_b, size);
+	clReleaseMemObject(table);
+}
+
+im_ptr filter::guided(int radius, float eps, im_ptr& src) {
+	if (radius < 1) { throw std::runtime_error("Guided filter radius must be positive"); }
+	if (eps <= 0.0f) { throw std::runtime_error("Guided filter epsilon must be positive"); }
+	src->make_image();
+	cl_int2 size = src->size;
+	cl_mem mean = env->alloc_im(size), mean_sq = env->alloc_im(size);
+	cl_mem coeff_a = env->alloc_im(size), coeff_b = env->alloc_im(size);
+	box_means(src->cl_storage, nullptr, true, mean, mean_sq, size, radius);
+
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
+	cl_kernel coeffs = kernels->at("guided_coeffs");
+	cl_int ret_code = clSetKernelArg(coeffs, 0, sizeof(cl_mem), &mean);
+	ret_code |= clSetKernelArg(coeffs, 1, sizeof(cl_mem), &mean_sq);
+	ret_code |= clSetKernelArg(coeffs, 2, sizeof(cl_sampler), &sampler);
+	ret_code |= clSetKernelArg(coeffs, 3, sizeof(cl_mem), &coeff_a);
+	ret_code |= clSetKernelArg(coeffs, 4, sizeof(cl_mem), &coeff_b);
+	ret_code |= clSetKernelArg(coeffs, 5, sizeof(cl_float), &eps);
+	util::assert_success(ret_code, "Failed to set guided filter args");
+	run_blocking(coeffs, size, LAUNCH_PURE | LAUNCH_GUARDED);
+
+	/* Means of coefficients reuse the buffers of the first means */
+	box_means(coeff_a, coeff_b, false, mean, mean_sq, size, radius);
+	im_ptr result = src->blank(size);
+	cl_kernel apply = kernels->at("guided_apply");
+	ret_code = clSetKernelArg(apply, 0, sizeof(cl_mem), &src->cl_storage);
+	ret_code |= clSetKernelArg(apply, 1, sizeof(cl_mem), &mean);
+	ret_code |= clSetKernelArg(apply, 2, sizeof(cl_mem), &mean_sq);
+	ret_code |= clSetKernelArg(apply, 3, sizeof(cl_sampler), &sampler);
+	ret_code |= clSetKernelArg(apply, 4, sizeof(cl_mem), &result->cl_storage);
+	util::assert_success(ret_code, "Failed to set guided filter args");
+	run_blocking(apply, size, LAUNCH_PURE | LAUNCH_GUARDED);
+	for (cl_mem temp : { mean, mean_sq, coeff_a, coeff_b }) { clReleaseMemObject(temp); }
 	return std::move(result);
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include "bounds.cl"
+
+/*
+*	Spectra are two complex planes of padded.x * padded.y, rows after rows:
+*	plane 0 holds red + i * green, plane 1 blue + i * alpha. Filters real in space keep
+*	both halves apart, so two real channels share one complex transform
+*/
+
+/*
+*	Image goes to the top-left corner. Right and bottom padding replicates the nearest edge
+*	for its first half and the opposite edge for the second one, wrapped convolution sees a clamped border
+*/
+__kernel void pack_planes(__read_only image2d_t src, sampler_t sampler, __global float2* dst, int2 padded) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE_BUF(padded, cd)) { return; }
+	int2 size = get_image_dim(src);
+	int2 from = cd;
+	if (cd.x >= size.x + (padded.x - size.x) / 2) { from.x = cd.x - padded.x; }
+	if (cd.y >= size.y + (padded.y - size.y) / 2) { from.y = cd.y - padded.y; }
+	float4 val = read_imagef(src, sampler, from);
+	int index = cd.x + padded.x * cd.y;
+	dst[index] = val.xy;
+	dst[padded.x * padded.y + index] = val.zw;
+}
+
+__kernel void unpack_planes(__global const float2* src, int2 padded, __write_only image2d_t dst, float scale) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	int index = cd.x + padded.x * cd.y;
+	float4 val = (float4)(src[index], src[padded.x * padded.y + index]) * scale;
+	write_imagef(dst, cd, fmax((float4)0.0f, fmin(1.0f, val)));
+}
+
+/*
+*	One radix-2 Stockham pass, p = 1, 2 ... n / 2 in turn, result in natural order after log2(n) passes.
+*	Rows: global size (n / 2, lines), columns: (lines, n / 2) so neighbour items touch neighbour columns.
+*	sign -1 for forward transform, 1 for inverse (unscaled)
+*/
+__kernel void fft_pass(__global const float2* src, __global float2* dst, int2 padded, int p, int vertical, float sign) {
+	int i = get_global_id(vertical ? 1 : 0), line = get_global_id(vertical ? 0 : 1);
+	int half_n = (vertical ? padded.y : padded.x) / 2;
+	int base = vertical ? (line / padded.x) * padded.x * padded.y + line % padded.x : line * padded.x;
+	int stride = vertical ? padded.x : 1;
+	int k = i & (p - 1);
+	float2 u0 = src[base + i * stride], u1 = src[base + (i + half_n) * stride];
+	float cos_val, sin_val = sincos(sign * M_PI_F * k / p, &cos_val);
+	u1 = (float2)(u1.x * cos_val - u1.y * sin_val, u1.x * sin_val + u1.y * cos_val);
+	int out = (i << 1) - k;
+	dst[base + out * stride] = u0 + u1;
+	dst[base + (out + p) * stride] = u0 - u1;
+}
+
+/* Signed offset of a padded coordinate, upper halves wrap to negatives */
+int2 wrapped(int2 cd, int2 padded) {
+	return select(cd, cd - padded, cd >= padded / 2);
+}
+
+/*
+*	Weights wrapped around the origin and mirrored, so the product of spectra gives
+*	the same correlation sum as conv_2D: out(x) = sum of src(x + t) * weights(centre + t)
+*/
+__kernel void wrap_kernel(__global const float* weights, int2 kern_size, __global float2* dst, int2 padded) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE_BUF(padded, cd)) { return; }
+	int2 from = kern_size / 2 - wrapped(cd, padded);
+	bool inside = from.x >= 0 && from.y >= 0 && from.x < kern_size.x && from.y < kern_size.y;
+	float weight = inside ? weights[from.x + kern_size.x * from.y] : 0.0f;
+	dst[cd.x + padded.x * cd.y] = (float2)(weight, 0.0f);
+}
+
+/* Both planes times single-plane filter spectrum, out of place so relaunches give the same result */
+__kernel void multiply_spectra(__global const float2* src, __global const float2* filter, __global float2* dst, int2 padded) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE_BUF(padded, cd)) { return; }
+	int index = cd.x + padded.x * cd.y;
+	float2 f = filter[index];
+	for (int plane = 0; plane < 2; ++plane) {
+		float2 d = src[plane * padded.x * padded.y + index];
+		dst[plane * padded.x * padded.y + index] = (float2)(d.x * f.x - d.y * f.y, d.x * f.y + d.y * f.x);
+	}
+}
+
+/* Gaussian notch reject at +-centres (cycles per pixel), symmetric real mask keeps packed channels apart */
+__kernel void notch_mask(__global const float2* src, __global float2* dst, int2 padded, __constant float2* centres, int count, float width) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE_BUF(padded, cd)) { return; }
+	float2 freq = convert_float2(wrapped(cd, padded)) / convert_float2(padded);
+	float gain = 1.0f;
+	for (int c = 0; c < count; ++c) {
+		float2 pos = freq - centres[c], neg = freq + centres[c];
+		gain *= (1.0f - exp(-dot(pos, pos) / (2.0f * width * width))) * (1.0f - exp(-dot(neg, neg) / (2.0f * width * width)));
+	}
+	int index = cd.x + padded.x * cd.y;
+	dst[index] = src[index] * gain;
+	dst[padded.x * padded.y + index] = src[padded.x * padded.y + index] * gain;
+}
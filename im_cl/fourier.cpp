@@ -0,0 +1,135 @@
+#include"im_executors.h"
+#include<cmath>
+
+/* Padding around images for notch filtering, keeps wrapped edges from ringing into the picture */
+#define NOTCH_MARGIN 16
+
+/* Spatial taps worth one butterfly: global memory round trip against a cached texture read */
+#define FFT_BUTTERFLY_COST 8.0
+
+fourier::fourier(hardware* env, functions* kernels) : executor(env, kernels) {}
+
+cl_int2 fourier::padded_size(cl_int2 size, cl_int2 margin) {
+	cl_int2 padded = { 1, 1 };
+	while (padded.x < size.x + 2 * margin.x) { padded.x <<= 1; }
+	while (padded.y < size.y + 2 * margin.y) { padded.y <<= 1; }
+	return padded;
+}
+
+size_t fourier::plane_bytes(cl_int2 padded) { return sizeof(cl_float2) * padded.x * padded.y; }
+
+void fourier::transform(cl_mem& data, cl_mem& temp, cl_int2 padded, int planes, float sign) {
+	cl_kernel kern = kernels->at("fft_pass");
+	for (cl_int vertical = 0; vertical < 2; ++vertical) {
+		cl_int length = vertical ? padded.y : padded.x;
+		cl_int lines = vertical ? padded.x * planes : padded.y * planes;
+		cl_int2 global = vertical ? cl_int2{ lines, length / 2 } : cl_int2{ length / 2, lines };
+		for (cl_int p = 1; p < length; p <<= 1) {
+			cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &data);
+			ret_code |= clSetKernelArg(kern, 1, sizeof(cl_mem), &temp);
+			ret_code |= clSetKernelArg(kern, 2, sizeof(cl_int2), &padded);
+			ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int), &p);
+			ret_code |= clSetKernelArg(kern, 4, sizeof(cl_int), &vertical);
+			ret_code |= clSetKernelArg(kern, 5, sizeof(cl_float), &sign);
+			util::assert_success(ret_code, "Failed to set FFT args");
+			run_blocking(kern, global, LAUNCH_PURE);
+			std::swap(data, temp);
+		}
+	}
+}
+
+cl_mem fourier::forward(im_ptr& src, cl_int2 padded) {
+	src->make_image();
+	cl_mem data = env->alloc_buf(CL_MEM_READ_WRITE, 2 * plane_bytes(padded), nullptr);
+	cl_mem temp = env->alloc_buf(CL_MEM_READ_WRITE, 2 * plane_bytes(padded), nullptr);
+	cl_kernel kern = kernels->at("pack_planes");
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST });
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &src->cl_storage);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_sampler), &sampler);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &data);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int2), &padded);
+	util::assert_success(ret_code, "Failed to set FFT packing args");
+	run_blocking(kern, padded, LAUNCH_PURE | LAUNCH_GUARDED);
+	transform(data, temp, padded, 2, -1.0f);
+	clReleaseMemObject(temp);
+	return data;
+}
+
+im_ptr fourier::inverse(cl_mem spectrum, cl_int2 padded, im_ptr& like) {
+	cl_mem temp = env->alloc_buf(CL_MEM_READ_WRITE, 2 * plane_bytes(padded), nullptr);
+	transform(spectrum, temp, padded, 2, 1.0f);
+	im_ptr result = like->blank(like->size);
+	cl_kernel kern = kernels->at("unpack_planes");
+	cl_float scale = 1.0f / (static_cast<float>(padded.x) * padded.y);
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &spectrum);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_int2), &padded);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &result->cl_storage);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_float), &scale);
+	util::assert_success(ret_code, "Failed to set FFT unpacking args");
+	run_blocking(kern, like->size, LAUNCH_PURE | LAUNCH_GUARDED);
+	/* Passes ping-pong, spectrum may now name the scratch buffer */
+	clReleaseMemObject(spectrum); clReleaseMemObject(temp);
+	return std::move(result);
+}
+
+im_ptr fourier::convolve(im_ptr& src, const std::vector<float>& weights, cl_int2 kern_size) {
+	if (weights.size() != static_cast<size_t>(kern_size.x) * kern_size.y) {
+		throw std::runtime_error("Kernel size does not match number of weights");
+	}
+	cl_int2 padded = padded_size(src->size, { kern_size.x / 2 + 1, kern_size.y / 2 + 1 });
+	cl_mem spectrum = forward(src, padded);
+
+	cl_mem weight_buf = env->alloc_buf(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		sizeof(float) * weights.size(), const_cast<float*>(weights.data()));
+	cl_mem filter = env->alloc_buf(CL_MEM_READ_WRITE, plane_bytes(padded), nullptr);
+	cl_mem temp = env->alloc_buf(CL_MEM_READ_WRITE, plane_bytes(padded), nullptr);
+	cl_kernel kern = kernels->at("wrap_kernel");
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &weight_buf);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_int2), &kern_size);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &filter);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int2), &padded);
+	util::assert_success(ret_code, "Failed to set kernel wrapping args");
+	run_blocking(kern, padded, LAUNCH_PURE | LAUNCH_GUARDED);
+	transform(filter, temp, padded, 1, -1.0f);
+	clReleaseMemObject(weight_buf); clReleaseMemObject(temp);
+
+	cl_mem product = env->alloc_buf(CL_MEM_READ_WRITE, 2 * plane_bytes(padded), nullptr);
+	kern = kernels->at("multiply_spectra");
+	ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &spectrum);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_mem), &filter);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &product);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int2), &padded);
+	util::assert_success(ret_code, "Failed to set spectrum product args");
+	run_blocking(kern, padded, LAUNCH_PURE | LAUNCH_GUARDED);
+	clReleaseMemObject(filter); clReleaseMemObject(spectrum);
+	return inverse(product, padded, src);
+}
+
+im_ptr fourier::notch(im_ptr& src, const std::vector<cl_float2>& centres, float width) {
+	if (centres.empty()) { throw std::runtime_error("No frequencies to remove"); }
+	if (width <= 0.0f) { throw std::runtime_error("Notch width must be positive"); }
+	cl_int2 padded = padded_size(src->size, { NOTCH_MARGIN, NOTCH_MARGIN });
+	cl_mem spectrum = forward(src, padded);
+	cl_mem centre_buf = env->alloc_buf(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		sizeof(cl_float2) * centres.size(), const_cast<cl_float2*>(centres.data()));
+	cl_int count = static_cast<cl_int>(centres.size());
+	cl_mem masked = env->alloc_buf(CL_MEM_READ_WRITE, 2 * plane_bytes(padded), nullptr);
+	cl_kernel kern = kernels->at("notch_mask");
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &spectrum);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_mem), &masked);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_int2), &padded);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_mem), &centre_buf);
+	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_int), &count);
+	ret_code |= clSetKernelArg(kern, 5, sizeof(cl_float), &width);
+	util::assert_success(ret_code, "Failed to set notch args");
+	run_blocking(kern, padded, LAUNCH_PURE | LAUNCH_GUARDED);
+	clReleaseMemObject(centre_buf); clReleaseMemObject(spectrum);
+	return inverse(masked, padded, src);
+}
+
+double fourier::cost(cl_int2 size, cl_int2 kern_size) {
+	cl_int2 padded = padded_size(size, { kern_size.x / 2 + 1, kern_size.y / 2 + 1 });
+	double points = static_cast<double>(padded.x) * padded.y;
+	/* Two image planes forth and back, one kernel plane forth: five transforms of points / 2 butterflies per pass */
+	return FFT_BUTTERFLY_COST * 5.0 * points / 2.0 * std::log2(points);
+}
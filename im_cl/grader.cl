@@ -0,0 +1,70 @@
+#include "bounds.cl"
+
+/*
+*	3D LUT: x - red, y - green, z - blue, lattice of size^3 nodes
+*/
+
+float3 lut_coord(float4 in_val, float4 domain_min, float4 domain_max, int size) {
+	float3 norm = (in_val.xyz - domain_min.xyz) / (domain_max.xyz - domain_min.xyz);
+	return clamp(norm, 0.0f, 1.0f) * (float)(size - 1);
+}
+
+/* Linear sampler, unnormalised coordinates point to texel centres */
+__kernel void trilinear(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst,
+	__read_only image3d_t lut, sampler_t lut_sampler, float4 domain_min, float4 domain_max, int size) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	float4 in_val = read_imagef(src, sampler, cd);
+	float3 pos = lut_coord(in_val, domain_min, domain_max, size) + 0.5f;
+	float4 out_val = read_imagef(lut, lut_sampler, (float4)(pos, 0.0f));
+	out_val.w = in_val.w;
+	write_imagef(dst, cd, fmax((float4)0.0f, fmin(1.0f, out_val)));
+}
+
+#define NODE(dx, dy, dz) read_imagef(lut, lut_sampler, base + (int4)(dx, dy, dz, 0))
+
+/* Nearest sampler, interpolates inside one of six tetrahedra of the cell */
+__kernel void tetrahedral(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst,
+	__read_only image3d_t lut, sampler_t lut_sampler, float4 domain_min, float4 domain_max, int size) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	float4 in_val = read_imagef(src, sampler, cd);
+	float3 pos = lut_coord(in_val, domain_min, domain_max, size);
+	int4 base = (int4)(min(convert_int3(floor(pos)), (int3)(size - 2)), 0);
+	float3 f = pos - convert_float3(base.xyz);
+
+	float4 c000 = NODE(0, 0, 0), c111 = NODE(1, 1, 1);
+	float4 out_val;
+	if (f.x > f.y) {
+		if (f.y > f.z) {
+			out_val = (1.0f - f.x) * c000 + (f.x - f.y) * NODE(1, 0, 0) + (f.y - f.z) * NODE(1, 1, 0) + f.z * c111;
+		}
+		else if (f.x > f.z) {
+			out_val = (1.0f - f.x) * c000 + (f.x - f.z) * NODE(1, 0, 0) + (f.z - f.y) * NODE(1, 0, 1) + f.y * c111;
+		}
+		else {
+			out_val = (1.0f - f.z) * c000 + (f.z - f.x) * NODE(0, 0, 1) + (f.x - f.y) * NODE(1, 0, 1) + f.y * c111;
+		}
+	}
+	else {
+		if (f.z > f.y) {
+			out_val = (1.0f - f.z) * c000 + (f.z - f.y) * NODE(0, 0, 1) + (f.y - f.x) * NODE(0, 1, 1) + f.x * c111;
+		}
+		else if (f.z > f.x) {
+			out_val = (1.0f - f.y) * c000 + (f.y - f.z) * NODE(0, 1, 0) + (f.z - f.x) * NODE(0, 1, 1) + f.x * c111;
+		}
+		else {
+			out_val = (1.0f - f.y) * c000 + (f.y - f.x) * NODE(0, 1, 0) + (f.x - f.z) * NODE(1, 1, 0) + f.z * c111;
+		}
+	}
+	out_val.w = in_val.w;
+	write_imagef(dst, cd, fmax((float4)0.0f, fmin(1.0f, out_val)));
+}
+
+/* Lattice laid out as size x size^2 image, slice b occupies rows [b * size, (b + 1) * size) */
+__kernel void identity_lattice(__write_only image2d_t dst, int size) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	float3 node = (float3)(cd.x, cd.y % size, cd.y / size) / (float)(size - 1);
+	write_imagef(dst, cd, (float4)(node, 0.0f));
+}
@@ -0,0 +1,106 @@
+#include"im_executors.h"
+#include<fstream>
+
+grader::grader(hardware* env, functions* kernels) : executor(env, kernels) {}
+
+grader::~grader() {
+	for (auto& cached : luts) { clReleaseMemObject(cached.second.table); }
+}
+
+const grader::lut& grader::load_cube(const std::string& filename) {
+	std::lock_guard<std::mutex> guard(loading);
+	auto cached = luts.find(filename);
+	if (cached != luts.end()) { return cached->second; }
+
+	std::ifstream cube(filename);
+	if (!cube.is_open()) { throw std::runtime_error("Failed to open " + filename); }
+	lut loaded = { nullptr, 0, { 0.0f, 0.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f, 1.0f } };
+	std::vector<float> nodes;
+	std::string line;
+	while (std::getline(cube, line)) {
+		std::istringstream iss(line);
+		std::string key;
+		if (!(iss >> key) || key[0] == '#') { continue; }
+		if (key == "TITLE") { continue; }
+		else if (key == "LUT_3D_SIZE") { iss >> loaded.size; nodes.reserve(4ull * loaded.size * loaded.size * loaded.size); }
+		else if (key == "DOMAIN_MIN") { iss >> loaded.domain_min.x >> loaded.domain_min.y >> loaded.domain_min.z; }
+		else if (key == "DOMAIN_MAX") { iss >> loaded.domain_max.x >> loaded.domain_max.y >> loaded.domain_max.z; }
+		else if (key == "LUT_3D_INPUT_RANGE") {
+			float low, high;
+			if (!(iss >> low >> high)) { throw std::runtime_error("Malformed LUT line: " + line); }
+			loaded.domain_min = { low, low, low, 0.0f };
+			loaded.domain_max = { high, high, high, 1.0f };
+		}
+		else if (key == "LUT_1D_SIZE") { throw std::runtime_error("1D LUTs are not supported: " + filename); }
+		/* Vendor keywords carry nothing for a 3D table, data lines start with a number */
+		else if (isalpha(static_cast<unsigned char>(key[0]))) { continue; }
+		else {
+			float r = static_cast<float>(atof(key.c_str())), g, b;
+			if (!(iss >> g >> b)) { throw std::runtime_error("Malformed LUT line: " + line); }
+			nodes.insert(nodes.end(), { r, g, b, 1.0f });
+		}
+	}
+	if (loaded.size < 2) { throw std::runtime_error("Missing LUT_3D_SIZE in " + filename); }
+	if (nodes.size() != 4ull * loaded.size * loaded.size * loaded.size) {
+		throw std::runtime_error("Wrong number of LUT entries in " + filename);
+	}
+	loaded.table = env->alloc_volume({ loaded.size, loaded.size, loaded.size, 1 }, nodes.data());
+	return luts.emplace(filename, loaded).first->second;
+}
+
+const grader::lut& grader::bake(const std::string& name, int lut_size, const std::vector<stage>& chain) {
+	std::lock_guard<std::mutex> guard(loading);
+	auto cached = luts.find(name);
+	if (cached != luts.end()) { return cached->second; }
+	if (lut_size < 2) { throw std::runtime_error("LUT size must be at least 2"); }
+
+	cl_int2 lattice_size = { lut_size, lut_size * lut_size };
+	im_ptr lattice = std::make_shared<im_object>(lattice_size, env);
+	cl_kernel kern = kernels->at("identity_lattice");
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &lattice->cl_storage);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(int), &lut_size);
+	util::assert_success(ret_code, "Failed to set lattice args");
+	run_blocking(kern, lattice_size, LAUNCH_PURE | LAUNCH_GUARDED);
+	for (const stage& step : chain) {
+		im_ptr next = step(lattice);
+		lattice.swap(next);
+	}
+
+	lut baked = { nullptr, lut_size, { 0.0f, 0.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f, 1.0f } };
+	baked.table = env->alloc_volume({ lut_size, lut_size, lut_size, 1 });
+	size_t region[3] = { (size_t)lut_size, (size_t)lut_size, 1 };
+	for (int slice = 0; slice < lut_size; ++slice) {
+		size_t src_origin[3] = { 0, (size_t)slice * lut_size, 0 };
+		size_t dst_origin[3] = { 0, 0, (size_t)slice };
+		ret_code |= env->copy_image(lattice->cl_storage, baked.table,
+			src_origin, dst_origin, region, 0, nullptr, nullptr);
+	}
+	ret_code |= clFinish(env->queue());
+	util::assert_success(ret_code, "Failed to bake LUT " + name);
+	return luts.emplace(name, baked).first->second;
+}
+
+im_ptr grader::run(const lut& table, const std::string& interpolation, im_ptr& src) {
+	cl_sampler lut_sampler;
+	if (interpolation == "trilinear") {
+		lut_sampler = env->samplers.at({ CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_LINEAR });
+	}
+	else if (interpolation == "tetrahedral") {
+		lut_sampler = env->samplers.at({ CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST });
+	}
+	else { throw std::runtime_error("Unknown interpolation: " + interpolation); }
+
+	src->make_image();
+	cl_kernel kern = kernels->at(interpolation);
+	im_ptr dst = src->blank(src->size);
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
+	cl_int ret_code = set_common_args(kern, src->cl_storage, sampler, dst->cl_storage);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_mem), &table.table);
+	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_sampler), &lut_sampler);
+	ret_code |= clSetKernelArg(kern, 5, sizeof(cl_float4), &table.domain_min);
+	ret_code |= clSetKernelArg(kern, 6, sizeof(cl_float4), &table.domain_max);
+	ret_code |= clSetKernelArg(kern, 7, sizeof(int), &table.size);
+	util::assert_success(ret_code, "Failed to set LUT args");
+	run_blocking(kern, src->size, LAUNCH_PURE | LAUNCH_GUARDED);
+	return std::move(dst);
+}
@@ -1,9 +1,13 @@
 #include"hardware.h"
 #include"util.h"
+#include"tuner.h"
+#include<cmath>
+#include<vector>
 
 
-hardware::hardware(size_t platform_id, size_t device_id, size_t prealloc_size) :
-	platform_id(platform_id), device_id(device_id), prealloc_size(prealloc_size) {
+hardware::hardware(size_t platform_id, size_t device_id, size_t prealloc_size, cl_command_queue_properties queue_props,
+	cl_device_type device_type) : platform_id(platform_id), device_id(device_id), prealloc_size(prealloc_size),
+	queue_props(queue_props), device_type(device_type) {
 	clGetPlatformIDs(0, NULL, &plat_num);
 	if (platform_id >= plat_num) { throw std::runtime_error("Illegal platform"); }
 	platforms = new cl_platform_id[plat_num];
@@ -12,10 +16,10 @@ hardware::hardware(size_t platform_id, size_t device_id, size_t prealloc_size) :
 	util::assert_success(ret_code, "Failed to get platforms");
 	cur_platform = platforms[platform_id];
 
-	clGetDeviceIDs(platforms[platform_id], CL_DEVICE_TYPE_GPU, 0, NULL, &dev_num);
+	clGetDeviceIDs(platforms[platform_id], device_type, 0, NULL, &dev_num);
 	if (device_id >= dev_num) { throw std::runtime_error("Illegal device"); }
 	cl_device_id* devices = new cl_device_id[dev_num];
-	clGetDeviceIDs(platforms[platform_id], CL_DEVICE_TYPE_GPU, dev_num, devices, NULL);
+	clGetDeviceIDs(platforms[platform_id], device_type, dev_num, devices, NULL);
 	util::assert_success(ret_code, "Failed to get devices");
 	cur_device = devices[device_id];
 	for (size_t i = 0; i < dev_num; ++i) { if (i != device_id) { clReleaseDevice(devices[i]); } }
@@ -25,8 +29,16 @@ hardware::hardware(size_t platform_id, size_t device_id, size_t prealloc_size) :
 	context = clCreateContext(contextProperties, 1, &cur_device, NULL, NULL, &ret_code);
 	util::assert_success(ret_code, "Failed to create context");
 
-	queue = clCreateCommandQueue(context, cur_device, 0, &ret_code);
-	util::assert_success(ret_code, "Failed to create command queue");
+	queue();
+
+	cl_uint format_num;
+	clGetSupportedImageFormats(context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D, 0, NULL, &format_num);
+	cl_image_format* formats = new cl_image_format[format_num];
+	clGetSupportedImageFormats(context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D, format_num, formats, NULL);
+	for (cl_uint f = 0; f < format_num; ++f) {
+		image_formats.emplace(formats[f].image_channel_order, formats[f].image_channel_data_type);
+	}
+	delete[] formats;
 
 	if (prealloc_size != 0) { preallocation = alloc_buf(CL_MEM_READ_WRITE, prealloc_size, nullptr); }
 
@@ -45,10 +57,10 @@ cl_mem hardware::alloc_buf(cl_mem_flags flags, size_t size, void* ptr) {
 	return buf;
 }
 
-cl_mem hardware::alloc_im(cl_int2 size, float* ptr, cl_uint order) {
+cl_mem hardware::alloc_im(cl_int2 size, float* ptr, cl_uint order, cl_channel_type type) {
 	cl_image_format format;
 	format.image_channel_order = order;
-	format.image_channel_data_type = CL_FLOAT;
+	format.image_channel_data_type = type;
 
 	cl_image_desc descriptor;
 	descriptor.image_type = CL_MEM_OBJECT_IMAGE2D;
@@ -58,6 +70,7 @@ cl_mem hardware::alloc_im(cl_int2 size, float* ptr, cl_uint order) {
 	descriptor.image_row_pitch = 0; descriptor.image_slice_pitch = 0;
 	descriptor.num_mip_levels = 0; descriptor.num_samples = 0;
 	descriptor.image_depth = 1; descriptor.image_array_size = 1;
+	descriptor.buffer = nullptr;
 
 	cl_int ret_code;
 	cl_mem_flags flags = CL_MEM_READ_WRITE;
@@ -67,14 +80,62 @@ cl_mem hardware::alloc_im(cl_int2 size, float* ptr, cl_uint order) {
 	return im;
 }
 
+bool hardware::supports(cl_channel_order order, cl_channel_type type) const {
+	return image_formats.count({ order, type }) != 0;
+}
+
+cl_mem hardware::alloc_volume(cl_int4 size, float* ptr) {
+	cl_image_format format;
+	format.image_channel_order = CL_RGBA;
+	format.image_channel_data_type = CL_FLOAT;
+
+	cl_image_desc descriptor;
+	descriptor.image_type = CL_MEM_OBJECT_IMAGE3D;
+	descriptor.image_width = static_cast<size_t>(size.x);
+	descriptor.image_height = static_cast<size_t>(size.y);
+	descriptor.image_depth = static_cast<size_t>(size.z);
+
+	descriptor.image_row_pitch = 0; descriptor.image_slice_pitch = 0;
+	descriptor.num_mip_levels = 0; descriptor.num_samples = 0;
+	descriptor.image_array_size = 1; descriptor.buffer = nullptr;
+
+	cl_int ret_code;
+	cl_mem_flags flags = CL_MEM_READ_WRITE;
+	if (ptr != nullptr) { flags |= CL_MEM_COPY_HOST_PTR; }
+	cl_mem im = clCreateImage(context, flags, &format, &descriptor, ptr, &ret_code);
+	util::assert_success(ret_code, "Failed to allocate volume");
+	return im;
+}
+
+cl_program hardware::build_program(const std::string& source, const std::string& options) {
+	const char* src = source.c_str();
+	size_t length = source.length();
+	cl_int ret_code;
+	cl_program program = clCreateProgramWithSource(context, 1, &src, &length, &ret_code);
+	util::assert_success(ret_code, "Failed to create program");
+	ret_code = clBuildProgram(program, 1, &cur_device, options.c_str(), NULL, NULL);
+	if (ret_code != CL_SUCCESS) {
+		char* log_str = new char[50000]; size_t ret_size;
+		clGetProgramBuildInfo(program, cur_device, CL_PROGRAM_BUILD_LOG, 50000, log_str, &ret_size);
+		std::string build_log(log_str, ret_size); delete[] log_str;
+		clReleaseProgram(program);
+		throw std::runtime_error(build_log);
+	}
+	return program;
+}
+
 
 template<typename target_value>
 target_value hardware::device_param(cl_device_id device, cl_device_info param) {
-	target_value result; cl_uint ret_size;
+	target_value result; size_t ret_size;
 	clGetDeviceInfo(device, param, sizeof(target_value), &result, &ret_size);
 	return result;
 }
 
+/* Used outside this unit */
+template cl_uint hardware::device_param<cl_uint>(cl_device_id, cl_device_info);
+template cl_ulong hardware::device_param<cl_ulong>(cl_device_id, cl_device_info);
+
 std::string hardware::string_param(cl_device_id device, cl_device_info param) {
 	char dev_param[256]; size_t ret_size;
 	clGetDeviceInfo(device, param, 256, dev_param, &ret_size);
@@ -128,8 +189,127 @@ void hardware::device_info(cl_device_id device, bool extensions) {
 	std::cout << std::endl << device_param<std::string>(device, CL_DEVICE_EXTENSIONS) << std::endl;
 }
 
+cl_command_queue hardware::queue() {
+	std::lock_guard<std::mutex> guard(lock);
+	auto cached = queues.find(std::this_thread::get_id());
+	if (cached != queues.end()) { return cached->second; }
+	cl_int ret_code;
+	cl_command_queue fresh = clCreateCommandQueue(context, cur_device, queue_props, &ret_code);
+	util::assert_success(ret_code, "Failed to create command queue");
+	return queues.emplace(std::this_thread::get_id(), fresh).first->second;
+}
+
+void hardware::reset_queue(cl_command_queue_properties props) {
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto& thread_queue : queues) {
+		clFinish(thread_queue.second);
+		cl_int ret_code;
+		cl_command_queue fresh = clCreateCommandQueue(context, cur_device, props, &ret_code);
+		util::assert_success(ret_code, "Failed to create command queue");
+		clReleaseCommandQueue(thread_queue.second);
+		thread_queue.second = fresh;
+	}
+	queue_props = props;
+}
+
+cl_event* hardware::log_slot(cl_event* slot) const { return (event_log != nullptr) ? slot : NULL; }
+
+void hardware::log_event(cl_event event, const std::string& name, bool transfer, size_t bytes) {
+	if (event_log == nullptr || event == nullptr) { return; }
+	std::lock_guard<std::mutex> guard(lock);
+	clRetainEvent(event);
+	event_log->push_back({ event, name, transfer, bytes });
+}
+
+cl_int hardware::copy_image(cl_mem src, cl_mem dst, const size_t* src_origin, const size_t* dst_origin,
+	const size_t* region, cl_uint wait_num, const cl_event* wait_list, cl_event* event) {
+	cl_event copy_event = nullptr;
+	cl_int ret_code = clEnqueueCopyImage(queue(), src, dst, src_origin, dst_origin, region,
+		wait_num, wait_list, (event != nullptr) ? event : log_slot(&copy_event));
+	if (event_log != nullptr && ret_code == CL_SUCCESS) {
+		size_t element_size = 0;
+		clGetImageInfo(src, CL_IMAGE_ELEMENT_SIZE, sizeof(size_t), &element_size, nullptr);
+		log_event((event != nullptr) ? *event : copy_event, "copy_image", true,
+			element_size * region[0] * region[1] * region[2]);
+	}
+	if (copy_event != nullptr) { clReleaseEvent(copy_event); }
+	return ret_code;
+}
+
+cl_int hardware::enqueue_kernel(cl_kernel kern, cl_int2 size, int launch,
+	cl_uint wait_num, const cl_event* wait_list, cl_event* event) {
+	size_t global_size[2] = { (size_t)size.x, (size_t)size.y };
+	bool guarded = (launch & LAUNCH_GUARDED) != 0;
+	tuner::local_size local = { 0, 0 };
+	if (tuning != nullptr && (launch & LAUNCH_PURE) != 0) {
+		local = tuning->pick(kern, size, guarded, wait_num, wait_list);
+	}
+	/* Winners are kept per size class, unguarded kernels may only take exact multiples */
+	if (local[0] != 0 && !guarded && (global_size[0] % local[0] != 0 || global_size[1] % local[1] != 0)) {
+		local = { 0, 0 };
+	}
+	if (local[0] == 0) {
+		return clEnqueueNDRangeKernel(queue(), kern, 2, NULL, global_size, NULL, wait_num, wait_list, event);
+	}
+	global_size[0] = (global_size[0] + local[0] - 1) / local[0] * local[0];
+	global_size[1] = (global_size[1] + local[1] - 1) / local[1] * local[1];
+	return clEnqueueNDRangeKernel(queue(), kern, 2, NULL, global_size, local.data(), wait_num, wait_list, event);
+}
+
+std::string hardware::kernel_name(cl_kernel kern) {
+	size_t name_size = 0;
+	clGetKernelInfo(kern, CL_KERNEL_FUNCTION_NAME, 0, nullptr, &name_size);
+	std::string name(name_size, '\0');
+	clGetKernelInfo(kern, CL_KERNEL_FUNCTION_NAME, name_size, &name[0], nullptr);
+	if (!name.empty() && name.back() == '\0') { name.pop_back(); }
+	return name;
+}
+
+cl_mem hardware::transfer_table(int transfer, int depth) {
+	std::lock_guard<std::mutex> guard(lock);
+	auto cached = transfer_tables.find({ transfer, depth });
+	if (cached != transfer_tables.end()) { return cached->second; }
+
+	float (*decode)(float) = nullptr;
+	float (*encode)(float) = nullptr;
+	switch (transfer) {
+	case TRANSFER_LINEAR:
+		decode = [](float v) { return v; };
+		encode = [](float v) { return v; };
+		break;
+	case TRANSFER_SRGB:
+		decode = [](float v) { return v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f); };
+		encode = [](float v) { return v <= 0.0031308f ? v * 12.92f : 1.055f * powf(v, 1.0f / 2.4f) - 0.055f; };
+		break;
+	case TRANSFER_REC709:
+		decode = [](float v) { return v < 0.081f ? v / 4.5f : powf((v + 0.099f) / 1.099f, 1.0f / 0.45f); };
+		encode = [](float v) { return v < 0.018f ? v * 4.5f : 1.099f * powf(v, 0.45f) - 0.099f; };
+		break;
+	case TRANSFER_GAMMA22:
+		decode = [](float v) { return powf(v, 2.2f); };
+		encode = [](float v) { return powf(v, 1.0f / 2.2f); };
+		break;
+	default: throw std::runtime_error("Unknown transfer function: " + std::to_string(transfer));
+	}
+
+	/* Encode nodes are spaced by square of index to follow steep curves near black */
+	size_t decode_size = size_t(1) << (8 * depth);
+	std::vector<float> table(decode_size + TRANSFER_ENCODE_STEPS + 1);
+	for (size_t code = 0; code < decode_size; ++code) {
+		table[code] = decode(code / (decode_size - 1.0f));
+	}
+	for (size_t node = 0; node <= TRANSFER_ENCODE_STEPS; ++node) {
+		float pos = node / static_cast<float>(TRANSFER_ENCODE_STEPS);
+		table[decode_size + node] = encode(pos * pos);
+	}
+	cl_mem table_buf = alloc_buf(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		table.size() * sizeof(float), table.data());
+	return transfer_tables.emplace(std::make_pair(transfer, depth), table_buf).first->second;
+}
+
 hardware::~hardware() {
-	clReleaseCommandQueue(queue);
+	for (auto& table : transfer_tables) { clReleaseMemObject(table.second); }
+	for (auto& thread_queue : queues) { clReleaseCommandQueue(thread_queue.second); }
 	clReleaseContext(context);
 	clReleaseDevice(cur_device);
 	if (prealloc_size != 0) { clReleaseMemObject(preallocation); }
@@ -2,6 +2,20 @@
 #include<CL/cl.h>
 #include<string>
 #include<map>
+#include<set>
+#include<vector>
+#include<thread>
+#include<mutex>
+
+/* Launch properties stated by caller, plain launches run with driver default local size */
+#define LAUNCH_PLAIN 0
+/* Kernel writes to its own outputs only, so tuner may relaunch it with live arguments */
+#define LAUNCH_PURE 1
+/* Kernel returns early for items outside size, so global size may be padded */
+#define LAUNCH_GUARDED 2
+
+struct functions;
+struct tuner;
 
 struct hardware {
 	cl_platform_id* platforms = nullptr;
@@ -10,17 +24,46 @@ struct hardware {
 	size_t dev_num = 0, plat_num = 0;
 	size_t platform_id = 0, device_id = 0;
 
-	cl_command_queue queue;
 	cl_context context;
 
+	/* Kernels of utils.cl, set by app */
+	functions* utils = nullptr;
+
+	/* Work-group sizes of this device, driver default if not set */
+	tuner* tuning = nullptr;
+
 	cl_mem preallocation = nullptr;
 	size_t prealloc_size = 0;
 
 	using sampler_params = std::pair<cl_addressing_mode, cl_filter_mode>;
 	std::map<sampler_params, cl_sampler> samplers;
 
+	/* Decode/encode tables of transfer functions by sample depth, built on first use */
+	std::map<std::pair<int, int>, cl_mem> transfer_tables;
+
+	/* Image formats supported by context for read-write images */
+	std::set<std::pair<cl_channel_order, cl_channel_type>> image_formats;
+
+	/* Enqueued command kept for profiling */
+	struct record {
+		cl_event event;
+		std::string name;
+		bool transfer;
+		size_t bytes;
+	};
+
+	/* If set, enqueued kernels and transfers append their retained events here, owner releases them */
+	std::vector<record>* event_log = nullptr;
+	cl_command_queue_properties queue_props = 0;
+	cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+
+	/* Keep packed 8-bit images in linear buffers instead of image objects, set by app for CPU devices */
+	bool buffers = false;
+
 	hardware() = default;
-	hardware(size_t platform_id, size_t device_id, size_t prealloc_size);
+	/* device_id indexes devices of given type on the platform */
+	hardware(size_t platform_id, size_t device_id, size_t prealloc_size, cl_command_queue_properties queue_props = 0,
+		cl_device_type device_type = CL_DEVICE_TYPE_GPU);
 
 	template<typename target_value>
 	static target_value device_param(cl_device_id device, cl_device_info param);
@@ -30,7 +73,45 @@ struct hardware {
 	static void device_info(cl_device_id device, bool extensions = false);
 
 	cl_mem alloc_buf(cl_mem_flags flags, size_t size, void* ptr);
-	cl_mem alloc_im(cl_int2 size, float* ptr = nullptr, cl_uint type = CL_RGBA);
+	cl_mem alloc_im(cl_int2 size, float* ptr = nullptr, cl_uint order = CL_RGBA, cl_channel_type type = CL_FLOAT);
+	bool supports(cl_channel_order order, cl_channel_type type) const;
+	cl_mem alloc_volume(cl_int4 size, float* ptr = nullptr);
+
+	/* Table for normalise/denormalise kernels, see utils.cl for layout */
+	cl_mem transfer_table(int transfer, int depth = 1);
+
+	/* In-order queue of calling thread, created on first use */
+	cl_command_queue queue();
+
+	/* Recreate queues of all threads with given properties after pending commands finish */
+	void reset_queue(cl_command_queue_properties props);
+
+	/* Slot for event of a command if it is going to be logged, NULL otherwise */
+	cl_event* log_slot(cl_event* slot) const;
+
+	/* Append event to event_log if set, event is retained */
+	void log_event(cl_event event, const std::string& name, bool transfer = false, size_t bytes = 0);
+
+	/* clEnqueueCopyImage on own queue, logged as transfer */
+	cl_int copy_image(cl_mem src, cl_mem dst, const size_t* src_origin, const size_t* dst_origin,
+		const size_t* region, cl_uint wait_num, const cl_event* wait_list, cl_event* event);
+
+	/*
+	*  2D launch over size on own queue. Pure kernels get tuned local size, global size is padded to it
+	*  for guarded ones, others fall back to driver default when it does not divide size
+	*/
+	cl_int enqueue_kernel(cl_kernel kern, cl_int2 size, int launch, cl_uint wait_num, const cl_event* wait_list, cl_event* event);
+
+	static std::string kernel_name(cl_kernel kern);
+
+	/* Build program for current device, throws build log on failure */
+	cl_program build_program(const std::string& source, const std::string& options = "-I.");
 
 	~hardware();
+
+private:
+	std::map<std::thread::id, cl_command_queue> queues;
+
+	/* Guards queues, transfer tables and event log against concurrent commands */
+	std::mutex lock;
 };
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include"executor.h"
 #include<unordered_map>
 #include<set>
+#include<functional>
 
 
 /* --- Transforms image colour space ---
@@ -15,15 +16,26 @@ struct converser : public executor {
 
 	converser(hardware* env, functions* conversers);
 
-	/* If src and dst are not a srgb, execute two conversions via srgb.
-	Requires image without gamma correction and returns also an image without gamma correction */
-	im_ptr run(col_pair colours, im_ptr& src);
+	/* Follows the shortest chain of conversions, multi-hop chains run as one fused kernel.
+	Requires image without gamma correction and returns also an image without gamma correction.
+	Reads packed or planar source, writes planar result if planar_out is set */
+	im_ptr run(col_pair colours, im_ptr& src, bool planar_out = false);
+
+	/* Sequence of colour spaces from first to second, both ends included */
+	static std::vector<std::string> find_path(const col_pair& colours);
+
+	~converser();
 
 private:
+	/* Generated programs, keyed by conversion path */
+	std::unordered_map<std::string, functions> fused;
+	std::mutex fusing;
 
 	void set_args(cl_kernel kern, im_ptr& src, im_ptr& dst);
 
-	im_ptr run_ycbcr(col_pair colours, im_ptr& src);
+	/* Build (or take cached) kernel applying all hops of path in registers,
+	buffer-backed source is read with load_px and written back to a buffer unless planar_out */
+	cl_kernel fuse(const std::vector<std::string>& path, bool planar_in, bool planar_out, bool buffered = false);
 };
 
 
@@ -38,23 +50,207 @@ struct contraster : public executor {
 	im_ptr exclusive_hist(im_ptr& src, float exclusive, int channel_mode);
 	im_ptr adaptive_hist(im_ptr& src, cl_int2 region, int exclude, int channel_mode);
 
+	/* Flat histogram, by CDF of 8-bit bins computed on device */
+	im_ptr equalise(im_ptr& src, int channel_mode);
+
+	/* Histogram of reference, which has the same layout and channel mode as src */
+	im_ptr match(im_ptr& src, im_ptr& reference, int channel_mode);
 
 private:
 	void set_args(cl_kernel kern, const im_ptr& src, im_ptr& dst);
+
+	/* Run kern with extra args set; planar images touch only planes selected by channel_mode,
+	buffer-backed ones expect the _buf variant of kern */
+	im_ptr apply(cl_kernel kern, cl_sampler sampler, im_ptr& src, int channel_mode, cl_int2 global, int launch);
+
+	/* Per-group histograms of first or all three channels, groups of them as 3 * HIST_BINS counts */
+	cl_mem histograms(im_ptr& src, int channels, cl_int& groups);
+
+	/* Equalisation without reference, matching with it */
+	im_ptr remap(im_ptr& src, im_ptr* reference, int channel_mode);
+};
+
+
+
+/* --- Colour grading via 3D look-up tables ---
+*  .cube files, baked chains of pointwise executors; trilinear, tetrahedral
+*/
+struct grader : public executor {
+	struct lut {
+		cl_mem table;
+		int size;
+		cl_float4 domain_min, domain_max;
+	};
+
+	/* Pointwise operation applied to lattice while baking */
+	using stage = std::function<im_ptr(im_ptr&)>;
+
+	grader(hardware* env, functions* kernels);
+
+	/* Load .cube file into image3d, cached by filename */
+	const lut& load_cube(const std::string& filename);
+
+	/* Pass identity lattice through chain and keep result as LUT, cached by name */
+	const lut& bake(const std::string& name, int lut_size, const std::vector<stage>& chain);
+
+	/* One texture lookup per pixel, interpolation is "trilinear" or "tetrahedral" */
+	im_ptr run(const lut& table, const std::string& interpolation, im_ptr& src);
+
+	~grader();
+
+private:
+	std::unordered_map<std::string, lut> luts;
+	std::mutex loading;
 };
 
 
 
-/* --- Some filters based on convolution ---
-*  Gauss blur
+/* --- Frequency domain via radix-2 Stockham FFT over power-of-two padded planes ---
+*  Convolution with large kernels, notch reject filters
+*/
+struct fourier : public executor {
+	fourier(hardware* env, functions* kernels);
+
+	/* Same correlation sum as spatial conv_2D, clamped borders, weights row by row */
+	im_ptr convolve(im_ptr& src, const std::vector<float>& weights, cl_int2 kern_size);
+
+	/* Remove periodic patterns at +-centres, in cycles per pixel, with Gaussian notches of given width */
+	im_ptr notch(im_ptr& src, const std::vector<cl_float2>& centres, float width);
+
+	/*
+	*  Spectrum of image padded to power-of-two sides with at least margin on every side:
+	*  planes (red + i * green) and (blue + i * alpha) of padded.x * padded.y float2, caller releases
+	*/
+	cl_mem forward(im_ptr& src, cl_int2 padded);
+
+	/* Image like given one from a spectrum of forward, releases spectrum */
+	im_ptr inverse(cl_mem spectrum, cl_int2 padded, im_ptr& like);
+
+	static cl_int2 padded_size(cl_int2 size, cl_int2 margin);
+
+	/* Estimated work of convolve in spatial taps, to compare against width * height * kernel area */
+	static double cost(cl_int2 size, cl_int2 kern_size);
+
+private:
+	static size_t plane_bytes(cl_int2 padded);
+
+	/* 2D transform of planes in place, sign -1 forward, 1 inverse without scaling; swaps data and temp as passes go */
+	void transform(cl_mem& data, cl_mem& temp, cl_int2 padded, int planes, float sign);
+};
+
+
+
+/* --- Full-reference image quality ---
+*  MSE and PSNR, SSIM with 11x11 Gaussian window, MS-SSIM over up to five scales
+*/
+struct assessor : public executor {
+	/* Per channel, maps only when asked: absolute error and SSIM at full scale */
+	struct quality {
+		cl_float4 mse, psnr, ssim, ms_ssim;
+		im_ptr error_map = nullptr, ssim_map = nullptr;
+	};
+
+	assessor(hardware* env, functions* kernels);
+
+	quality compare(im_ptr& a, im_ptr& b, bool maps = false);
+
+	~assessor();
+private:
+	/* Normalised Gaussian taps of SSIM window */
+	cl_mem weights;
+
+	/* SSIM and contrast-structure maps at one scale */
+	std::pair<im_ptr, im_ptr> ssim_maps(im_ptr& a, im_ptr& b);
+
+	im_ptr halve(im_ptr& src);
+};
+
+
+
+/* --- Summed-area tables built by work-efficient parallel prefix scans ---
+*  Box blur and local contrast normalisation at constant cost per pixel whatever the window
+*/
+struct integrator : public executor {
+	integrator(hardware* env, functions* kernels);
+
+	/*
+	*  Table of (size.x + 1) x (size.y + 1) float8 of image src, sums of pixels or their squares
+	*  in float-float form (rounded sum, rounding error), first row and column zero, caller releases
+	*/
+	cl_mem build(cl_mem src, cl_int2 size, bool squares);
+
+	/* Means over (2 * radius + 1) windows cut to the image into float image dst */
+	void box_mean(cl_mem table, cl_int2 radius, cl_mem dst, cl_int2 size);
+
+	im_ptr box_blur(cl_int2 radius, im_ptr& src);
+
+	/* (x - local mean) / max(local deviation, eps), +-3 deviations mapped to [0, 1] */
+	im_ptr local_normalise(int radius, float eps, im_ptr& src);
+
+private:
+	/* Fixed-group and in-place scan passes, launched as given and never retried by the tuner */
+	void run_direct(cl_kernel kern, const size_t* global_size, const size_t* local_size);
+};
+
+
+
+/* --- Some filters based on convolution and order statistics ---
+*  Gauss blur, median, edge-preserving bilateral and guided filters
 */
 struct filter : public executor {
+	/* FFT path for large kernels, set by app */
+	fourier* spectral = nullptr;
+
+	/* Box means of guided filter, set by app */
+	integrator* integral = nullptr;
+
 	filter(hardware* env, functions* filters);
 
-	im_ptr gauss(float sigma, int lin_size, im_ptr& src);
+	/* mode: "spatial", "fft" or "auto", which takes the cheaper one by estimate */
+	im_ptr gauss(float sigma, int lin_size, im_ptr& src, const std::string& mode = "auto");
+
+	/* Correlation with kern_size weights given row by row, centre at kern_size / 2, clamped borders */
+	im_ptr convolve(const std::vector<float>& weights, cl_int2 kern_size, im_ptr& src, const std::string& mode = "auto");
+
+	/* Median of (2 * radius + 1)^2 window, exchange networks up to 5x5 and histograms of 8-bit codes beyond */
+	im_ptr median(int radius, im_ptr& src);
+
+	/* Tiled in local memory, sigma_r in units of colour distance (channels in [0, 1]) */
+	im_ptr bilateral(int radius, float sigma_s, float sigma_r, im_ptr& src);
+
+	/* Self-guided, linear in image size: box means, coefficients, box means of coefficients */
+	im_ptr guided(int radius, float eps, im_ptr& src);
+
+private:
+	/* Box means of src_a and src_b (or squares of src_a) over summed-area tables, float images */
+	void box_means(cl_mem src_a, cl_mem src_b, bool square_b, cl_mem dst_a, cl_mem dst_b, cl_int2 size, int radius);
+
+	/* conv_kern is a CL_A image, or a float buffer for buffer-backed src */
+	im_ptr spatial_convolve(cl_mem conv_kern, im_ptr& src, cl_int radius);
+};
+
+
+
+/* --- Mathematical morphology with rectangular structuring elements ---
+*  Erode, dilate, open, close, top-hat, black top-hat
+*/
+struct morpher : public executor {
+	morpher(hardware* env, functions* kernels);
+
+	/* element is width x height of the rectangle, anchored at its centre */
+	im_ptr run(const std::string& operation, cl_int2 element, im_ptr& src);
 
 private:
-	im_ptr convolve(cl_mem conv_kern, im_ptr& src, cl_int radius);
+	/*
+	*  Minimum (erode) or maximum (dilate) over element, rows then columns.
+	*  Second passes of open and close take the reflected element, which differs for even sizes
+	*/
+	im_ptr extremum(cl_int2 element, im_ptr& src, bool dilate, bool reflected = false);
+
+	/* Van Herk / Gil-Werman pass over lines of size pixels, about three comparisons per pixel */
+	im_ptr line_pass(im_ptr& src, int size, bool vertical, bool dilate, bool reflected);
+
+	im_ptr difference(im_ptr& minuend, im_ptr& subtrahend);
 };
 
 
@@ -116,4 +312,8 @@ private:
 	/* Set args depending on kernel type */
 	void set_args(cl_kernel kern, cl_mem src, cl_mem dst,
 		cl_sampler sampler, float factor, int* params);
+
+	/* Same for _buf variants, which take sizes instead of sampler */
+	void set_buf_args(cl_kernel kern, cl_mem src, cl_int2 src_size,
+		cl_mem dst, cl_int2 dst_size, float factor, int* params);
 };
\ No newline at end of file
@@ -1,94 +1,355 @@
 #include"im_object.h"
 #include"util.h"
+#include<algorithm>
 
+/* Work-group of stat kernels and cap on groups of the first pass */
+#define STAT_ITEMS 256
+#define STAT_GROUPS 256
 
-im_object::im_object(cl_int2 size, hardware* env, cl_mem storage) : size(size),
-	alloc_size(3 * size.x * size.y), env(env), host_ptr(nullptr) {
+/* Mirror of stat_rec in utils.cl */
+struct stat_rec {
+	cl_float4 min_val, max_val, mean, m2;
+	cl_uint pixels;
+	cl_uint padding[3];
+};
+
+im_object::im_object(cl_int2 size, hardware* env, cl_mem storage, cl_channel_type format,
+	cl_channel_order order) : size(size), alloc_size(3 * size.x * size.y), env(env),
+	format(format), order(order), host_ptr(nullptr) {
 	if (storage != nullptr) { this->cl_storage = storage; }
-	else { cl_storage = env->alloc_im(size); }
+	else { cl_storage = env->alloc_im(size, nullptr, order, format); }
 }
 
-im_object::im_object(char* host_ptr, size_t width, size_t height, hardware* env, int direct_gamma) : 
-	host_ptr(host_ptr), env(env), alloc_size(3 * width * height) {
-	this->size = { (cl_int)width, (cl_int)height };
+im_object::im_object(cl_int2 size, hardware* env, cl_channel_type format, int components, int depth) :
+	size(size), alloc_size(components * depth * size.x * size.y), env(env), format(format),
+	components(components), depth(depth) {
+	/* 16-bit samples need 16-bit storage to stay exact */
+	if (depth == 2 && this->format == CL_UNORM_INT8) { this->format = CL_UNORM_INT16; }
+	if (depth == 2 && this->format == CL_HALF_FLOAT) { this->format = CL_FLOAT; }
+	if (components == 1 && env->supports(CL_LUMINANCE, this->format)) { order = CL_LUMINANCE; }
+	if (!env->supports(order, this->format)) { this->format = CL_FLOAT; }
+	if (env->buffers && components == 3 && depth == 1) { buffered = true; this->format = CL_FLOAT; }
+	cl_storage = alloc_storage(size);
+}
 
-	cl_mem temp_buf = (alloc_size > env->prealloc_size) ?
-		env->alloc_buf(CL_MEM_READ_ONLY, alloc_size, nullptr) : env->preallocation;
-	cl_event copy_event = nullptr;
-	cl_int ret_code = clEnqueueWriteBuffer(env->queue, temp_buf,
-		CL_FALSE, 0, alloc_size, host_ptr, 0, nullptr, &copy_event);
-	cl_kernel norm_kern = util::kernels->at("normalise");
-	cl_storage = env->alloc_im(size);
-	ret_code = clSetKernelArg(norm_kern, 0, sizeof(cl_mem), &temp_buf);
+im_object::im_object(char* host_ptr, size_t width, size_t height, hardware* env, int direct_gamma,
+	cl_channel_type format, int components, int depth) :
+	im_object({ (cl_int)width, (cl_int)height }, env, format, components, depth) {
+	this->host_ptr = host_ptr;
+	host_written(direct_gamma);
+}
+
+size_t im_object::row_bytes() const { return static_cast<size_t>(components) * depth * size.x; }
+
+cl_event im_object::upload_band(const char* band, cl_mem staging, int first_row, int rows, int direct_gamma) {
+	bool packed_bytes = (components == 3 && depth == 1);
+	cl_event copy_event = nullptr, norm_event = nullptr;
+	cl_int ret_code = clEnqueueWriteBuffer(env->queue(), staging, CL_FALSE, 0,
+		rows * row_bytes(), band, 0, nullptr, &copy_event);
+	cl_kernel norm_kern = buffered ? env->utils->at("normalise_buf") : packed_bytes ? env->utils->at("normalise") :
+		env->utils->at("normalise_any", util::defines({ { "SAMPLE_CHANNELS", components }, { "SAMPLE_DEPTH", depth } }));
+	cl_mem table = env->transfer_table(direct_gamma, depth);
+	cl_uint arg = 4;
+	ret_code |= clSetKernelArg(norm_kern, 0, sizeof(cl_mem), &staging);
 	ret_code |= clSetKernelArg(norm_kern, 1, sizeof(cl_int2), &size);
 	ret_code |= clSetKernelArg(norm_kern, 2, sizeof(cl_mem), &cl_storage);
-	ret_code |= clSetKernelArg(norm_kern, 3, sizeof(cl_int), &direct_gamma);
+	ret_code |= clSetKernelArg(norm_kern, 3, sizeof(cl_mem), &table);
+	if (!packed_bytes) {
+		ret_code |= clSetKernelArg(norm_kern, arg++, sizeof(int), &components);
+		ret_code |= clSetKernelArg(norm_kern, arg++, sizeof(int), &depth);
+	}
+	ret_code |= clSetKernelArg(norm_kern, arg, sizeof(int), &first_row);
 
-	size_t global_size[2] = { (size_t)size.x, (size_t)size.y };
-	ret_code = clEnqueueNDRangeKernel(env->queue, norm_kern,
-		2, NULL, global_size, NULL, 0, NULL, NULL);
-	ret_code |= clFinish(env->queue);
-	if (alloc_size > env->prealloc_size) { clReleaseMemObject(temp_buf); }
+	size_t global_size[2] = { packed_bytes ? (size_t)(size.x + 3) / 4 : (size_t)size.x, (size_t)rows };
+	ret_code |= clEnqueueNDRangeKernel(env->queue(), norm_kern,
+		2, NULL, global_size, NULL, 1, &copy_event, &norm_event);
+	util::assert_success(ret_code, "Failed to enqueue upload");
+	env->log_event(copy_event, "write_buffer", true, rows * row_bytes());
+	env->log_event(norm_event, hardware::kernel_name(norm_kern));
+	clReleaseEvent(copy_event);
+	device_written();
+	return norm_event;
+}
+
+cl_event im_object::download_band(char* band, cl_mem staging, int first_row, int rows, int inverse_gamma) {
+	if (planar()) { throw std::runtime_error("Planar image must be merged before download"); }
+	bool packed_bytes = (components == 3 && depth == 1);
+	cl_event norm_event = nullptr, read_event = nullptr;
+	cl_kernel kern = buffered ? env->utils->at("denormalise_buf") : packed_bytes ? env->utils->at("denormalise") :
+		env->utils->at("denormalise_any", util::defines({ { "SAMPLE_CHANNELS", components }, { "SAMPLE_DEPTH", depth } }));
+	cl_mem table = env->transfer_table(inverse_gamma, depth);
+	cl_uint arg = 0;
+	cl_int ret_code = clSetKernelArg(kern, arg++, sizeof(cl_mem), &cl_storage);
+	if (!buffered) {
+		ret_code |= clSetKernelArg(kern, arg++, sizeof(cl_sampler), &env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST }));
+	}
+	ret_code |= clSetKernelArg(kern, arg++, sizeof(cl_mem), &staging);
+	ret_code |= clSetKernelArg(kern, arg++, sizeof(cl_int2), &size);
+	ret_code |= clSetKernelArg(kern, arg++, sizeof(cl_mem), &table);
+	if (!packed_bytes) {
+		ret_code |= clSetKernelArg(kern, arg++, sizeof(int), &components);
+		ret_code |= clSetKernelArg(kern, arg++, sizeof(int), &depth);
+	}
+	ret_code |= clSetKernelArg(kern, arg, sizeof(int), &first_row);
+
+	size_t global_size[2] = { packed_bytes ? (size_t)(size.x + 3) / 4 : (size_t)size.x, (size_t)rows };
+	ret_code |= clEnqueueNDRangeKernel(env->queue(), kern,
+		2, NULL, global_size, NULL, 0, NULL, &norm_event);
+	ret_code |= clEnqueueReadBuffer(env->queue(), staging, CL_FALSE, 0,
+		rows * row_bytes(), band, 1, &norm_event, &read_event);
+	util::assert_success(ret_code, "Failed to enqueue download");
+	env->log_event(norm_event, hardware::kernel_name(kern));
+	env->log_event(read_event, "read_buffer", true, rows * row_bytes());
+	clReleaseEvent(norm_event);
+	return read_event;
 }
 
-im_object::im_object(im_object&& other) noexcept : cl_storage(other.cl_storage),
-	env(other.env), size(other.size), alloc_size(other.alloc_size) {
+im_object::im_object(cl_int2 size, hardware* env, plane_set planes, cl_channel_type format) :
+	size(size), alloc_size(3 * size.x * size.y), env(env), format(format), planes(planes) {}
+
+im_object::im_object(im_object&& other) noexcept : size(other.size), alloc_size(other.alloc_size),
+	env(other.env), cl_storage(other.cl_storage), format(other.format), order(other.order),
+	components(other.components), depth(other.depth), buffered(other.buffered), planes(other.planes) {
 	if (cl_storage != nullptr) { clRetainMemObject(cl_storage); }
+	for (cl_mem plane : planes) { if (plane != nullptr) { clRetainMemObject(plane); } }
 	delete[] host_ptr;
 	host_ptr = other.host_ptr;
+	state = other.state;
+	host_gamma = other.host_gamma;
 	other.host_ptr = nullptr;
+	other.state = residency::device;
 }
 
-char* im_object::get_host_ptr(int inverse_gamma) {
-	if (host_ptr == nullptr) {
-		host_ptr = new char[alloc_size];
-		cl_mem temp_buf = (alloc_size > env->prealloc_size) ?
-			env->alloc_buf(CL_MEM_WRITE_ONLY, alloc_size, nullptr) : env->preallocation;
-
-		cl_kernel kern = util::kernels->at("denormalise");
-		cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &cl_storage);
-		ret_code |= clSetKernelArg(kern, 1, sizeof(cl_sampler), &env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST }));
-		ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &temp_buf);
-		ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int2), &size);
-		ret_code |= clSetKernelArg(kern, 4, sizeof(cl_int), &inverse_gamma);
-
-		size_t global_size[2] = { (size_t)size.x, (size_t)size.y };
-		ret_code = clEnqueueNDRangeKernel(env->queue, kern,
-			2, NULL, global_size, NULL, 0, NULL, NULL);
-		clFinish(env->queue);
-		ret_code |= clEnqueueReadBuffer(env->queue, temp_buf,
-			CL_TRUE, 0, alloc_size, host_ptr, 0, NULL, NULL);
-		util::assert_success(ret_code, "Failed to read from device");
-		if (alloc_size > env->prealloc_size) { clReleaseMemObject(temp_buf); }
+bool im_object::planar() const { return cl_storage == nullptr && planes[0] != nullptr; }
+
+std::shared_ptr<im_object> im_object::blank(cl_int2 size, cl_mem storage) const {
+	auto im = std::make_shared<im_object>(size, env, (storage == nullptr) ? alloc_storage(size) : storage, format, order);
+	im->buffered = buffered;
+	im->components = components;
+	im->depth = depth;
+	im->alloc_size = components * depth * size.x * size.y;
+	return im;
+}
+
+cl_mem im_object::alloc_storage(cl_int2 size) const {
+	if (!buffered) { return env->alloc_im(size, nullptr, order, format); }
+	return env->alloc_buf(CL_MEM_READ_WRITE, 4 * sizeof(cl_float) * size.x * size.y, nullptr);
+}
+
+void im_object::make_image() {
+	if (!buffered) { return; }
+	/* Buffer rows match CL_RGBA/CL_FLOAT layout, plain copy is enough */
+	cl_mem im = env->alloc_im(size, nullptr, CL_RGBA, CL_FLOAT);
+	size_t origin[3] = { 0, 0, 0 }, region[3] = { (size_t)size.x, (size_t)size.y, 1 };
+	cl_event copy_event = nullptr;
+	cl_int ret_code = clEnqueueCopyBufferToImage(env->queue(), cl_storage, im,
+		0, origin, region, 0, NULL, env->log_slot(&copy_event));
+	ret_code |= clFinish(env->queue());
+	util::assert_success(ret_code, "Failed to copy buffer to image");
+	if (copy_event != nullptr) {
+		env->log_event(copy_event, "copy_buffer_to_image", true, 4 * sizeof(cl_float) * size.x * size.y);
+		clReleaseEvent(copy_event);
 	}
-	return host_ptr;
+	clReleaseMemObject(cl_storage);
+	cl_storage = im;
+	buffered = false;
 }
 
-channels im_object::get_channels(int inverse_gamma) {
-	cl_mem temp_buf = (alloc_size > env->prealloc_size) ?
-		env->alloc_buf(CL_MEM_WRITE_ONLY, alloc_size, nullptr) : env->preallocation;
+namespace {
+	void assert_inside(cl_int4 rect, cl_int2 size) {
+		if (rect.s[0] < 0 || rect.s[1] < 0 || rect.s[2] <= 0 || rect.s[3] <= 0 ||
+			rect.s[0] + rect.s[2] > size.x || rect.s[1] + rect.s[3] > size.y) {
+			throw std::runtime_error("Region is outside of image");
+		}
+	}
 
-	cl_kernel kern = util::kernels->at("denormalise");
+	/* Rectangle copy between float4 buffers of given widths */
+	cl_int copy_buffer_rect(hardware* env, cl_mem src, cl_int src_width, cl_mem dst, cl_int dst_width,
+		cl_int4 rect, cl_int2 origin) {
+		size_t px = 4 * sizeof(cl_float);
+		size_t src_origin[3] = { rect.s[0] * px, (size_t)rect.s[1], 0 };
+		size_t dst_origin[3] = { origin.x * px, (size_t)origin.y, 0 };
+		size_t region[3] = { rect.s[2] * px, (size_t)rect.s[3], 1 };
+		return clEnqueueCopyBufferRect(env->queue(), src, dst, src_origin, dst_origin, region,
+			src_width * px, 0, dst_width * px, 0, 0, NULL, NULL);
+	}
+}
+
+std::shared_ptr<im_object> im_object::crop(cl_int4 rect) {
+	assert_inside(rect, size);
+	cl_int2 part_size = { rect.s[2], rect.s[3] };
+	size_t src_origin[3] = { (size_t)rect.s[0], (size_t)rect.s[1], 0 };
+	size_t dst_origin[3] = { 0, 0, 0 }, region[3] = { (size_t)part_size.x, (size_t)part_size.y, 1 };
+	std::shared_ptr<im_object> part = nullptr;
+	cl_int ret_code = CL_SUCCESS;
+	if (planar()) {
+		plane_set part_planes;
+		for (size_t p = 0; p < 3; ++p) {
+			part_planes[p] = env->alloc_im(part_size, nullptr, CL_R, format);
+			ret_code |= env->copy_image(planes[p], part_planes[p], src_origin, dst_origin, region, 0, nullptr, nullptr);
+		}
+		part = std::make_shared<im_object>(part_size, env, part_planes, format);
+		part->components = components;
+		part->depth = depth;
+		part->alloc_size = components * depth * part_size.x * part_size.y;
+	}
+	else {
+		part = blank(part_size);
+		if (buffered) { ret_code |= copy_buffer_rect(env, cl_storage, size.x, part->cl_storage, part_size.x, rect, { 0, 0 }); }
+		else { ret_code |= env->copy_image(cl_storage, part->cl_storage, src_origin, dst_origin, region, 0, nullptr, nullptr); }
+	}
+	ret_code |= clFinish(env->queue());
+	util::assert_success(ret_code, "Failed to crop image");
+	return part;
+}
+
+void im_object::paste(im_object& part, cl_int4 rect, cl_int2 origin) {
+	assert_inside(rect, part.size);
+	assert_inside({ { origin.x, origin.y, rect.s[2], rect.s[3] } }, size);
+	/* Layouts differ: bring part to the layout of this image */
+	if (planar() && !part.planar()) {
+		paste(*part.split(), rect, origin);
+		return;
+	}
+	if (!planar() && part.planar()) {
+		paste(*part.merge(), rect, origin);
+		return;
+	}
+	cl_int ret_code = CL_SUCCESS;
+	if (buffered && part.buffered) {
+		ret_code |= copy_buffer_rect(env, part.cl_storage, part.size.x, cl_storage, size.x, rect, origin);
+	}
+	else {
+		/* Kernel rather than image copy, formats may differ */
+		make_image(); part.make_image();
+		cl_kernel kern = env->utils->at("paste_region");
+		cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
+		cl_int2 shift = { rect.s[0] - origin.x, rect.s[1] - origin.y };
+		size_t global_offset[2] = { (size_t)origin.x, (size_t)origin.y };
+		size_t global_size[2] = { (size_t)rect.s[2], (size_t)rect.s[3] };
+		size_t pairs = planar() ? 3 : 1;
+		for (size_t p = 0; p < pairs; ++p) {
+			cl_mem from = planar() ? part.planes[p] : part.cl_storage, to = planar() ? planes[p] : cl_storage;
+			ret_code |= clSetKernelArg(kern, 0, sizeof(cl_mem), &from);
+			ret_code |= clSetKernelArg(kern, 1, sizeof(cl_sampler), &sampler);
+			ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &to);
+			ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int2), &shift);
+			cl_event kern_event = nullptr;
+			ret_code |= clEnqueueNDRangeKernel(env->queue(), kern, 2, global_offset, global_size, NULL,
+				0, NULL, env->log_slot(&kern_event));
+			if (kern_event != nullptr) {
+				env->log_event(kern_event, "paste_region");
+				clReleaseEvent(kern_event);
+			}
+		}
+	}
+	ret_code |= clFinish(env->queue());
+	util::assert_success(ret_code, "Failed to paste image");
+	device_written();
+}
+
+cl_channel_type im_object::plane_format(hardware* env, cl_channel_type format) {
+	cl_channel_type plane = env->supports(CL_R, format) ? format : CL_FLOAT;
+	if (!env->supports(CL_R, plane)) { throw std::runtime_error("Planar images are not supported by device"); }
+	return plane;
+}
+
+std::shared_ptr<im_object> im_object::split() {
+	make_image();
+	cl_channel_type split_format = plane_format(env, format);
+	plane_set split_planes;
+	for (cl_mem& plane : split_planes) { plane = env->alloc_im(size, nullptr, CL_R, split_format); }
+
+	cl_kernel kern = env->utils->at("split_planes");
 	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
 	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &cl_storage);
 	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_sampler), &sampler);
-	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &temp_buf);
-	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int2), &size);
-	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_int), &inverse_gamma);
+	for (cl_uint p = 0; p < 3; ++p) {
+		ret_code |= clSetKernelArg(kern, 2 + p, sizeof(cl_mem), &split_planes[p]);
+	}
+	cl_event kern_event = nullptr;
+	ret_code |= env->enqueue_kernel(kern, size, LAUNCH_PURE | LAUNCH_GUARDED, 0, NULL, env->log_slot(&kern_event));
+	ret_code |= clFinish(env->queue());
+	util::assert_success(ret_code, "Failed to split image");
+	if (kern_event != nullptr) {
+		env->log_event(kern_event, "split_planes");
+		clReleaseEvent(kern_event);
+	}
+	return std::make_shared<im_object>(size, env, split_planes, split_format);
+}
 
-	size_t global_size[2] = { (size_t)size.x, (size_t)size.y };
-	cl_event q_event = nullptr;
-	ret_code = clEnqueueNDRangeKernel(env->queue, kern,
-		2, NULL, global_size, NULL, 0, NULL, &q_event);
+std::shared_ptr<im_object> im_object::merge() {
+	auto merged = std::make_shared<im_object>(size, env, nullptr, format);
+	merged->components = components;
+	merged->depth = depth;
+	merged->alloc_size = alloc_size;
+	cl_kernel kern = env->utils->at("merge_planes");
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
+	cl_int ret_code = CL_SUCCESS;
+	for (cl_uint p = 0; p < 3; ++p) {
+		ret_code |= clSetKernelArg(kern, p, sizeof(cl_mem), &planes[p]);
+	}
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_sampler), &sampler);
+	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_mem), &merged->cl_storage);
+	cl_event kern_event = nullptr;
+	ret_code |= env->enqueue_kernel(kern, size, LAUNCH_PURE | LAUNCH_GUARDED, 0, NULL, env->log_slot(&kern_event));
+	ret_code |= clFinish(env->queue());
+	util::assert_success(ret_code, "Failed to merge image");
+	if (kern_event != nullptr) {
+		env->log_event(kern_event, "merge_planes");
+		clReleaseEvent(kern_event);
+	}
+	return merged;
+}
+
+bool im_object::host_valid(int gamma) const {
+	return host_ptr != nullptr && state != residency::device && host_gamma == gamma;
+}
+
+void im_object::device_written() { state = residency::device; }
+
+void im_object::host_written(int direct_gamma) {
+	if (host_ptr == nullptr) { throw std::runtime_error("No host copy to upload"); }
+	if (planar()) { throw std::runtime_error("Planar image must be merged before upload"); }
+	cl_mem temp_buf = (alloc_size > env->prealloc_size) ?
+		env->alloc_buf(CL_MEM_READ_ONLY, alloc_size, nullptr) : env->preallocation;
+	cl_event norm_event = upload_band(host_ptr, temp_buf, 0, size.y, direct_gamma);
+	cl_int ret_code = clWaitForEvents(1, &norm_event);
+	clReleaseEvent(norm_event);
+	if (alloc_size > env->prealloc_size) { clReleaseMemObject(temp_buf); }
+	util::assert_success(ret_code, "Failed to upload host copy");
+	state = residency::both;
+	host_gamma = direct_gamma;
+}
+
+char* im_object::get_host_ptr(int inverse_gamma) {
+	if (host_valid(inverse_gamma)) { return host_ptr; }
+	std::shared_ptr<im_object> merged = planar() ? merge() : nullptr;
+	im_object* packed = planar() ? merged.get() : this;
+	if (host_ptr == nullptr) { host_ptr = new char[alloc_size]; }
+	cl_mem temp_buf = (alloc_size > env->prealloc_size) ?
+		env->alloc_buf(CL_MEM_WRITE_ONLY, alloc_size, nullptr) : env->preallocation;
+	cl_event read_event = packed->download_band(host_ptr, temp_buf, 0, size.y, inverse_gamma);
+	cl_int ret_code = clWaitForEvents(1, &read_event);
+	clReleaseEvent(read_event);
+	if (alloc_size > env->prealloc_size) { clReleaseMemObject(temp_buf); }
+	util::assert_success(ret_code, "Failed to read from device");
+	state = residency::both;
+	host_gamma = inverse_gamma;
+	return host_ptr;
+}
 
-	size_t channel_size = size.x * size.y;
+channels im_object::get_channels(int inverse_gamma) {
+	/* Host copy is downloaded once and kept, channels are split from it; 16-bit samples give their high byte */
+	auto src = reinterpret_cast<unsigned char*>(get_host_ptr(inverse_gamma));
+	size_t channel_size = static_cast<size_t>(size.x) * size.y;
 	channels host_channels = { new char[channel_size], new char[channel_size], new char[channel_size] };
-	for (size_t channel = 0; channel < 2; ++channel) {
-		ret_code |= clEnqueueReadBuffer(env->queue, temp_buf, CL_FALSE,
-			channel_size * channel, channel_size, host_channels[channel], 1, &q_event, NULL);
+	for (size_t pix = 0; pix < channel_size; ++pix) {
+		for (size_t channel = 0; channel < 3; ++channel) {
+			size_t sample = pix * components + ((components < 3) ? 0 : channel);
+			host_channels[channel][pix] = static_cast<char>(src[sample * depth]);
+		}
 	}
-	util::assert_success(ret_code, "Failed to read from device");
-	if (alloc_size > env->prealloc_size) { clReleaseMemObject(temp_buf); }
 	return host_channels;
 }
 
@@ -101,16 +362,77 @@ histogram im_object::calc_histograms(int inverse_gamma) {
 	for (size_t channel = 0; channel < 4; ++channel) {
 		hist[channel].fill(0);
 	}
-	for (size_t pix = 0; pix < alloc_size; pix += 3) {
+	/* Grey samples count for every colour, 16-bit samples by their high byte */
+	size_t pixels = static_cast<size_t>(size.x) * size.y;
+	for (size_t pix = 0; pix < pixels; ++pix) {
 		for (size_t col = 0; col < 3; ++col) {
-			int val = static_cast<int>(src[pix + col]);
+			size_t sample = pix * components + ((components < 3) ? 0 : col);
+			int val = static_cast<int>(src[sample * depth]);
 			hist[col][val]++; hist[3][val]++;
 		}
 	}
 	return hist;
 }
 
+im_stats im_object::stat(cl_int4 rect) {
+	if (planar()) { return merge()->stat(rect); }
+	if (rect.s[2] == 0 || rect.s[3] == 0) { rect = { { 0, 0, size.x, size.y } }; }
+	if (rect.s[0] < 0 || rect.s[1] < 0 || rect.s[2] < 0 || rect.s[3] < 0 ||
+		rect.s[0] + rect.s[2] > size.x || rect.s[1] + rect.s[3] > size.y) {
+		throw std::runtime_error("Statistics rectangle is outside of image");
+	}
+
+	cl_kernel partial_kern = buffered ? env->utils->at("stat_partial", util::defines({ { "STAT_BUF", 1 } }))
+		: env->utils->at("stat_partial");
+	cl_kernel final_kern = buffered ? env->utils->at("stat_final", util::defines({ { "STAT_BUF", 1 } }))
+		: env->utils->at("stat_final");
+	size_t kern_max = 0, items = STAT_ITEMS;
+	clGetKernelWorkGroupInfo(partial_kern, env->cur_device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kern_max, NULL);
+	while (items > 1 && items > kern_max) { items /= 2; }
+	size_t area = static_cast<size_t>(rect.s[2]) * rect.s[3];
+	cl_int groups = static_cast<cl_int>(std::min<size_t>((area + items - 1) / items, STAT_GROUPS));
+	cl_mem partials = env->alloc_buf(CL_MEM_READ_WRITE, groups * sizeof(stat_rec), nullptr);
+
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
+	cl_int ret_code = clSetKernelArg(partial_kern, 0, sizeof(cl_mem), &cl_storage);
+	if (buffered) { ret_code |= clSetKernelArg(partial_kern, 1, sizeof(cl_int2), &size); }
+	else { ret_code |= clSetKernelArg(partial_kern, 1, sizeof(cl_sampler), &sampler); }
+	ret_code |= clSetKernelArg(partial_kern, 2, sizeof(cl_int4), &rect);
+	ret_code |= clSetKernelArg(partial_kern, 3, sizeof(cl_mem), &partials);
+	ret_code |= clSetKernelArg(partial_kern, 4, items * sizeof(stat_rec), NULL);
+	ret_code |= clSetKernelArg(final_kern, 0, sizeof(cl_mem), &partials);
+	ret_code |= clSetKernelArg(final_kern, 1, sizeof(cl_int), &groups);
+	ret_code |= clSetKernelArg(final_kern, 2, items * sizeof(stat_rec), NULL);
+	util::assert_success(ret_code, "Failed to set statistics args");
+
+	size_t global_size = groups * items;
+	cl_event events[2] = { nullptr, nullptr };
+	ret_code = clEnqueueNDRangeKernel(env->queue(), partial_kern, 1, NULL, &global_size, &items,
+		0, NULL, env->log_slot(&events[0]));
+	ret_code |= clEnqueueNDRangeKernel(env->queue(), final_kern, 1, NULL, &items, &items,
+		0, NULL, env->log_slot(&events[1]));
+	stat_rec total;
+	ret_code |= clEnqueueReadBuffer(env->queue(), partials, CL_TRUE, 0, sizeof(stat_rec), &total, 0, NULL, NULL);
+	clReleaseMemObject(partials);
+	util::assert_success(ret_code, "Failed to compute statistics");
+	for (cl_event& kern_event : events) {
+		if (kern_event == nullptr) { continue; }
+		env->log_event(kern_event, (&kern_event == events) ? "stat_partial" : "stat_final");
+		clReleaseEvent(kern_event);
+	}
+
+	im_stats result;
+	result.min = total.min_val; result.max = total.max_val; result.mean = total.mean;
+	result.pixels = total.pixels;
+	for (int ch = 0; ch < 4; ++ch) {
+		result.variance.s[ch] = total.m2.s[ch] / total.pixels;
+		result.sum.s[ch] = total.mean.s[ch] * total.pixels;
+	}
+	return result;
+}
+
 im_object::~im_object() {
 	if (cl_storage != nullptr) { clReleaseMemObject(cl_storage); }
+	for (cl_mem plane : planes) { if (plane != nullptr) { clReleaseMemObject(plane); } }
 	delete[] host_ptr;
 }
\ No newline at end of file
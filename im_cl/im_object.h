@@ -7,9 +7,26 @@
 struct util;
 using histogram = std::array<std::array<int, 256>, 4>;
 using channels = std::array<char*, 3>;
+using plane_set = std::array<cl_mem, 3>;
 
-#define GAMMA_CORRECTION_ON 1
-#define GAMMA_CORRECTION_OFF 0
+/* Per-channel statistics of device values, population variance */
+struct im_stats {
+	cl_float4 min, max, mean, variance, sum;
+	size_t pixels;
+};
+
+/* Transfer functions between 8-bit code values and linear light */
+#define TRANSFER_LINEAR 0
+#define TRANSFER_SRGB 1
+#define TRANSFER_REC709 2
+#define TRANSFER_GAMMA22 3
+
+#define GAMMA_CORRECTION_ON TRANSFER_SRGB
+#define GAMMA_CORRECTION_OFF TRANSFER_LINEAR
+
+/* Layout of transfer tables, must match utils.cl */
+#define TRANSFER_DECODE_SIZE 256
+#define TRANSFER_ENCODE_STEPS 4096
 
 struct im_object {
 	cl_int2 size;
@@ -17,21 +34,100 @@ struct im_object {
 
 	hardware* env;
 	cl_mem cl_storage = nullptr;
+
+	/* Channel type of cl_storage: CL_FLOAT, CL_HALF_FLOAT, CL_UNORM_INT8 or CL_UNORM_INT16 */
+	cl_channel_type format = CL_FLOAT;
+
+	/* CL_LUMINANCE for grey images if supported, CL_RGBA otherwise */
+	cl_channel_order order = CL_RGBA;
+
+	/* Host layout: samples per pixel (1 - 4) and bytes per sample (1 or 2) */
+	int components = 3;
+	int depth = 1;
+
+	/* Buffer layout: cl_storage is a linear buffer of float4 pixels, row after row */
+	bool buffered = false;
+
+	/* Planar layout: three single-channel CL_R images used instead of cl_storage */
+	plane_set planes = { nullptr, nullptr, nullptr };
 	char* host_ptr = nullptr;
 
+	/*
+	*  Which copies of content are current, host_ptr holds code values encoded with host_gamma.
+	*  Device is always current: executors read cl_storage directly, so host edits are uploaded at once
+	*/
+	enum class residency { device, both };
+	residency state = residency::device;
+	int host_gamma = GAMMA_CORRECTION_OFF;
+
 	
 	/* Construct empty image of given size, allocate non-empty buffer if needed */
-	im_object(cl_int2 size, hardware* env, cl_mem storage = nullptr);
+	im_object(cl_int2 size, hardware* env, cl_mem storage = nullptr,
+		cl_channel_type format = CL_FLOAT, cl_channel_order order = CL_RGBA);
+
+	/* Construct empty image for host data of given components and depth in the narrowest order keeping them */
+	im_object(cl_int2 size, hardware* env, cl_channel_type format, int components, int depth);
 
-	/* Construct image with content of 3-channel host_ptr, allocate empty buffer, keeps host_ptr */
-	im_object(char* host_ptr, size_t width, size_t height, hardware* env, int direct_gamma);
+	/* Construct image with content of host_ptr holding given components of given depth, keeps host_ptr */
+	im_object(char* host_ptr, size_t width, size_t height, hardware* env,
+		int direct_gamma, cl_channel_type format = CL_FLOAT, int components = 3, int depth = 1);
 
 
+	/* Construct planar image, takes ownership of planes */
+	im_object(cl_int2 size, hardware* env, plane_set planes, cl_channel_type format);
+
 	im_object(im_object&& other) noexcept;
 
+	bool planar() const;
+
+	/* Bytes of one host row */
+	size_t row_bytes() const;
+
 	/*
-	*  Return host_ptr if has one or enqueue buffer read for it.
-	*  Return pointer to sequence [ ... [pix.ch0 pix.ch1 pix.ch2] ... ]
+	*  Enqueue non-blocking copy of host rows [first_row, first_row + rows) into staging buffer
+	*  and their normalisation into the image, band must stay alive until returned event completes
+	*/
+	cl_event upload_band(const char* band, cl_mem staging, int first_row, int rows, int direct_gamma);
+
+	/* Reverse of upload_band, band is filled when returned event completes */
+	cl_event download_band(char* band, cl_mem staging, int first_row, int rows, int inverse_gamma);
+
+	/* Empty image of given size with the same device format and host layout */
+	std::shared_ptr<im_object> blank(cl_int2 size, cl_mem storage = nullptr) const;
+
+	/* Storage of the same kind and device format for an image of given size */
+	cl_mem alloc_storage(cl_int2 size) const;
+
+	/* Move buffer content into an image object, for kernels without a buffer variant */
+	void make_image();
+
+	/* Device copy of rect (x, y, width, height) with the same storage, format and host layout */
+	std::shared_ptr<im_object> crop(cl_int4 rect);
+
+	/* Copy rect of part over this image at origin, on device; drops host copy of content */
+	void paste(im_object& part, cl_int4 rect, cl_int2 origin);
+
+	/* Channel type for CL_R planes of an image stored in given format */
+	static cl_channel_type plane_format(hardware* env, cl_channel_type format);
+
+	/* Packed image -> three CL_R planes, source stays valid */
+	std::shared_ptr<im_object> split();
+
+	/* Three CL_R planes -> packed image, source stays valid */
+	std::shared_ptr<im_object> merge();
+
+	/* Host copy is current and encoded with given transfer, reading it costs no transfer */
+	bool host_valid(int gamma) const;
+
+	/* Device content changed in place, host copy is stale from now on */
+	void device_written();
+
+	/* host_ptr was edited with code values of given transfer, uploads them */
+	void host_written(int direct_gamma);
+
+	/*
+	*  Return host_ptr if it is current for inverse_gamma, read it back otherwise.
+	*  Return pointer to sequence [ ... [pix.ch0 ... pix.ch(components - 1)] ... ] of depth-byte samples
 	*/
 	char* get_host_ptr(int inverse_gamma);
 	
@@ -42,8 +138,11 @@ struct im_object {
 
 	histogram calc_histograms(int inverse_gamma);
 
-	/*int** historgrams();
-	std::pair<float*, float*> stat();*/
+	/*
+	*  Reduced on device, only the result is read back. rect: x, y, width, height,
+	*  zero width or height take the whole image
+	*/
+	im_stats stat(cl_int4 rect = { { 0, 0, 0, 0 } });
 
 	~im_object();
 };
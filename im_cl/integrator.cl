@@ -0,0 +1,132 @@
+#include "bounds.cl"
+
+/*
+*	Summed-area tables of float4 pixels in float-float form: float8 with the rounded sum in .lo
+*	and its rounding error in .hi, about 48 significant bits, so sums over tens of megapixels do not drift.
+*	Table is (width + 1) x (height + 1), row 0 and column 0 are zeros
+*/
+float8 ff_add(float8 a, float8 b) {
+	float4 s = a.lo + b.lo;
+	float4 v = s - a.lo;
+	float4 e = (a.lo - (s - v)) + (b.lo - v) + a.hi + b.hi;
+	float4 sum = s + e;
+	return (float8)(sum, e - (sum - s));
+}
+
+float4 ff_value(float8 a) { return a.lo + a.hi; }
+
+/*
+*	Blelloch scan of 2 * local size pixels of a row per work-group, inclusive sums to rows,
+*	block totals to totals[row * groups + block]. square takes squares of pixels
+*/
+__kernel void scan_rows(__read_only image2d_t src, sampler_t sampler, __global float8* rows,
+	__global float8* totals, int square, __local float8* temp) {
+	int lid = get_local_id(0), items = get_local_size(0), n = 2 * items;
+	int block = get_group_id(0), blocks = get_num_groups(0), row = get_global_id(1);
+	int width = get_image_width(src), x0 = block * n;
+	float8 orig[2];
+	for (int h = 0; h < 2; ++h) {
+		int x = x0 + lid + h * items;
+		float4 val = (x < width) ? read_imagef(src, sampler, (int2)(x, row)) : (float4)(0.0f);
+		if (square) { val *= val; }
+		orig[h] = (float8)(val, (float4)(0.0f));
+		temp[lid + h * items] = orig[h];
+	}
+
+	int offset = 1;
+	for (int d = items; d > 0; d >>= 1, offset <<= 1) {
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < d) {
+			int ai = offset * (2 * lid + 1) - 1, bi = offset * (2 * lid + 2) - 1;
+			temp[bi] = ff_add(temp[ai], temp[bi]);
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (lid == 0) {
+		totals[row * blocks + block] = temp[n - 1];
+		temp[n - 1] = (float8)(0.0f);
+	}
+	for (int d = 1; d < n; d <<= 1) {
+		offset >>= 1;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < d) {
+			int ai = offset * (2 * lid + 1) - 1, bi = offset * (2 * lid + 2) - 1;
+			float8 left = temp[ai];
+			temp[ai] = temp[bi];
+			temp[bi] = ff_add(temp[bi], left);
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for (int h = 0; h < 2; ++h) {
+		int x = x0 + lid + h * items;
+		if (x < width) { rows[row * width + x] = ff_add(temp[lid + h * items], orig[h]); }
+	}
+}
+
+/* Exclusive scan of block totals, one work-item per row, a few dozen blocks at most */
+__kernel void scan_totals(__global float8* totals, int blocks, int height) {
+	int row = get_global_id(0);
+	if (row >= height) { return; }
+	float8 run = (float8)(0.0f);
+	for (int b = 0; b < blocks; ++b) {
+		float8 total = totals[row * blocks + b];
+		totals[row * blocks + b] = run;
+		run = ff_add(run, total);
+	}
+}
+
+__kernel void add_totals(__global float8* rows, __global const float8* totals, int2 size, int block_size) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE_BUF(size, cd)) { return; }
+	int blocks = (size.x + block_size - 1) / block_size;
+	int index = cd.y * size.x + cd.x;
+	rows[index] = ff_add(rows[index], totals[cd.y * blocks + cd.x / block_size]);
+}
+
+/* One work-item per table column walks down the rows, neighbour items read neighbour pixels */
+__kernel void scan_cols(__global const float8* rows, __global float8* sat, int2 size) {
+	int x = get_global_id(0);
+	if (x > size.x) { return; }
+	float8 run = (float8)(0.0f);
+	sat[x] = run;
+	for (int y = 0; y < size.y; ++y) {
+		if (x > 0) { run = ff_add(run, rows[y * size.x + x - 1]); }
+		sat[(y + 1) * (size.x + 1) + x] = run;
+	}
+}
+
+/* Sum over pixels [lo, hi), corners of table */
+float4 box_sum(__global const float8* sat, int2 size, int2 lo, int2 hi) {
+	int pitch = size.x + 1;
+	float8 pos = ff_add(sat[hi.y * pitch + hi.x], sat[lo.y * pitch + lo.x]);
+	float8 neg = ff_add(sat[hi.y * pitch + lo.x], sat[lo.y * pitch + hi.x]);
+	return ff_value(ff_add(pos, -neg));
+}
+
+/* Window of (2 * radius + 1) pixels on each axis cut to the image, divided by its actual area */
+__kernel void box_mean(__global const float8* sat, int2 radius, __write_only image2d_t dst) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	int2 size = get_image_dim(dst);
+	int2 lo = max(cd - radius, 0), hi = min(cd + radius + 1, size);
+	float area = (float)((hi.x - lo.x) * (hi.y - lo.y));
+	write_imagef(dst, cd, box_sum(sat, size, lo, hi) / area);
+}
+
+/* (x - local mean) / local deviation, +-LCN_SIGMAS deviations mapped to [0, 1] */
+#define LCN_SIGMAS 3.0f
+
+__kernel void local_normalise(__read_only image2d_t src, sampler_t sampler, __global const float8* sat,
+	__global const float8* sat_sq, int2 radius, float eps, __write_only image2d_t dst) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	int2 size = get_image_dim(dst);
+	int2 lo = max(cd - radius, 0), hi = min(cd + radius + 1, size);
+	float area = (float)((hi.x - lo.x) * (hi.y - lo.y));
+	float4 mean = box_sum(sat, size, lo, hi) / area;
+	float4 variance = fmax(box_sum(sat_sq, size, lo, hi) / area - mean * mean, 0.0f);
+	float4 in_val = read_imagef(src, sampler, cd);
+	float4 out_val = 0.5f + (in_val - mean) / (2.0f * LCN_SIGMAS * fmax(sqrt(variance), eps));
+	out_val.w = in_val.w;
+	write_imagef(dst, cd, fmax((float4)0.0f, fmin(1.0f, out_val)));
+}
@@ -0,0 +1,118 @@
+#include"im_executors.h"
+
+/* Work-items of scan_rows, each scans two pixels; smaller groups on devices that cannot hold it */
+#define SCAN_ITEMS 256
+
+integrator::integrator(hardware* env, functions* kernels) : executor(env, kernels) {}
+
+cl_mem integrator::build(cl_mem src, cl_int2 size, bool squares) {
+	cl_kernel scan = kernels->at("scan_rows");
+	size_t kern_max = 0, items = SCAN_ITEMS;
+	clGetKernelWorkGroupInfo(scan, env->cur_device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kern_max, NULL);
+	size_t local_mem = hardware::device_param<cl_ulong>(env->cur_device, CL_DEVICE_LOCAL_MEM_SIZE);
+	while (items > 1 && (items > kern_max || 2 * items * sizeof(cl_float8) > local_mem)) { items /= 2; }
+	cl_int block_size = static_cast<cl_int>(2 * items);
+	cl_int blocks = (size.x + block_size - 1) / block_size;
+
+	size_t pixels = static_cast<size_t>(size.x) * size.y;
+	size_t table_size = static_cast<size_t>(size.x + 1) * (size.y + 1);
+	cl_mem rows = env->alloc_buf(CL_MEM_READ_WRITE, pixels * sizeof(cl_float8), nullptr);
+	cl_mem totals = env->alloc_buf(CL_MEM_READ_WRITE, static_cast<size_t>(blocks) * size.y * sizeof(cl_float8), nullptr);
+	cl_mem table = env->alloc_buf(CL_MEM_READ_WRITE, table_size * sizeof(cl_float8), nullptr);
+
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
+	cl_int square = squares ? 1 : 0;
+	cl_int ret_code = clSetKernelArg(scan, 0, sizeof(cl_mem), &src);
+	ret_code |= clSetKernelArg(scan, 1, sizeof(cl_sampler), &sampler);
+	ret_code |= clSetKernelArg(scan, 2, sizeof(cl_mem), &rows);
+	ret_code |= clSetKernelArg(scan, 3, sizeof(cl_mem), &totals);
+	ret_code |= clSetKernelArg(scan, 4, sizeof(cl_int), &square);
+	ret_code |= clSetKernelArg(scan, 5, 2 * items * sizeof(cl_float8), NULL);
+	util::assert_success(ret_code, "Failed to set scan args");
+	size_t global_size[2] = { blocks * items, static_cast<size_t>(size.y) };
+	size_t local_size[2] = { items, 1 };
+	run_direct(scan, global_size, local_size);
+
+	/* Rows wider than one block get offsets of preceding blocks */
+	if (blocks > 1) {
+		cl_kernel kern = kernels->at("scan_totals");
+		ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &totals);
+		ret_code |= clSetKernelArg(kern, 1, sizeof(cl_int), &blocks);
+		ret_code |= clSetKernelArg(kern, 2, sizeof(cl_int), &size.y);
+		util::assert_success(ret_code, "Failed to set scan args");
+		size_t rows_size[2] = { static_cast<size_t>(size.y), 1 };
+		run_direct(kern, rows_size, NULL);
+
+		kern = kernels->at("add_totals");
+		ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &rows);
+		ret_code |= clSetKernelArg(kern, 1, sizeof(cl_mem), &totals);
+		ret_code |= clSetKernelArg(kern, 2, sizeof(cl_int2), &size);
+		ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int), &block_size);
+		util::assert_success(ret_code, "Failed to set scan args");
+		size_t pixels_size[2] = { static_cast<size_t>(size.x), static_cast<size_t>(size.y) };
+		run_direct(kern, pixels_size, NULL);
+	}
+
+	cl_kernel cols = kernels->at("scan_cols");
+	ret_code = clSetKernelArg(cols, 0, sizeof(cl_mem), &rows);
+	ret_code |= clSetKernelArg(cols, 1, sizeof(cl_mem), &table);
+	ret_code |= clSetKernelArg(cols, 2, sizeof(cl_int2), &size);
+	util::assert_success(ret_code, "Failed to set scan args");
+	run_blocking(cols, { size.x + 1, 1 }, LAUNCH_PURE | LAUNCH_GUARDED);
+	clReleaseMemObject(rows); clReleaseMemObject(totals);
+	return table;
+}
+
+void integrator::run_direct(cl_kernel kern, const size_t* global_size, const size_t* local_size) {
+	cl_event kern_event = nullptr;
+	cl_int ret_code = clEnqueueNDRangeKernel(env->queue(), kern, 2, NULL, global_size, local_size,
+		0, NULL, env->log_slot(&kern_event));
+	ret_code |= clFinish(env->queue());
+	util::assert_success(ret_code, "Failed to run " + hardware::kernel_name(kern));
+	if (kern_event != nullptr) {
+		env->log_event(kern_event, hardware::kernel_name(kern));
+		clReleaseEvent(kern_event);
+	}
+}
+
+void integrator::box_mean(cl_mem table, cl_int2 radius, cl_mem dst, cl_int2 size) {
+	cl_kernel kern = kernels->at("box_mean");
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &table);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_int2), &radius);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &dst);
+	util::assert_success(ret_code, "Failed to set box args");
+	run_blocking(kern, size, LAUNCH_PURE | LAUNCH_GUARDED);
+}
+
+im_ptr integrator::box_blur(cl_int2 radius, im_ptr& src) {
+	if (radius.x < 0 || radius.y < 0) { throw std::runtime_error("Box radius must not be negative"); }
+	src->make_image();
+	cl_mem table = build(src->cl_storage, src->size, false);
+	im_ptr result = src->blank(src->size);
+	box_mean(table, radius, result->cl_storage, src->size);
+	clReleaseMemObject(table);
+	return std::move(result);
+}
+
+im_ptr integrator::local_normalise(int radius, float eps, im_ptr& src) {
+	if (radius < 1) { throw std::runtime_error("Normalisation radius must be positive"); }
+	if (eps <= 0.0f) { throw std::runtime_error("Normalisation epsilon must be positive"); }
+	src->make_image();
+	cl_mem table = build(src->cl_storage, src->size, false);
+	cl_mem table_sq = build(src->cl_storage, src->size, true);
+	im_ptr result = src->blank(src->size);
+	cl_kernel kern = kernels->at("local_normalise");
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
+	cl_int2 window = { radius, radius };
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &src->cl_storage);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_sampler), &sampler);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &table);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_mem), &table_sq);
+	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_int2), &window);
+	ret_code |= clSetKernelArg(kern, 5, sizeof(cl_float), &eps);
+	ret_code |= clSetKernelArg(kern, 6, sizeof(cl_mem), &result->cl_storage);
+	util::assert_success(ret_code, "Failed to set normalisation args");
+	run_blocking(kern, src->size, LAUNCH_PURE | LAUNCH_GUARDED);
+	clReleaseMemObject(table); clReleaseMemObject(table_sq);
+	return std::move(result);
+}
@@ -1,24 +1,309 @@
 #define _CRT_SECURE_NO_WARNINGS
 #include"io_manager.h"
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<functional>
+#include<exception>
+#include<vector>
+#include<cstring>
 
-im_ptr io_manager::load_pnm(hardware* env, const std::string& filename, int gamma) {
+/* Host band in flight between file and device */
+struct io_manager::band {
+	std::vector<char> data;
+	int first_row = 0, rows = 0;
+	cl_event done = nullptr;
+};
+
+/* Progress shared by file and device sides of a pipeline over STREAM_SLOTS bands */
+struct io_manager::band_stream {
+	std::mutex lock;
+	std::condition_variable changed;
+	int ready = 0, released = 0;
+	bool aborted = false;
+	std::exception_ptr error = nullptr;
+
+	/* Blocks until predicate holds, false if the pipeline was aborted */
+	bool wait(const std::function<bool()>& predicate) {
+		std::unique_lock<std::mutex> guard(lock);
+		changed.wait(guard, [&] { return aborted || predicate(); });
+		return !aborted;
+	}
+
+	void advance(int& counter) {
+		{ std::lock_guard<std::mutex> guard(lock); ++counter; }
+		changed.notify_all();
+	}
+
+	void abort(std::exception_ptr cause) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			aborted = true;
+			if (error == nullptr) { error = cause; }
+		}
+		changed.notify_all();
+	}
+};
+
+std::string io_manager::next_token(FILE* file) {
+	std::string token;
+	int c = fgetc(file);
+	while (c != EOF) {
+		if (c == '#') { while (c != EOF && c != '\n') { c = fgetc(file); } }
+		else if (isspace(c)) { if (!token.empty()) { break; } }
+		else { token.push_back(static_cast<char>(c)); }
+		c = fgetc(file);
+	}
+	return token;
+}
+
+void io_manager::stretch(char* samples, size_t count, int depth, size_t maxval) {
+	size_t full = (depth == 2) ? 65535 : 255;
+	auto bytes = reinterpret_cast<unsigned char*>(samples);
+	for (size_t s = 0; s < count; ++s) {
+		size_t code = (depth == 2) ? (bytes[2 * s] << 8) | bytes[2 * s + 1] : bytes[s];
+		code = std::min(full, (code * full + maxval / 2) / maxval);
+		if (depth == 2) {
+			bytes[2 * s] = static_cast<unsigned char>(code >> 8);
+			bytes[2 * s + 1] = static_cast<unsigned char>(code);
+		}
+		else { bytes[s] = static_cast<unsigned char>(code); }
+	}
+}
+
+int io_manager::band_rows(im_ptr& im) {
+	size_t rows = STREAM_BAND_BYTES / im->row_bytes();
+	return static_cast<int>(std::max<size_t>(1, std::min<size_t>(rows, im->size.y)));
+}
+
+void io_manager::await(band& cur) {
+	if (cur.done == nullptr) { return; }
+	cl_int ret_code = clWaitForEvents(1, &cur.done);
+	clReleaseEvent(cur.done);
+	cur.done = nullptr;
+	util::assert_success(ret_code, "Failed to transfer band");
+}
+
+io_manager::header io_manager::read_header(FILE* in_image, const std::string& filename) {
+	std::string magic = next_token(in_image);
+	size_t w = 0, h = 0, maxval = 0;
+	int components = 0;
+	if (magic == "P5" || magic == "P6") {
+		w = atoi(next_token(in_image).c_str());
+		h = atoi(next_token(in_image).c_str());
+		maxval = atoi(next_token(in_image).c_str());
+		components = (magic == "P5") ? 1 : 3;
+	}
+	else if (magic == "P7") {
+		for (std::string key = next_token(in_image); key != "ENDHDR"; key = next_token(in_image)) {
+			if (key.empty()) { break; }
+			else if (key == "WIDTH") { w = atoi(next_token(in_image).c_str()); }
+			else if (key == "HEIGHT") { h = atoi(next_token(in_image).c_str()); }
+			else if (key == "DEPTH") { components = atoi(next_token(in_image).c_str()); }
+			else if (key == "MAXVAL") { maxval = atoi(next_token(in_image).c_str()); }
+			else if (key == "TUPLTYPE") { next_token(in_image); }
+		}
+	}
+	else {
+		fclose(in_image);
+		throw std::runtime_error("Unsupported format " + magic + " in " + filename);
+	}
+	if (w == 0 || h == 0 || maxval == 0 || maxval > 65535 || components < 1 || components > 4) {
+		fclose(in_image);
+		throw std::runtime_error("Malformed header of " + filename);
+	}
+	return { w, h, maxval, components };
+}
+
+cl_int2 io_manager::size_pnm(const std::string& filename) {
+	FILE* in_image = fopen(filename.c_str(), "rb");
+	if (in_image == nullptr) { throw std::runtime_error("Failed to open " + filename); }
+	header head = read_header(in_image, filename);
+	fclose(in_image);
+	return { { (cl_int)head.w, (cl_int)head.h } };
+}
+
+im_ptr io_manager::load_pnm(hardware* env, const std::string& filename, int gamma, cl_channel_type format, cl_int4 window) {
 	FILE* in_image = fopen(filename.c_str(), "rb");
 	if (in_image == nullptr) { throw std::runtime_error("Failed to open " + filename); }
-	char f[4]; size_t w, h, m;
-	int head = fscanf(in_image, "%s\n%u %u\n%u\n", f, &w, &h, &m);
-	char* source = new char[3 * w * h];
-	fread(source, 1, 3ull * w * h, in_image);
-	im_ptr im = std::make_shared<im_object>(source, w, h, env, gamma);
+	header head = read_header(in_image, filename);
+	size_t w = head.w, h = head.h, maxval = head.maxval;
+	int components = head.components;
+	if (window.s[2] == 0 || window.s[3] == 0) { window = { { 0, 0, (cl_int)w, (cl_int)h } }; }
+	if (window.s[0] < 0 || window.s[1] < 0 || window.s[2] < 0 || window.s[3] < 0 ||
+		(size_t)window.s[0] + window.s[2] > w || (size_t)window.s[1] + window.s[3] > h) {
+		fclose(in_image);
+		throw std::runtime_error("Window is outside of " + filename);
+	}
+
+	int depth = (maxval > 255) ? 2 : 1;
+	size_t full = (depth == 2) ? 65535 : 255;
+	/* Samples outside window are skipped in file, only the window is uploaded and normalised */
+	long pixel_bytes = static_cast<long>(components) * depth;
+	long skip_left = window.s[0] * pixel_bytes, skip_right = (static_cast<long>(w) - window.s[0] - window.s[2]) * pixel_bytes;
+	im_ptr im = std::make_shared<im_object>(cl_int2{ window.s[2], window.s[3] }, env, format, components, depth);
+	int rows = band_rows(im), band_count = (im->size.y + rows - 1) / rows;
+	std::vector<band> slots(STREAM_SLOTS);
+	std::vector<cl_mem> staging(STREAM_SLOTS);
+	for (size_t slot = 0; slot < STREAM_SLOTS; ++slot) {
+		slots[slot].data.resize(rows * im->row_bytes());
+		staging[slot] = env->alloc_buf(CL_MEM_READ_ONLY, slots[slot].data.size(), nullptr);
+	}
+
+	/* Reader thread fills bands ahead while previous ones are uploaded and normalised */
+	band_stream stream;
+	std::thread reader([&] {
+		try {
+			/* Row by row, so that offsets stay small on platforms with 32-bit long */
+			for (int row = 0; row < window.s[1]; ++row) {
+				if (fseek(in_image, static_cast<long>(w) * pixel_bytes, SEEK_CUR) != 0) {
+					throw std::runtime_error("Unexpected end of " + filename);
+				}
+			}
+			for (int b = 0; b < band_count; ++b) {
+				if (!stream.wait([&] { return b < stream.released + STREAM_SLOTS; })) { return; }
+				band& cur = slots[b % STREAM_SLOTS];
+				cur.first_row = b * rows;
+				cur.rows = std::min(rows, im->size.y - cur.first_row);
+				size_t samples = cur.rows * static_cast<size_t>(window.s[2]) * components;
+				if (skip_left == 0 && skip_right == 0) {
+					if (fread(cur.data.data(), depth, samples, in_image) != samples) {
+						throw std::runtime_error("Unexpected end of " + filename);
+					}
+				}
+				else {
+					size_t row_samples = samples / cur.rows;
+					for (int row = 0; row < cur.rows; ++row) {
+						if (fseek(in_image, skip_left, SEEK_CUR) != 0 ||
+							fread(cur.data.data() + row * im->row_bytes(), depth, row_samples, in_image) != row_samples ||
+							fseek(in_image, skip_right, SEEK_CUR) != 0) {
+							throw std::runtime_error("Unexpected end of " + filename);
+						}
+					}
+				}
+				/* Tables assume full range of depth */
+				if (maxval != full) { stretch(cur.data.data(), samples, depth, maxval); }
+				stream.advance(stream.ready);
+			}
+		}
+		catch (...) { stream.abort(std::current_exception()); }
+	});
+	try {
+		for (int b = 0; b < band_count; ++b) {
+			if (!stream.wait([&] { return stream.ready > b; })) { break; }
+			band& cur = slots[b % STREAM_SLOTS];
+			cur.done = im->upload_band(cur.data.data(), staging[b % STREAM_SLOTS], cur.first_row, cur.rows, gamma);
+			clFlush(env->queue());
+			int oldest = b + 1 - STREAM_SLOTS;
+			if (oldest >= 0) {
+				await(slots[oldest % STREAM_SLOTS]);
+				stream.advance(stream.released);
+			}
+		}
+		for (band& cur : slots) { await(cur); }
+	}
+	catch (...) { stream.abort(std::current_exception()); }
+	reader.join();
 	fclose(in_image);
+
+	clFinish(env->queue());
+	for (band& cur : slots) { if (cur.done != nullptr) { clReleaseEvent(cur.done); } }
+	for (cl_mem buf : staging) { clReleaseMemObject(buf); }
+	if (stream.error != nullptr) { std::rethrow_exception(stream.error); }
 	return std::move(im);
 }
 
+namespace {
+	/* Pixels of components samples each, only the first out_components of them go to file */
+	void write_samples(const char* data, size_t pixels, int components, int depth, int out_components, FILE* out_image) {
+		if (out_components == components) { fwrite(data, depth, pixels * components, out_image); return; }
+		for (size_t pix = 0; pix < pixels; ++pix) {
+			fwrite(data + pix * components * depth, depth, out_components, out_image);
+		}
+	}
+}
+
+void io_manager::write_bands(im_ptr& storage, FILE* out_image, int inverse_gamma, int out_components) {
+	/* Current host copy goes to file as is */
+	if (storage->host_valid(inverse_gamma)) {
+		write_samples(storage->host_ptr, static_cast<size_t>(storage->size.x) * storage->size.y,
+			storage->components, storage->depth, out_components, out_image);
+		return;
+	}
+	hardware* env = storage->env;
+	im_ptr packed = storage->planar() ? storage->merge() : storage;
+	int components = packed->components, depth = packed->depth;
+
+	/* Bands are kept as host copy, so further saves and host statistics with this transfer need no readback */
+	storage->device_written();
+	if (storage->host_ptr == nullptr) { storage->host_ptr = new char[packed->alloc_size]; }
+	char* host_copy = storage->host_ptr;
+	int rows = band_rows(packed), band_count = (packed->size.y + rows - 1) / rows;
+	std::vector<band> slots(STREAM_SLOTS);
+	std::vector<cl_mem> staging(STREAM_SLOTS);
+	for (size_t slot = 0; slot < STREAM_SLOTS; ++slot) {
+		slots[slot].data.resize(rows * packed->row_bytes());
+		staging[slot] = env->alloc_buf(CL_MEM_WRITE_ONLY, slots[slot].data.size(), nullptr);
+	}
+
+	/* Writer thread drains bands while next ones are denormalised and read back */
+	band_stream stream;
+	std::thread writer([&] {
+		try {
+			for (int b = 0; b < band_count; ++b) {
+				if (!stream.wait([&] { return stream.ready > b; })) { return; }
+				band& cur = slots[b % STREAM_SLOTS];
+				await(cur);
+				size_t pixels = static_cast<size_t>(cur.rows) * packed->size.x;
+				write_samples(cur.data.data(), pixels, components, depth, out_components, out_image);
+				memcpy(host_copy + cur.first_row * packed->row_bytes(), cur.data.data(), cur.rows * packed->row_bytes());
+				stream.advance(stream.released);
+			}
+		}
+		catch (...) { stream.abort(std::current_exception()); }
+	});
+	try {
+		for (int b = 0; b < band_count; ++b) {
+			if (!stream.wait([&] { return b < stream.released + STREAM_SLOTS; })) { break; }
+			band& cur = slots[b % STREAM_SLOTS];
+			cur.first_row = b * rows;
+			cur.rows = std::min(rows, packed->size.y - cur.first_row);
+			cur.done = packed->download_band(cur.data.data(), staging[b % STREAM_SLOTS],
+				cur.first_row, cur.rows, inverse_gamma);
+			clFlush(env->queue());
+			stream.advance(stream.ready);
+		}
+	}
+	catch (...) { stream.abort(std::current_exception()); }
+	writer.join();
+
+	clFinish(env->queue());
+	for (band& cur : slots) { if (cur.done != nullptr) { clReleaseEvent(cur.done); } }
+	for (cl_mem buf : staging) { clReleaseMemObject(buf); }
+	if (stream.error != nullptr) { std::rethrow_exception(stream.error); }
+	storage->state = im_object::residency::both;
+	storage->host_gamma = inverse_gamma;
+}
+
 void io_manager::write_pnm(im_ptr& storage, const std::string& filename, int inverse_gamma) {
 	FILE* out_image = fopen(filename.c_str(), "wb");
 	if (out_image == nullptr) { throw std::runtime_error("Failed to open " + filename); }
-	fprintf(out_image, "P6\n%d %d\n%d\n", storage->size.x, storage->size.y, 255);
-	char* src = storage->get_host_ptr(inverse_gamma);
-	fwrite(src, 1, 3ull * storage->size.x * storage->size.y, out_image);
+	int out_components = (storage->components < 3) ? 1 : 3;
+	fprintf(out_image, "P%d\n%d %d\n%d\n", (out_components == 1) ? 5 : 6,
+		storage->size.x, storage->size.y, (storage->depth == 2) ? 65535 : 255);
+	try { write_bands(storage, out_image, inverse_gamma, out_components); }
+	catch (...) { fclose(out_image); throw; }
 	fclose(out_image);
 }
 
+void io_manager::write_pam(im_ptr& storage, const std::string& filename, int inverse_gamma) {
+	static const char* tuple_types[] = { "GRAYSCALE", "GRAYSCALE_ALPHA", "RGB", "RGB_ALPHA" };
+	FILE* out_image = fopen(filename.c_str(), "wb");
+	if (out_image == nullptr) { throw std::runtime_error("Failed to open " + filename); }
+	int components = storage->components;
+	fprintf(out_image, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL %d\nTUPLTYPE %s\nENDHDR\n", storage->size.x,
+		storage->size.y, components, (storage->depth == 2) ? 65535 : 255, tuple_types[components - 1]);
+	try { write_bands(storage, out_image, inverse_gamma, components); }
+	catch (...) { fclose(out_image); throw; }
+	fclose(out_image);
+}
@@ -4,9 +4,51 @@
 #include<string>
 #include<iostream>
 #include<fstream>
+#include<algorithm>
+
+/* Bands in flight at once and bytes of host rows in one band */
+#define STREAM_SLOTS 3
+#define STREAM_BAND_BYTES (4 << 20)
 
 struct io_manager {
-	static im_ptr load_pnm(hardware* env, const std::string& filename, int gamma);
+	/*
+	*  Reads P5, P6 and P7 (PAM) of 1 - 4 channels and 8 or 16 bits, keeping native layout.
+	*  Row bands are read on a background thread while previous ones are uploaded.
+	*  Non-empty window (x, y, width, height) reads and uploads only that rectangle
+	*/
+	static im_ptr load_pnm(hardware* env, const std::string& filename, int gamma, cl_channel_type format, cl_int4 window);
+
+	/* Width and height from header only */
+	static cl_int2 size_pnm(const std::string& filename);
 
+	/* P5 for grey images, P6 otherwise, alpha is dropped */
 	static void write_pnm(im_ptr& storage, const std::string& filename, int inverse_gamma);
+
+	static void write_pam(im_ptr& storage, const std::string& filename, int inverse_gamma);
+
+private:
+	struct band;
+	struct band_stream;
+
+	struct header {
+		size_t w, h, maxval;
+		int components;
+	};
+
+	/* Parses header up to the first sample, closes file and throws if it is malformed */
+	static header read_header(FILE* in_image, const std::string& filename);
+
+	/* Next whitespace-separated header token, skips comments */
+	static std::string next_token(FILE* file);
+
+	/* Rescale samples of given maxval to full range of depth */
+	static void stretch(char* samples, size_t count, int depth, size_t maxval);
+
+	static int band_rows(im_ptr& im);
+
+	/* Wait for transfer of band and release its event */
+	static void await(band& cur);
+
+	/* Stream image to file by bands written on a background thread, keeps out_components of each pixel */
+	static void write_bands(im_ptr& storage, FILE* out_image, int inverse_gamma, int out_components);
 };
\ No newline at end of file
@@ -1,13 +1,29 @@
 #include"app.h"
+#include"server.h"
+#include"pool.h"
+#include<algorithm>
+#include<fstream>
+#include<chrono>
+#include<iomanip>
 
-app* app_ptr = nullptr;
+/* Thread-local so that pool workers run the same commands on their own devices */
+thread_local app* app_ptr = nullptr;
 
-enum class commands { INIT, ENV, DEV, QUIT, ZOOM, CONVERSE, ROTATE, CONTRAST, GAUSS, WAVELET };
+/* All devices of the node, opened on first batch */
+pool* pool_ptr = nullptr;
+
+enum class commands { INIT, ENV, DEV, QUIT, ZOOM, CONVERSE, ROTATE, CONTRAST, GAUSS, WAVELET, GRADE, GAMMA, PROFILE, SERVE, BATCH, TUNE, MEDIAN, SMOOTH, MORPH, CONV, NOTCH, BOX, LCN, STAT, COMPARE };
 
 std::unordered_map<std::string, commands> command_ids = {
 		{"init", commands::INIT}, {"env", commands::ENV}, {"dev", commands::DEV}, {"quit", commands::QUIT},
 		{"zoom", commands::ZOOM}, {"converse", commands::CONVERSE}, {"rotate", commands::ROTATE},
-	{"contrast", commands::CONTRAST}, {"gauss", commands::GAUSS}
+	{"contrast", commands::CONTRAST}, {"gauss", commands::GAUSS}, {"grade", commands::GRADE},
+	{"gamma", commands::GAMMA}, {"profile", commands::PROFILE}, {"serve", commands::SERVE},
+	{"batch", commands::BATCH}, {"tune", commands::TUNE}, {"median", commands::MEDIAN},
+	{"smooth", commands::SMOOTH}, {"morph", commands::MORPH},
+	{"conv", commands::CONV}, {"notch", commands::NOTCH},
+	{"box", commands::BOX}, {"lcn", commands::LCN}, {"stat", commands::STAT},
+	{"compare", commands::COMPARE}
 };
 
 std::unordered_map<commands, std::string> cmd_syntax = {
@@ -15,9 +31,24 @@ std::unordered_map<commands, std::string> cmd_syntax = {
 	{commands::INIT, "init [-p] <platform_id> [-d] <device_id> [-m storage_size]"},
 	{commands::CONVERSE, "converse [-i] <input> -o <output> [-t <to_cs>] [-f <from_cs>]"},
 	{commands::ROTATE, "rotate [-i] <input> -o <output> -a <angle> [-x <center.x> -y <center.y>] [-t <type>]"},
-	{commands::GAUSS, "gauss <input> -o <output> [-s <sigma>] [-w <window_size>]"},
-	{commands::CONTRAST, "contrast <input> -o <output> [-t <type>] [-v <via_space>] [-c <contrast_val>] [-e <exclusion>] [-x <x_region> -y <y_region>] "},
-	{commands::WAVELET, "wavelet <input> -o <output> [-b <basis>] [-t <threshold>]"}
+	{commands::GAUSS, "gauss <input> -o <output> [-s <sigma>] [-w <window_size>] [-m auto|spatial|fft]"},
+	{commands::CONTRAST, "contrast <input> -o <output> [-t <type>] [-v <via_space>] [-c <contrast_val>] [-e <exclusion>] [-x <x_region> -y <y_region>] [-r <reference>]"},
+	{commands::WAVELET, "wavelet <input> -o <output> [-b <basis>] [-t <threshold>]"},
+	{commands::GRADE, "grade <input> -o <output> (-l <lut.cube> | [-v <via_space>] -c <contrast_val>) [-t <interpolation>] [-n <lut_size>]"},
+	{commands::GAMMA, "gamma [<transfer>]"},
+	{commands::PROFILE, "profile on|off|report"},
+	{commands::SERVE, "serve <socket_path> [-q <capacity>] [-w <workers>]"},
+	{commands::BATCH, "batch <job_file>"},
+	{commands::TUNE, "tune on|off|show|clear"},
+	{commands::MEDIAN, "median <input> -o <output> [-r <radius>]"},
+	{commands::SMOOTH, "smooth <input> -o <output> [-t bilateral|guided] [-r <radius>] [-s <sigma_space>] [-c <sigma_colour>] [-e <epsilon>]"},
+	{commands::MORPH, "morph <input> -o <output> -t erode|dilate|open|close|tophat|blackhat [-x <width>] [-y <height>]"},
+	{commands::CONV, "conv <input> -o <output> -k <kernel_file> [-m auto|spatial|fft]"},
+	{commands::NOTCH, "notch <input> -o <output> -f <fx>,<fy>[;<fx>,<fy>...] [-w <width>]"},
+	{commands::BOX, "box <input> -o <output> [-x <radius_x>] [-y <radius_y>]"},
+	{commands::LCN, "lcn <input> -o <output> [-r <radius>] [-e <epsilon>]"},
+	{commands::STAT, "stat <input> [-x <left> -y <top> -w <width> -h <height>]"},
+	{commands::COMPARE, "compare <input> <reference> [-e <error_map>] [-s <ssim_map>]"}
 };
 
 struct wrong_usage : public std::runtime_error {
@@ -30,255 +61,643 @@ void assert_init() {
 }
 
 
-int main(int argc, char** argv) {
-	try { app_ptr = new app(0, 0); }
-	catch (std::runtime_error e) { 
-		std::cerr << " Default init failed:" << 
-			std::endl << e.what() << std::endl;
-	}
-	while (true) {
-		std::cout << "> ";
-		command cmd = util::next_action();
-		auto cmd_index = command_ids.find(cmd.first);
-		if (cmd_index == command_ids.end()) {
-			std::cerr << "Unknown command: " << cmd.first << std::endl;
-			continue;
-		}
-		try {
-			switch (cmd_index->second) {
-			case commands::INIT: {
-				std::string platform = cmd.second["-p"];
-				if (platform.empty()) { platform = cmd.second["arg0"]; }
-				std::string device = cmd.second["-d"];
-				if (platform.empty()) { device = cmd.second["arg1"]; }
-				if (platform.empty() || device.empty()) { throw wrong_usage(); }
+void run_command(command& cmd);
 
-				delete app_ptr;
-				app_ptr = new app(atoi(platform.c_str()), atoi(device.c_str()));
-				break;
-			}
-			case commands::ENV: {
-				if (app_ptr != nullptr) { app_ptr->env_info(); }
-				else { hardware::env_info(); }
-				break;
-			}
-			case commands::DEV: {
-				assert_init();
-				hardware::device_info(app_ptr->env.cur_device);
-				break;
-			}
-			case commands::QUIT: { goto app_exit; }
+/* Run one command against app_ptr, throws wrong_usage or std::runtime_error */
+void execute(command& cmd, commands id) {
+	switch (id) {
+	case commands::INIT: {
+		std::string platform = cmd.second["-p"];
+		if (platform.empty()) { platform = cmd.second["arg0"]; }
+		std::string device = cmd.second["-d"];
+		if (platform.empty()) { device = cmd.second["arg1"]; }
+		if (platform.empty() || device.empty()) { throw wrong_usage(); }
 
-			case commands::ZOOM: {
-				assert_init();
-				std::string input = cmd.second["-i"], kern_type = cmd.second["-t"];
-				if (input.empty()) { input = cmd.second["arg0"]; }
-				if (kern_type.empty()) { kern_type = "bilinear"; }
-				if (input.empty() || cmd.second["-o"].empty()) { throw wrong_usage(); }
+		delete app_ptr;
+		app_ptr = new app(atoi(platform.c_str()), atoi(device.c_str()));
+		break;
+	}
+	case commands::ENV: {
+		if (app_ptr != nullptr) { app_ptr->env_info(); }
+		else { hardware::env_info(); }
+		break;
+	}
+	case commands::DEV: {
+		assert_init();
+		hardware::device_info(app_ptr->env.cur_device);
+		break;
+	}
+	case commands::QUIT: { break; }
 
-				im_ptr src = app_ptr->get_im(input);
-				im_ptr scaled = nullptr;
+	case commands::ZOOM: {
+		assert_init();
+		std::string input = cmd.second["-i"], kern_type = cmd.second["-t"];
+		if (input.empty()) { input = cmd.second["arg0"]; }
+		if (kern_type.empty()) { kern_type = "bilinear"; }
+		if (input.empty() || cmd.second["-o"].empty()) { throw wrong_usage(); }
 
-				if (cmd.second["-x"].empty() && cmd.second["-y"].empty()) {
-					if (cmd.second["-f"].empty()) { throw wrong_usage(); }
-					float factor = atoi(cmd.second["-f"].c_str()) / 100.0f;
-					scaled = app_ptr->zoomer_ptr->run(kern_type, factor, src);
-				}
-				else {
-					if (cmd.second["-x"].empty() || cmd.second["-y"].empty()) { throw wrong_usage(); };
-					int new_x = atoi(cmd.second["-x"].c_str()), new_y = atoi(cmd.second["-y"].c_str());
-					scaled = app_ptr->zoomer_ptr->precise(src, { new_x, new_y });
-				}
-				app_ptr->put_im(cmd.second["-o"], scaled);
-				break;
-			}
-			case commands::CONVERSE: {
-				assert_init();
-				std::string input = cmd.second["-i"];
-				std::string to = cmd.second["-t"], from = cmd.second["-f"];
-				if (input.empty()) { input = cmd.second["arg0"]; }
+		im_ptr src = app_ptr->get_im(input, app_ptr->transfer, app_ptr->storage_for(app_ptr->transfer, 1));
+		im_ptr scaled = nullptr;
+
+		if (cmd.second["-x"].empty() && cmd.second["-y"].empty()) {
+			if (cmd.second["-f"].empty()) { throw wrong_usage(); }
+			float factor = atoi(cmd.second["-f"].c_str()) / 100.0f;
+			scaled = app_ptr->zoomer_ptr->run(kern_type, factor, src);
+		}
+		else {
+			if (cmd.second["-x"].empty() || cmd.second["-y"].empty()) { throw wrong_usage(); };
+			int new_x = atoi(cmd.second["-x"].c_str()), new_y = atoi(cmd.second["-y"].c_str());
+			scaled = app_ptr->zoomer_ptr->precise(src, { new_x, new_y });
+		}
+		app_ptr->put_im(cmd.second["-o"], scaled, app_ptr->transfer);
+		break;
+	}
+	case commands::CONVERSE: {
+		assert_init();
+		std::string input = cmd.second["-i"];
+		std::string to = cmd.second["-t"], from = cmd.second["-f"];
+		if (input.empty()) { input = cmd.second["arg0"]; }
 
-				if (to.empty() && from.empty()) { throw wrong_usage(); }
-				if (input.empty() || cmd.second["-o"].empty()) { throw wrong_usage(); }
+		if (to.empty() && from.empty()) { throw wrong_usage(); }
+		if (input.empty() || cmd.second["-o"].empty()) { throw wrong_usage(); }
 
-				if (from.empty()) { from = "srgb"; }
-				else if (to.empty()) { to = "srgb"; }
+		if (from.empty()) { from = "srgb"; }
+		else if (to.empty()) { to = "srgb"; }
 
-				im_ptr src = app_ptr->get_im(input, GAMMA_CORRECTION_OFF);
-				im_ptr conversed = app_ptr->converser_ptr->run({ from, to }, src);
-				app_ptr->put_im(cmd.second["-o"], conversed, GAMMA_CORRECTION_OFF);
-				break;
+		im_ptr src = app_ptr->get_im(input, GAMMA_CORRECTION_OFF, app_ptr->storage_for(GAMMA_CORRECTION_OFF, 1));
+		im_ptr conversed = app_ptr->converser_ptr->run({ from, to }, src);
+		app_ptr->put_im(cmd.second["-o"], conversed, GAMMA_CORRECTION_OFF);
+		break;
+	}
+	case commands::ROTATE: {
+		assert_init();
+		std::string input = cmd.second["-i"], algo = cmd.second["-t"];
+		if (input.empty()) { input = cmd.second["arg0"]; }
+		if (cmd.second["-a"].empty() || input.empty() ||
+			cmd.second["-o"].empty()) { throw wrong_usage(); }
+		
+		if (algo.empty()) { algo = "shear"; }
+		im_ptr src = app_ptr->get_im(input, app_ptr->transfer, app_ptr->storage_for(app_ptr->transfer, 1));
+		im_ptr rotated = nullptr;
+		if (algo == "clockwise" || algo == "counter_clockwise") {
+			rotated = app_ptr->rotator_ptr->simple_angle(algo, src);
+		}
+		else {
+			cl_int2 center = { src->size.x / 2, src->size.y / 2 };
+			if (!cmd.second["-x"].empty() && !cmd.second["-y"].empty()) {
+				center.x = atoi(cmd.second["-x"].c_str());
+				center.y = atoi(cmd.second["-y"].c_str());
 			}
-			case commands::ROTATE: {
-				assert_init();
-				std::string input = cmd.second["-i"], algo = cmd.second["-t"];
-				if (input.empty()) { input = cmd.second["arg0"]; }
-				if (cmd.second["-a"].empty() || input.empty() ||
-					cmd.second["-o"].empty()) { throw wrong_usage(); }
-				
-				if (algo.empty()) { algo = "shear"; }
-				im_ptr src = app_ptr->get_im(input);
-				im_ptr rotated = nullptr;
-				if (algo == "clockwise" || algo == "counter_clockwise") {
-					rotated = app_ptr->rotator_ptr->simple_angle(algo, src);
-				}
-				else {
-					cl_int2 center = { src->size.x / 2, src->size.y / 2 };
-					if (!cmd.second["-x"].empty() && !cmd.second["-y"].empty()) {
-						center.x = atoi(cmd.second["-x"].c_str());
-						center.y = atoi(cmd.second["-y"].c_str());
-					}
-					double theta = atof(cmd.second["-a"].c_str());
-					rotated = app_ptr->rotator_ptr->run(algo, theta, center, src);
-				}
-				app_ptr->put_im(cmd.second["-o"], rotated);
-				break;
+			double theta = atof(cmd.second["-a"].c_str());
+			rotated = app_ptr->rotator_ptr->run(algo, theta, center, src);
+		}
+		app_ptr->put_im(cmd.second["-o"], rotated, app_ptr->transfer);
+		break;
+	}
+	case commands::CONTRAST: {
+		assert_init();
+		std::string input = cmd.second["arg0"], algo = cmd.second["-t"];
+		if (input.empty()) { input = cmd.second["-i"]; }
+		if (input.empty() || cmd.second["-o"].empty()) { throw wrong_usage(); }
+		size_t passes = cmd.second["-v"].empty() ? 1 : 3;
+		im_ptr src = app_ptr->get_im(input, GAMMA_CORRECTION_OFF, app_ptr->storage_for(GAMMA_CORRECTION_OFF, passes));
+		int channel_mode = contraster::all_channels;
+		if (!cmd.second["-v"].empty()) {
+			channel_mode = contraster::single_channel;
+			im_ptr coloured = app_ptr->converser_ptr->run({ "srgb", cmd.second["-v"] }, src, true);
+			src.swap(coloured);
+		}
+		if (algo.empty()) { algo = "manual"; }
+		im_ptr contrasted = nullptr;
+		if (algo == "manual") {
+			if (cmd.second["-c"].empty()) { throw wrong_usage(); }
+			float c_val = static_cast<float>(atof(cmd.second["-c"].c_str()));
+			contrasted = app_ptr->contraster_ptr->manual(src, c_val, channel_mode);
+		}
+		else if (algo == "exclusive") {
+			std::string excl_str = cmd.second["-e"];
+			if (excl_str.empty()) { excl_str = "0.39"; }
+			float exclusion = static_cast<float>(atof(excl_str.c_str())) / 100.0f;
+			contrasted = app_ptr->contraster_ptr->exclusive_hist(src, exclusion, channel_mode);
+		}
+		else if (algo == "adaptive") {
+			if (cmd.second["-x"].empty() || cmd.second["-y"].empty() ||
+				cmd.second["-e"].empty()) { throw wrong_usage(); }
+			cl_int2 region = { atoi(cmd.second["-x"].c_str()), atoi(cmd.second["-y"].c_str()) };
+			int exclude = atoi(cmd.second["-e"].c_str());
+			contrasted = app_ptr->contraster_ptr->adaptive_hist(src, region, exclude, channel_mode);
+		}
+		else if (algo == "equalise") { contrasted = app_ptr->contraster_ptr->equalise(src, channel_mode); }
+		else if (algo == "match") {
+			if (cmd.second["-r"].empty()) { throw wrong_usage(); }
+			im_ptr reference = app_ptr->get_im(cmd.second["-r"], GAMMA_CORRECTION_OFF,
+				app_ptr->storage_for(GAMMA_CORRECTION_OFF, passes));
+			if (!cmd.second["-v"].empty()) {
+				im_ptr coloured = app_ptr->converser_ptr->run({ "srgb", cmd.second["-v"] }, reference, true);
+				reference.swap(coloured);
 			}
-			case commands::CONTRAST: {
-				assert_init();
-				std::string input = cmd.second["arg0"], algo = cmd.second["-t"];
-				if (input.empty()) { input = cmd.second["-i"]; }
-				if (input.empty() || cmd.second["-o"].empty()) { throw wrong_usage(); }
-				im_ptr src = app_ptr->get_im(input, GAMMA_CORRECTION_OFF);
-				int channel_mode = contraster::all_channels;
-				if (!cmd.second["-v"].empty()) {
-					channel_mode = contraster::single_channel;
-					im_ptr coloured = app_ptr->converser_ptr->run({ "srgb", cmd.second["-v"] }, src);
-					src.swap(coloured);
-				}
-				if (algo.empty()) { algo = "manual"; }
-				im_ptr contrasted = nullptr;
-				if (algo == "manual") {
-					if (cmd.second["-c"].empty()) { throw wrong_usage(); }
-					float c_val = static_cast<float>(atof(cmd.second["-c"].c_str()));
-					contrasted = app_ptr->contraster_ptr->manual(src, c_val, channel_mode);
-				}
-				else if (algo == "exclusive") {
-					std::string excl_str = cmd.second["-e"];
-					if (excl_str.empty()) { excl_str = "0.39"; }
-					float exclusion = static_cast<float>(atof(excl_str.c_str())) / 100.0f;
-					contrasted = app_ptr->contraster_ptr->exclusive_hist(src, exclusion, channel_mode);
-				}
-				else if (algo == "adaptive") {
-					if (cmd.second["-x"].empty() || cmd.second["-y"].empty() ||
-						cmd.second["-e"].empty()) { throw wrong_usage(); }
-					cl_int2 region = { atoi(cmd.second["-x"].c_str()), atoi(cmd.second["-y"].c_str()) };
-					int exclude = atoi(cmd.second["-e"].c_str());
-					contrasted = app_ptr->contraster_ptr->adaptive_hist(src, region, exclude, channel_mode);
-				}
-				else { throw std::runtime_error("Unknown contrast: " + algo); }
-				if (!cmd.second["-v"].empty()) {
-					channel_mode = contraster::single_channel;
-					im_ptr decoloured = app_ptr->converser_ptr->run({ cmd.second["-v"], "srgb" }, src);
-					contrasted.swap(decoloured);
+			contrasted = app_ptr->contraster_ptr->match(src, reference, channel_mode);
+		}
+		else { throw std::runtime_error("Unknown contrast: " + algo); }
+		if (!cmd.second["-v"].empty()) {
+			channel_mode = contraster::single_channel;
+			im_ptr decoloured = app_ptr->converser_ptr->run({ cmd.second["-v"], "srgb" }, contrasted);
+			contrasted.swap(decoloured);
+		}
+		app_ptr->put_im(cmd.second["-o"], contrasted, GAMMA_CORRECTION_OFF);
+		break;
+	}
+	case commands::GAUSS: {
+		std::string input = cmd.second["arg0"];
+		if (input.empty()) { input = cmd.second["-i"]; }
+		if (input.empty() || cmd.second["-o"].empty()) { throw wrong_usage(); }
+		float sigma_val = 1.0f; int win_size = 3;
+		if (!cmd.second["-s"].empty()) { sigma_val = (float)atof(cmd.second["-s"].c_str()); }
+		if (!cmd.second["-w"].empty()) { win_size = atoi(cmd.second["-w"].c_str()); }
+		im_ptr src = app_ptr->get_im(input, app_ptr->transfer, app_ptr->storage_for(app_ptr->transfer, 1));
+		std::string mode = cmd.second["-m"].empty() ? "auto" : cmd.second["-m"];
+		im_ptr blured = app_ptr->filter_ptr->gauss(sigma_val, win_size, src, mode);
+		app_ptr->put_im(cmd.second["-o"], blured, app_ptr->transfer);
+		break;
+	}
+	case commands::MEDIAN: {
+		assert_init();
+		std::string input = cmd.second["arg0"];
+		if (input.empty()) { input = cmd.second["-i"]; }
+		if (input.empty() || cmd.second["-o"].empty()) { throw wrong_usage(); }
+		int radius = 1;
+		if (!cmd.second["-r"].empty()) { radius = atoi(cmd.second["-r"].c_str()); }
+		/* Order statistics survive any monotonic transfer, code values keep histogram bins exact */
+		im_ptr src = app_ptr->get_im(input, GAMMA_CORRECTION_OFF, app_ptr->storage_for(GAMMA_CORRECTION_OFF, 1));
+		im_ptr filtered = app_ptr->filter_ptr->median(radius, src);
+		app_ptr->put_im(cmd.second["-o"], filtered, GAMMA_CORRECTION_OFF);
+		break;
+	}
+	case commands::SMOOTH: {
+		assert_init();
+		std::string input = cmd.second["arg0"], algo = cmd.second["-t"];
+		if (input.empty()) { input = cmd.second["-i"]; }
+		if (input.empty() || cmd.second["-o"].empty()) { throw wrong_usage(); }
+		if (algo.empty()) { algo = "bilateral"; }
+		int radius = 5;
+		if (!cmd.second["-r"].empty()) { radius = atoi(cmd.second["-r"].c_str()); }
+		/* Edges are judged by colour differences as seen, on gamma-encoded values */
+		im_ptr src = app_ptr->get_im(input, GAMMA_CORRECTION_OFF, CL_FLOAT);
+		im_ptr smoothed = nullptr;
+		if (algo == "bilateral") {
+			float sigma_s = radius / 2.0f, sigma_r = 0.1f;
+			if (!cmd.second["-s"].empty()) { sigma_s = (float)atof(cmd.second["-s"].c_str()); }
+			if (!cmd.second["-c"].empty()) { sigma_r = (float)atof(cmd.second["-c"].c_str()); }
+			smoothed = app_ptr->filter_ptr->bilateral(radius, sigma_s, sigma_r, src);
+		}
+		else if (algo == "guided") {
+			float eps = 0.01f;
+			if (!cmd.second["-e"].empty()) { eps = (float)atof(cmd.second["-e"].c_str()); }
+			smoothed = app_ptr->filter_ptr->guided(radius, eps, src);
+		}
+		else { throw std::runtime_error("Unknown smoothing: " + algo); }
+		app_ptr->put_im(cmd.second["-o"], smoothed, GAMMA_CORRECTION_OFF);
+		break;
+	}
+	case commands::MORPH: {
+		assert_init();
+		std::string input = cmd.second["arg0"];
+		if (input.empty()) { input = cmd.second["-i"]; }
+		if (input.empty() || cmd.second["-o"].empty() || cmd.second["-t"].empty()) { throw wrong_usage(); }
+		cl_int2 element = { 3, 3 };
+		if (!cmd.second["-x"].empty()) { element.x = atoi(cmd.second["-x"].c_str()); }
+		if (!cmd.second["-y"].empty()) { element.y = atoi(cmd.second["-y"].c_str()); }
+		im_ptr src = app_ptr->get_im(input, GAMMA_CORRECTION_OFF, app_ptr->storage_for(GAMMA_CORRECTION_OFF, 1));
+		im_ptr morphed = app_ptr->morpher_ptr->run(cmd.second["-t"], element, src);
+		app_ptr->put_im(cmd.second["-o"], morphed, GAMMA_CORRECTION_OFF);
+		break;
+	}
+	case commands::CONV: {
+		assert_init();
+		std::string input = cmd.second["arg0"];
+		if (input.empty()) { input = cmd.second["-i"]; }
+		if (input.empty() || cmd.second["-o"].empty() || cmd.second["-k"].empty()) { throw wrong_usage(); }
+		/* Kernel file: width and height, then weights row by row */
+		std::ifstream kern_file(cmd.second["-k"]);
+		if (!kern_file.is_open()) { throw std::runtime_error("Failed to open " + cmd.second["-k"]); }
+		cl_int2 kern_size = { 0, 0 };
+		kern_file >> kern_size.x >> kern_size.y;
+		if (kern_size.x < 1 || kern_size.y < 1) { throw std::runtime_error("Malformed kernel size in " + cmd.second["-k"]); }
+		std::vector<float> weights(static_cast<size_t>(kern_size.x) * kern_size.y);
+		for (float& weight : weights) {
+			if (!(kern_file >> weight)) { throw std::runtime_error("Not enough weights in " + cmd.second["-k"]); }
+		}
+		std::string mode = cmd.second["-m"].empty() ? "auto" : cmd.second["-m"];
+		im_ptr src = app_ptr->get_im(input, app_ptr->transfer, app_ptr->storage_for(app_ptr->transfer, 1));
+		im_ptr convolved = app_ptr->filter_ptr->convolve(weights, kern_size, src, mode);
+		app_ptr->put_im(cmd.second["-o"], convolved, app_ptr->transfer);
+		break;
+	}
+	case commands::NOTCH: {
+		assert_init();
+		std::string input = cmd.second["arg0"];
+		if (input.empty()) { input = cmd.second["-i"]; }
+		if (input.empty() || cmd.second["-o"].empty() || cmd.second["-f"].empty()) { throw wrong_usage(); }
+		std::vector<cl_float2> centres;
+		std::istringstream freq_list(cmd.second["-f"]);
+		std::string freq;
+		while (std::getline(freq_list, freq, ';')) {
+			cl_float2 centre = { 0.0f, 0.0f };
+			std::istringstream pair(freq);
+			char comma = 0;
+			if (!(pair >> centre.x >> comma >> centre.y) || comma != ',') { throw wrong_usage(); }
+			centres.push_back(centre);
+		}
+		float width = 0.005f;
+		if (!cmd.second["-w"].empty()) { width = (float)atof(cmd.second["-w"].c_str()); }
+		im_ptr src = app_ptr->get_im(input, app_ptr->transfer, CL_FLOAT);
+		im_ptr cleaned = app_ptr->fourier_ptr->notch(src, centres, width);
+		app_ptr->put_im(cmd.second["-o"], cleaned, app_ptr->transfer);
+		break;
+	}
+	case commands::BOX: {
+		assert_init();
+		std::string input = cmd.second["arg0"];
+		if (input.empty()) { input = cmd.second["-i"]; }
+		if (input.empty() || cmd.second["-o"].empty()) { throw wrong_usage(); }
+		cl_int2 radius = { 2, 2 };
+		if (!cmd.second["-x"].empty()) { radius.x = atoi(cmd.second["-x"].c_str()); }
+		if (!cmd.second["-y"].empty()) { radius.y = atoi(cmd.second["-y"].c_str()); }
+		im_ptr src = app_ptr->get_im(input, app_ptr->transfer, app_ptr->storage_for(app_ptr->transfer, 1));
+		im_ptr blured = app_ptr->integrator_ptr->box_blur(radius, src);
+		app_ptr->put_im(cmd.second["-o"], blured, app_ptr->transfer);
+		break;
+	}
+	case commands::LCN: {
+		assert_init();
+		std::string input = cmd.second["arg0"];
+		if (input.empty()) { input = cmd.second["-i"]; }
+		if (input.empty() || cmd.second["-o"].empty()) { throw wrong_usage(); }
+		int radius = 15; float eps = 0.02f;
+		if (!cmd.second["-r"].empty()) { radius = atoi(cmd.second["-r"].c_str()); }
+		if (!cmd.second["-e"].empty()) { eps = (float)atof(cmd.second["-e"].c_str()); }
+		/* Contrast as seen, on gamma-encoded values */
+		im_ptr src = app_ptr->get_im(input, GAMMA_CORRECTION_OFF, CL_FLOAT);
+		im_ptr normalised = app_ptr->integrator_ptr->local_normalise(radius, eps, src);
+		app_ptr->put_im(cmd.second["-o"], normalised, GAMMA_CORRECTION_OFF);
+		break;
+	}
+	case commands::STAT: {
+		assert_init();
+		std::string input = cmd.second["arg0"];
+		if (input.empty()) { input = cmd.second["-i"]; }
+		if (input.empty()) { throw wrong_usage(); }
+		cl_int4 rect = { { 0, 0, 0, 0 } };
+		const char* keys[4] = { "-x", "-y", "-w", "-h" };
+		for (int k = 0; k < 4; ++k) {
+			if (!cmd.second[keys[k]].empty()) { rect.s[k] = atoi(cmd.second[keys[k]].c_str()); }
+		}
+		/* Values as executors see them, decoded with current transfer */
+		im_ptr src = app_ptr->get_im(input, app_ptr->transfer, CL_FLOAT);
+		im_stats stats = src->stat(rect);
+		const char* names[3] = { "red", "green", "blue" };
+		std::cout << stats.pixels << " pixels" << std::endl;
+		std::cout << std::left << std::setw(8) << "" << std::setw(12) << "min" << std::setw(12) << "max"
+			<< std::setw(12) << "mean" << std::setw(12) << "variance" << "sum" << std::endl;
+		int colours = (src->components < 3) ? 1 : 3;
+		for (int ch = 0; ch < colours; ++ch) {
+			std::cout << std::setw(8) << ((colours == 1) ? "grey" : names[ch]) << std::setw(12) << stats.min.s[ch] << std::setw(12) << stats.max.s[ch]
+				<< std::setw(12) << stats.mean.s[ch] << std::setw(12) << stats.variance.s[ch] << stats.sum.s[ch] << std::endl;
+		}
+		std::cout << std::right;
+		break;
+	}
+	case commands::COMPARE: {
+		assert_init();
+		std::string input = cmd.second["arg0"], reference = cmd.second["arg1"];
+		if (input.empty() || reference.empty()) { throw wrong_usage(); }
+		/* Metrics are defined on code values */
+		im_ptr src = app_ptr->get_im(input, GAMMA_CORRECTION_OFF, CL_FLOAT);
+		im_ptr ref = app_ptr->get_im(reference, GAMMA_CORRECTION_OFF, CL_FLOAT);
+		bool maps = !cmd.second["-e"].empty() || !cmd.second["-s"].empty();
+		assessor::quality result = app_ptr->assessor_ptr->compare(src, ref, maps);
+		const char* names[3] = { "red", "green", "blue" };
+		int colours = (src->components < 3) ? 1 : 3;
+		std::cout << std::left << std::setw(8) << "" << std::setw(14) << "mse" << std::setw(12) << "psnr"
+			<< std::setw(12) << "ssim" << "ms-ssim" << std::endl;
+		for (int ch = 0; ch < colours; ++ch) {
+			std::cout << std::setw(8) << ((colours == 1) ? "grey" : names[ch]) << std::setw(14) << result.mse.s[ch]
+				<< std::setw(12) << result.psnr.s[ch] << std::setw(12) << result.ssim.s[ch] << result.ms_ssim.s[ch] << std::endl;
+		}
+		std::cout << std::right;
+		if (!cmd.second["-e"].empty()) { app_ptr->put_im(cmd.second["-e"], result.error_map, GAMMA_CORRECTION_OFF); }
+		if (!cmd.second["-s"].empty()) { app_ptr->put_im(cmd.second["-s"], result.ssim_map, GAMMA_CORRECTION_OFF); }
+		break;
+	}
+	case commands::SERVE: {
+		static bool serving = false;
+		std::string path = cmd.second["arg0"];
+		if (path.empty()) { throw wrong_usage(); }
+		if (serving) { throw std::runtime_error("Already serving"); }
+		std::string capacity = cmd.second["-q"], workers = cmd.second["-w"];
+		int worker_num = workers.empty() ? 1 : std::max(atoi(workers.c_str()), 1);
+		/* Workers share the app, each with own queue and kernel instances */
+		app* shared = app_ptr;
+		server jobs(path, capacity.empty() ? 64 : atoi(capacity.c_str()), [shared, worker_num](command& job) {
+			/* Queues, transfer and tuner are shared by workers, only their read-only forms may run concurrently */
+			auto job_id = command_ids.find(job.first);
+			if (worker_num > 1 && job_id != command_ids.end()) {
+				commands id = job_id->second;
+				bool read_only = (id == commands::GAMMA && job.second["arg0"].empty()) ||
+					(id == commands::TUNE && job.second["arg0"] == "show");
+				if (!read_only && (id == commands::INIT || id == commands::SERVE || id == commands::BATCH ||
+					id == commands::PROFILE || id == commands::GAMMA || id == commands::TUNE)) {
+					throw std::runtime_error("Not allowed with several workers: " + job.first);
 				}
-				app_ptr->put_im(cmd.second["-o"], contrasted, GAMMA_CORRECTION_OFF);
-				break;
-			}
-			case commands::GAUSS: {
-				std::string input = cmd.second["arg0"];
-				if (input.empty()) { input = cmd.second["-i"]; }
-				if (input.empty() || cmd.second["-o"].empty()) { throw wrong_usage(); }
-				float sigma_val = 1.0f; int win_size = 3;
-				if (!cmd.second["-s"].empty()) { sigma_val = (float)atof(cmd.second["-s"].c_str()); }
-				if (!cmd.second["-w"].empty()) { win_size = atoi(cmd.second["-w"].c_str()); }
-				im_ptr src = app_ptr->get_im(input);
-				im_ptr blured = app_ptr->filter_ptr->gauss(sigma_val, win_size, src);
-				app_ptr->put_im(cmd.second["-o"], blured);
-				break;
 			}
+			if (app_ptr == nullptr) { app_ptr = shared; }
+			run_command(job);
+		});
+		std::cout << "Serving on " << path << " with " << worker_num << " workers, send shutdown to stop" << std::endl;
+		serving = true;
+		try { jobs.serve(worker_num); }
+		catch (...) { serving = false; throw; }
+		serving = false;
+		break;
+	}
+	case commands::BATCH: {
+		std::string job_file = cmd.second["arg0"];
+		if (job_file.empty()) { throw wrong_usage(); }
+		std::ifstream job_lines(job_file);
+		if (!job_lines.is_open()) { throw std::runtime_error("Failed to open " + job_file); }
+		std::vector<command> jobs;
+		std::string line;
+		while (std::getline(job_lines, line)) {
+			command job = util::parse_action(line);
+			if (job.first.empty() || job.first[0] == '#') { continue; }
+			auto job_id = command_ids.find(job.first);
+			if (job_id != command_ids.end() && (job_id->second == commands::INIT || job_id->second == commands::QUIT ||
+				job_id->second == commands::SERVE || job_id->second == commands::BATCH || job_id->second == commands::PROFILE)) {
+				throw std::runtime_error("Not allowed in batch: " + job.first);
 			}
+			jobs.push_back(job);
+		}
+		if (pool_ptr == nullptr) { pool_ptr = new pool(); }
 
-			/*if (cmd["exe"] == "zoom") { assert_init();
-				std::string input = cmd["arg0"], output = cmd["-o"];
-				std::string scale = cmd["-f"], kern_type = cmd["-t"];
-				if (scale.empty() || input.empty() || output.empty()) { 
-					report_cmd("zoom"); continue;
-				}
-				float factor = atoi(scale.c_str()) / 100.0f;
-				if (kern_type.empty()) { kern_type = "lan3"; }
-				im_ptr src = app_ptr->get_im(input);
-				im_ptr scaled = app_ptr->zoomer_ptr->run(kern_type, factor, *src);
-				app_ptr->put_im(output, scaled);
-			}*/
-			/*else if (cmd["exe"] == "converse") { assert_init();
-				std::string input = cmd["arg0"], output = cmd["-o"];
-				std::string to_cs = cmd["-t"], from_cs = cmd["-f"];
-				if ((to_cs.empty() && from_cs.empty()) || input.empty() || output.empty()) {
-					report_cmd("converse"); continue;
-				}
-				if (from_cs.empty()) { from_cs = "srgb"; }
-				else if (to_cs.empty()) { to_cs = "srgb"; }
-				im_ptr src = app_ptr->get_im(input, false);
-				im_ptr conversed = app_ptr->converser_ptr->run(from_cs, to_cs, *src);
-				app_ptr->put_im(output, conversed, false);
-			}
-			else if (cmd["exe"] == "rotate") { assert_init();
-				std::string input = cmd["arg0"], output = cmd["-o"];
-				std::string angle = cmd["-a"], algo = cmd["-t"];
-				if (angle.empty() || input.empty() || output.empty()) {
-					report_cmd("rotate"); continue;
-				}
-				if (algo.empty()) { algo = "shear"; }
-				im_ptr src = app_ptr->get_im(input);
-				im_ptr rotated = app_ptr->rotator_ptr->run(algo, atof(angle.c_str()), *src);
-				app_ptr->put_im(output, rotated);
-			}
-			else if (cmd["exe"] == "gauss") { assert_init();
-				std::string input = cmd["arg0"], output = cmd["-o"];
-				std::string sigma = cmd["-s"], window = cmd["-w"];
-				if (input.empty() || output.empty()) {
-					report_cmd("gauss"); continue;
-				}
-				float sigma_val = 1.5f; int win_size = 5;
-				if (!sigma.empty()) { sigma_val = (float)atof(sigma.c_str()); }
-				if (!window.empty()) { win_size = atoi(window.c_str()); }
-				im_ptr src = app_ptr->get_im(input);
-				im_ptr blured = app_ptr->filter_ptr->gauss(sigma_val, win_size, *src);
-				app_ptr->put_im(output, blured);
+		/* Input size as cost, devices converge to their measured bytes per ms */
+		int transfer = app_ptr != nullptr ? app_ptr->transfer : TRANSFER_SRGB;
+		std::vector<pool::task> tasks;
+		for (command& job : jobs) {
+			auto input = job.second.find("-i");
+			if (input == job.second.end()) { input = job.second.find("arg0"); }
+			std::ifstream probe(input == job.second.end() ? "" : input->second, std::ios::binary | std::ios::ate);
+			double cost = probe.is_open() ? static_cast<double>(probe.tellg()) : 1.0;
+			tasks.push_back({ [&job, transfer](app& device) {
+				app_ptr = &device;
+				device.transfer = transfer;
+				run_command(job);
+			}, std::max(cost, 1.0) });
+		}
+		auto start = std::chrono::steady_clock::now();
+		std::map<size_t, std::string> errors = pool_ptr->run(tasks);
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		for (auto& error : errors) {
+			std::cerr << "Job " << error.first + 1 << " (" << jobs[error.first].first << "): " << error.second << std::endl;
+		}
+		for (const pool::device_report& device : pool_ptr->last_batch()) {
+			std::cout << "  " << device.name << ": " << device.tasks << " jobs (" << device.stolen << " stolen), busy "
+				<< device.busy_ms << " ms, " << device.throughput << " bytes/ms" << std::endl;
+		}
+		std::cout << tasks.size() - errors.size() << "/" << tasks.size() << " jobs in " << elapsed << " ms" << std::endl;
+		break;
+	}
+	case commands::TUNE: {
+		assert_init();
+		std::string mode = cmd.second["arg0"];
+		if (mode == "on") { app_ptr->tuning.enabled = true; }
+		else if (mode == "off") { app_ptr->tuning.enabled = false; }
+		else if (mode == "show") { app_ptr->tuning.show(std::cout); }
+		else if (mode == "clear") { app_ptr->tuning.clear(); }
+		else { throw wrong_usage(); }
+		break;
+	}
+	case commands::PROFILE: {
+		assert_init();
+		std::string mode = cmd.second["arg0"];
+		if (mode == "on") { app_ptr->set_profiling(true); }
+		else if (mode == "off") { app_ptr->set_profiling(false); }
+		else if (mode == "report") { app_ptr->profile.report(std::cout); }
+		else { throw wrong_usage(); }
+		break;
+	}
+	case commands::GAMMA: {
+		assert_init();
+		std::string name = cmd.second["arg0"];
+		if (name.empty()) {
+			for (const auto& transfer : app::transfers) {
+				std::cout << ((transfer.second == app_ptr->transfer) ? "-> " : "   ") << transfer.first << std::endl;
 			}
-			else if (cmd["exe"] == "contrast") { assert_init();
-				std::string input = cmd["arg0"], output = cmd["-o"];
-				if (input.empty() || output.empty()) { report_cmd("contrast"); continue; }
+			break;
+		}
+		auto transfer = app::transfers.find(name);
+		if (transfer == app::transfers.end()) { throw std::runtime_error("Unknown transfer function: " + name); }
+		app_ptr->transfer = transfer->second;
+		break;
+	}
+	case commands::GRADE: {
+		assert_init();
+		std::string input = cmd.second["arg0"], interpolation = cmd.second["-t"];
+		if (input.empty()) { input = cmd.second["-i"]; }
+		if (input.empty() || cmd.second["-o"].empty()) { throw wrong_usage(); }
+		if (cmd.second["-l"].empty() && cmd.second["-c"].empty()) { throw wrong_usage(); }
+		if (interpolation.empty()) { interpolation = "tetrahedral"; }
 
-				contraster::args params(cmd["-t"], cmd["-v"], cmd["-c"], cmd["-e"], cmd["-r"]);
-				im_ptr src = app_ptr->get_im(input, false);
-				im_ptr contrasted = app_ptr->contraster_ptr->run(*src, params);
-				app_ptr->put_im(output, contrasted);
-			}
-			else if (cmd["exe"] == "wavelet") { assert_init();
-				std::string input = cmd["arg0"], output = cmd["-o"];
-				std::string basis = cmd["-b"], thresholding = cmd["-t"];
-				if (input.empty() || output.empty()) { report_cmd("wavelet"); continue; }
-				if (basis.empty()) { basis = "haar"; }
-				if (thresholding.empty()) { thresholding = "soft"; }
-				float threshold_val = 0.01f;
-				if (!thresholding.empty()) { threshold_val = (float)atof(thresholding.c_str()); }
-				im_ptr src = app_ptr->get_im(input);
-				im_ptr wave = app_ptr->wavelet_ptr->run(basis, threshold_val, *src);
-				app_ptr->put_im(output, wave);
+		const grader::lut* table = nullptr;
+		if (!cmd.second["-l"].empty()) { table = &app_ptr->grader_ptr->load_cube(cmd.second["-l"]); }
+		else {
+			std::string via = cmd.second["-v"];
+			float c_val = static_cast<float>(atof(cmd.second["-c"].c_str()));
+			int lut_size = cmd.second["-n"].empty() ? 33 : atoi(cmd.second["-n"].c_str());
+			std::vector<grader::stage> chain;
+			if (!via.empty()) {
+				chain.push_back([via](im_ptr& im) { return app_ptr->converser_ptr->run({ "srgb", via }, im); });
+				chain.push_back([c_val](im_ptr& im) {
+					return app_ptr->contraster_ptr->manual(im, c_val, contraster::single_channel);
+				});
+				chain.push_back([via](im_ptr& im) { return app_ptr->converser_ptr->run({ via, "srgb" }, im); });
 			}
-			else if (cmd["exe"] == "env") {
-				if (app_ptr != nullptr) { app_ptr->env_info(); }
-				else { hardware::env_info(); }
+			else {
+				chain.push_back([c_val](im_ptr& im) {
+					return app_ptr->contraster_ptr->manual(im, c_val, contraster::all_channels);
+				});
 			}
-			else if (cmd["exe"] == "dev") { assert_init(); 
-				hardware::device_info(app_ptr->env.cur_device);
-			}
-			else if (cmd["exe"] == "init") {
-				std::string platform = cmd["-p"], device = cmd["-d"];
-				if (platform.empty() || device.empty()) { platform = cmd["arg0"], device = cmd["arg1"];
-					if (platform.empty() || device.empty()) { report_cmd("init"); continue; }
-				}
-				delete app_ptr;
-				app_ptr = new app(atoi(platform.c_str()), atoi(device.c_str()));
-			}
-			else if (cmd["exe"] == "quit") { break; }
-			else { std::cout << "No such command: " << cmd["exe"] << std::endl; }*/
+			std::string name = "contrast:" + via + ":" + cmd.second["-c"] + ":" + std::to_string(lut_size);
+			table = &app_ptr->grader_ptr->bake(name, lut_size, chain);
+		}
+		im_ptr src = app_ptr->get_im(input, GAMMA_CORRECTION_OFF, app_ptr->storage_for(GAMMA_CORRECTION_OFF, 1));
+		im_ptr graded = app_ptr->grader_ptr->run(*table, interpolation, src);
+		app_ptr->put_im(cmd.second["-o"], graded, GAMMA_CORRECTION_OFF);
+		break;
+	}
+	}
+
+	/*if (cmd["exe"] == "zoom") { assert_init();
+		std::string input = cmd["arg0"], output = cmd["-o"];
+		std::string scale = cmd["-f"], kern_type = cmd["-t"];
+		if (scale.empty() || input.empty() || output.empty()) { 
+			report_cmd("zoom"); continue;
+		}
+		float factor = atoi(scale.c_str()) / 100.0f;
+		if (kern_type.empty()) { kern_type = "lan3"; }
+		im_ptr src = app_ptr->get_im(input);
+		im_ptr scaled = app_ptr->zoomer_ptr->run(kern_type, factor, *src);
+		app_ptr->put_im(output, scaled);
+	}*/
+	/*else if (cmd["exe"] == "converse") { assert_init();
+		std::string input = cmd["arg0"], output = cmd["-o"];
+		std::string to_cs = cmd["-t"], from_cs = cmd["-f"];
+		if ((to_cs.empty() && from_cs.empty()) || input.empty() || output.empty()) {
+			report_cmd("converse"); continue;
+		}
+		if (from_cs.empty()) { from_cs = "srgb"; }
+		else if (to_cs.empty()) { to_cs = "srgb"; }
+		im_ptr src = app_ptr->get_im(input, false);
+		im_ptr conversed = app_ptr->converser_ptr->run(from_cs, to_cs, *src);
+		app_ptr->put_im(output, conversed, false);
+	}
+	else if (cmd["exe"] == "rotate") { assert_init();
+		std::string input = cmd["arg0"], output = cmd["-o"];
+		std::string angle = cmd["-a"], algo = cmd["-t"];
+		if (angle.empty() || input.empty() || output.empty()) {
+			report_cmd("rotate"); continue;
+		}
+		if (algo.empty()) { algo = "shear"; }
+		im_ptr src = app_ptr->get_im(input);
+		im_ptr rotated = app_ptr->rotator_ptr->run(algo, atof(angle.c_str()), *src);
+		app_ptr->put_im(output, rotated);
+	}
+	else if (cmd["exe"] == "gauss") { assert_init();
+		std::string input = cmd["arg0"], output = cmd["-o"];
+		std::string sigma = cmd["-s"], window = cmd["-w"];
+		if (input.empty() || output.empty()) {
+			report_cmd("gauss"); continue;
 		}
-		catch (wrong_usage e) { std::cerr << e.what() << cmd_syntax[cmd_index->second]; }
-		catch (std::runtime_error e) { std::cerr << e.what() << std::endl; }
+		float sigma_val = 1.5f; int win_size = 5;
+		if (!sigma.empty()) { sigma_val = (float)atof(sigma.c_str()); }
+		if (!window.empty()) { win_size = atoi(window.c_str()); }
+		im_ptr src = app_ptr->get_im(input);
+		im_ptr blured = app_ptr->filter_ptr->gauss(sigma_val, win_size, *src);
+		app_ptr->put_im(output, blured);
+	}
+	else if (cmd["exe"] == "contrast") { assert_init();
+		std::string input = cmd["arg0"], output = cmd["-o"];
+		if (input.empty() || output.empty()) { report_cmd("contrast"); continue; }
+
+		contraster::args params(cmd["-t"], cmd["-v"], cmd["-c"], cmd["-e"], cmd["-r"]);
+		im_ptr src = app_ptr->get_im(input, false);
+		im_ptr contrasted = app_ptr->contraster_ptr->run(*src, params);
+		app_ptr->put_im(output, contrasted);
+	}
+	else if (cmd["exe"] == "wavelet") { assert_init();
+		std::string input = cmd["arg0"], output = cmd["-o"];
+		std::string basis = cmd["-b"], thresholding = cmd["-t"];
+		if (input.empty() || output.empty()) { report_cmd("wavelet"); continue; }
+		if (basis.empty()) { basis = "haar"; }
+		if (thresholding.empty()) { thresholding = "soft"; }
+		float threshold_val = 0.01f;
+		if (!thresholding.empty()) { threshold_val = (float)atof(thresholding.c_str()); }
+		im_ptr src = app_ptr->get_im(input);
+		im_ptr wave = app_ptr->wavelet_ptr->run(basis, threshold_val, *src);
+		app_ptr->put_im(output, wave);
+	}
+	else if (cmd["exe"] == "env") {
+		if (app_ptr != nullptr) { app_ptr->env_info(); }
+		else { hardware::env_info(); }
+	}
+	else if (cmd["exe"] == "dev") { assert_init(); 
+		hardware::device_info(app_ptr->env.cur_device);
+	}
+	else if (cmd["exe"] == "init") {
+		std::string platform = cmd["-p"], device = cmd["-d"];
+		if (platform.empty() || device.empty()) { platform = cmd["arg0"], device = cmd["arg1"];
+			if (platform.empty() || device.empty()) { report_cmd("init"); continue; }
+		}
+		delete app_ptr;
+		app_ptr = new app(atoi(platform.c_str()), atoi(device.c_str()));
+	}
+	else if (cmd["exe"] == "quit") { break; }
+	else { std::cout << "No such command: " << cmd["exe"] << std::endl; }*/
+}
+
+/*
+*  Region keys accepted by every command loading images: -R <x>,<y>,<w>,<h> writes the region alone,
+*  -P <x>,<y>,<w>,<h> pastes it over the whole input, -H <halo> loads that much context around it
+*/
+struct scoped_region {
+	scoped_region(keys& opts) {
+		if (opts["-R"].empty() && opts["-P"].empty()) { return; }
+		if (!opts["-R"].empty() && !opts["-P"].empty()) { throw std::runtime_error("Either -R or -P, not both"); }
+		app::roi.composite = !opts["-P"].empty();
+		std::istringstream rect(app::roi.composite ? opts["-P"] : opts["-R"]);
+		char sep[3] = { 0, 0, 0 };
+		cl_int4& r = app::roi.rect;
+		if (!(rect >> r.s[0] >> sep[0] >> r.s[1] >> sep[1] >> r.s[2] >> sep[2] >> r.s[3]) ||
+			sep[0] != ',' || sep[1] != ',' || sep[2] != ',' || r.s[2] <= 0 || r.s[3] <= 0) {
+			app::roi = app::region();
+			throw std::runtime_error("Region expected as <x>,<y>,<width>,<height>");
+		}
+		if (!opts["-H"].empty()) { app::roi.halo = std::max(atoi(opts["-H"].c_str()), 0); }
+	}
+
+	~scoped_region() { app::roi = app::region(); }
+};
+
+/* Look up and execute command, profiled if enabled; usage errors carry expected syntax */
+void run_command(command& cmd) {
+	auto cmd_index = command_ids.find(cmd.first);
+	if (cmd_index == command_ids.end()) { throw std::runtime_error("Unknown command: " + cmd.first); }
+	bool profiled = app_ptr != nullptr && app_ptr->profile.enabled && cmd_index->second != commands::INIT &&
+		cmd_index->second != commands::QUIT && cmd_index->second != commands::PROFILE &&
+		cmd_index->second != commands::SERVE && cmd_index->second != commands::BATCH;
+	/* Profiler collects events of one command at a time */
+	static std::mutex profiling;
+	std::unique_lock<std::mutex> serial(profiling, std::defer_lock);
+	if (profiled) { serial.lock(); app_ptr->profile.begin(&app_ptr->env, cmd.first); }
+	try {
+		scoped_region region(cmd.second);
+		execute(cmd, cmd_index->second);
+	}
+	catch (wrong_usage& e) {
+		if (profiled) { app_ptr->profile.end(); }
+		throw std::runtime_error(e.what() + cmd_syntax[cmd_index->second]);
+	}
+	catch (...) {
+		if (profiled) { app_ptr->profile.end(); }
+		throw;
+	}
+	if (profiled) { app_ptr->profile.end(); }
+}
+
+int main(int argc, char** argv) {
+	try { app_ptr = new app(0, 0); }
+	catch (const std::runtime_error& e) { 
+		std::cerr << " Default init failed:" << 
+			std::endl << e.what() << std::endl;
+	}
+	/* Arguments form a single command, e.g. "im_cl serve /tmp/im_cl.sock" runs as a daemon */
+	if (argc > 1) {
+		std::string line;
+		for (int arg = 1; arg < argc; ++arg) { line.append(arg > 1 ? " " : "").append(argv[arg]); }
+		command cmd = util::parse_action(line);
+		int status = 0;
+		try { run_command(cmd); }
+		catch (const std::runtime_error& e) { std::cerr << e.what() << std::endl; status = 1; }
+		delete pool_ptr;
+		delete app_ptr;
+		return status;
+	}
+	while (true) {
+		std::cout << "> ";
+		command cmd = util::next_action();
+		if (cmd.first == "quit") { break; }
+		try { run_command(cmd); }
+		catch (const std::runtime_error& e) { std::cerr << e.what() << std::endl; }
 	}
-	app_exit:
+	delete pool_ptr;
 	delete app_ptr;
 }
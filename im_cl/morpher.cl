@@ -0,0 +1,56 @@
+#include "bounds.cl"
+
+/*
+*	Van Herk / Gil-Werman: a line of length n is split into blocks of n pixels,
+*	prefix holds running extrema from each block start, suffix from each block end.
+*	A window of n pixels spans at most two blocks, so it is one combine of suffix at its first pixel
+*	and prefix at its last one. Both are stored for the line extended by left pixels before
+*	and size - 1 - left after the image, clamp-to-edge reads leave extrema unchanged
+*/
+
+/* Built with -D MORPH_DILATE for maximum, minimum otherwise */
+#ifdef MORPH_DILATE
+#define COMBINE fmax
+#else
+#define COMBINE fmin
+#endif
+
+/* One work-item per block of a row (vertical == 0) or column */
+__kernel void vhgw_blocks(__read_only image2d_t src, sampler_t sampler,
+	__write_only image2d_t prefix, __write_only image2d_t suffix, int size, int left, int vertical) {
+	int start = get_global_id(0) * size, line = get_global_id(1);
+	int2 step = vertical ? (int2)(0, 1) : (int2)(1, 0);
+	int2 base = vertical ? (int2)(line, start) : (int2)(start, line);
+	float4 run = read_imagef(src, sampler, base - step * left);
+	write_imagef(prefix, base, run);
+	for (int i = 1; i < size; ++i) {
+		run = COMBINE(run, read_imagef(src, sampler, base + step * (i - left)));
+		write_imagef(prefix, base + step * i, run);
+	}
+	run = read_imagef(src, sampler, base + step * (size - 1 - left));
+	write_imagef(suffix, base + step * (size - 1), run);
+	for (int i = size - 2; i >= 0; --i) {
+		run = COMBINE(run, read_imagef(src, sampler, base + step * (i - left)));
+		write_imagef(suffix, base + step * i, run);
+	}
+}
+
+/* Window of pixel cd starts at extended index cd and ends at cd + size - 1 */
+__kernel void vhgw_merge(__read_only image2d_t prefix, __read_only image2d_t suffix, sampler_t sampler,
+	__write_only image2d_t dst, int size, int vertical) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	int2 last = cd + (vertical ? (int2)(0, size - 1) : (int2)(size - 1, 0));
+	write_imagef(dst, cd, COMBINE(read_imagef(suffix, sampler, cd), read_imagef(prefix, sampler, last)));
+}
+
+/* Top-hats: clamped minuend - subtrahend, alpha of minuend */
+__kernel void difference(__read_only image2d_t minuend, __read_only image2d_t subtrahend,
+	sampler_t sampler, __write_only image2d_t dst) {
+	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
+	float4 a = read_imagef(minuend, sampler, cd);
+	float4 out_val = fmax(a - read_imagef(subtrahend, sampler, cd), 0.0f);
+	out_val.w = a.w;
+	write_imagef(dst, cd, out_val);
+}
@@ -0,0 +1,84 @@
+#include"im_executors.h"
+
+morpher::morpher(hardware* env, functions* kernels) : executor(env, kernels) {}
+
+im_ptr morpher::run(const std::string& operation, cl_int2 element, im_ptr& src) {
+	if (element.x < 1 || element.y < 1) { throw std::runtime_error("Structuring element must be at least 1x1"); }
+	src->make_image();
+	if (operation == "erode") { return extremum(element, src, false); }
+	if (operation == "dilate") { return extremum(element, src, true); }
+	if (operation == "open") {
+		im_ptr eroded = extremum(element, src, false);
+		return extremum(element, eroded, true, true);
+	}
+	if (operation == "close") {
+		im_ptr dilated = extremum(element, src, true);
+		return extremum(element, dilated, false, true);
+	}
+	if (operation == "tophat") {
+		im_ptr eroded = extremum(element, src, false);
+		im_ptr opened = extremum(element, eroded, true, true);
+		return difference(src, opened);
+	}
+	if (operation == "blackhat") {
+		im_ptr dilated = extremum(element, src, true);
+		im_ptr closed = extremum(element, dilated, false, true);
+		return difference(closed, src);
+	}
+	throw std::runtime_error("Unknown morphology: " + operation);
+}
+
+im_ptr morpher::extremum(cl_int2 element, im_ptr& src, bool dilate, bool reflected) {
+	im_ptr rows = line_pass(src, element.x, false, dilate, reflected);
+	return line_pass(rows, element.y, true, dilate, reflected);
+}
+
+im_ptr morpher::line_pass(im_ptr& src, int size, bool vertical, bool dilate, bool reflected) {
+	if (size == 1) { return src; }
+	/* Window [x - left, x + size - 1 - left], centred for odd sizes, mirrored for reflected even ones */
+	cl_int left = reflected ? size - 1 - size / 2 : size / 2, vert = vertical ? 1 : 0;
+	cl_int length = vertical ? src->size.y : src->size.x;
+	cl_int lines = vertical ? src->size.x : src->size.y;
+	cl_int blocks = (length + 2 * (size - 1)) / size;
+	cl_int2 extended = vertical ? cl_int2{ src->size.x, blocks * size } : cl_int2{ blocks * size, src->size.y };
+	cl_mem prefix = env->alloc_im(extended, nullptr, src->order, src->format);
+	cl_mem suffix = env->alloc_im(extended, nullptr, src->order, src->format);
+
+	cl_kernel kern = dilate ? kernels->at("vhgw_blocks", util::defines({ { "MORPH_DILATE", 1 } })) : kernels->at("vhgw_blocks");
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST });
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &src->cl_storage);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_sampler), &sampler);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &prefix);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_mem), &suffix);
+	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_int), &size);
+	ret_code |= clSetKernelArg(kern, 5, sizeof(cl_int), &left);
+	ret_code |= clSetKernelArg(kern, 6, sizeof(cl_int), &vert);
+	util::assert_success(ret_code, "Failed to set morphology args");
+	run_blocking(kern, { blocks, lines }, LAUNCH_PURE);
+
+	im_ptr result = src->blank(src->size);
+	kern = dilate ? kernels->at("vhgw_merge", util::defines({ { "MORPH_DILATE", 1 } })) : kernels->at("vhgw_merge");
+	ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &prefix);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_mem), &suffix);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_sampler), &sampler);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_mem), &result->cl_storage);
+	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_int), &size);
+	ret_code |= clSetKernelArg(kern, 5, sizeof(cl_int), &vert);
+	util::assert_success(ret_code, "Failed to set morphology args");
+	run_blocking(kern, src->size, LAUNCH_PURE | LAUNCH_GUARDED);
+	clReleaseMemObject(prefix); clReleaseMemObject(suffix);
+	return std::move(result);
+}
+
+im_ptr morpher::difference(im_ptr& minuend, im_ptr& subtrahend) {
+	cl_kernel kern = kernels->at("difference");
+	im_ptr result = minuend->blank(minuend->size);
+	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &minuend->cl_storage);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_mem), &subtrahend->cl_storage);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_sampler), &sampler);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_mem), &result->cl_storage);
+	util::assert_success(ret_code, "Failed to set difference args");
+	run_blocking(kern, minuend->size, LAUNCH_PURE | LAUNCH_GUARDED);
+	return std::move(result);
+}
@@ -0,0 +1,164 @@
+#include"pool.h"
+#include<algorithm>
+#include<chrono>
+#include<numeric>
+
+/* Weight of the latest task in the throughput average */
+#define THROUGHPUT_DECAY 0.3
+
+pool::pool() {
+	cl_uint plat_num = 0;
+	clGetPlatformIDs(0, NULL, &plat_num);
+	std::vector<cl_platform_id> platforms(plat_num);
+	if (plat_num != 0) { clGetPlatformIDs(plat_num, platforms.data(), NULL); }
+	for (size_t plat_id = 0; plat_id < platforms.size(); ++plat_id) {
+		cl_uint dev_num = 0;
+		if (clGetDeviceIDs(platforms[plat_id], CL_DEVICE_TYPE_ALL, 0, NULL, &dev_num) != CL_SUCCESS) { continue; }
+		std::vector<cl_device_id> devices(dev_num);
+		clGetDeviceIDs(platforms[plat_id], CL_DEVICE_TYPE_ALL, dev_num, devices.data(), NULL);
+		for (size_t dev_id = 0; dev_id < devices.size(); ++dev_id) {
+			cl_device_id device = devices[dev_id];
+			if (!hardware::device_param<cl_bool>(device, CL_DEVICE_IMAGE_SUPPORT)) { continue; }
+			std::unique_ptr<worker> next(new worker());
+			next->platform_id = plat_id, next->device_id = dev_id;
+			next->report = { hardware::string_param(device, CL_DEVICE_NAME), 0, 0, 0.0, 0.0 };
+			next->peak = static_cast<double>(std::max(hardware::device_param<cl_uint>(device, CL_DEVICE_MAX_COMPUTE_UNITS), 1u)) *
+				std::max(hardware::device_param<cl_uint>(device, CL_DEVICE_MAX_CLOCK_FREQUENCY), 1u);
+			workers.push_back(std::move(next));
+		}
+	}
+
+	/* Each app is created on its worker thread, which then drives its own device */
+	for (auto& cur : workers) { cur->thread = std::thread(&pool::work, this, cur.get()); }
+	std::unique_lock<std::mutex> guard(lock);
+	finished.wait(guard, [this] { return started == workers.size(); });
+	for (auto it = workers.begin(); it != workers.end(); ) {
+		if ((*it)->alive) { ++it; continue; }
+		(*it)->thread.join();
+		it = workers.erase(it);
+	}
+	if (workers.empty()) { throw std::runtime_error("No usable devices"); }
+}
+
+pool::~pool() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto& cur : workers) { cur->thread.join(); }
+}
+
+void pool::work(worker* self) {
+	std::unique_ptr<app> device;
+	try { device.reset(new app(self->platform_id, self->device_id, 0, 0, CL_DEVICE_TYPE_ALL)); }
+	catch (const std::exception& e) {
+		std::cerr << self->report.name << " skipped: " << e.what() << std::endl;
+	}
+	std::unique_lock<std::mutex> guard(lock);
+	self->alive = device != nullptr;
+	++started;
+	finished.notify_all();
+	if (!device) { return; }
+
+	while (true) {
+		size_t index;
+		wake.wait(guard, [&] { return stopping || pick(self, index); });
+		if (stopping) { return; }
+		task& cur = (*batch)[index];
+		guard.unlock();
+
+		auto start = std::chrono::steady_clock::now();
+		std::string error;
+		try { cur.work(*device); }
+		catch (const std::exception& e) { error = e.what(); }
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		guard.lock();
+		if (!error.empty()) { errors.emplace(index, error); }
+		double sample = cur.cost / std::max(elapsed, 1e-3);
+		self->throughput = self->measured ? (1.0 - THROUGHPUT_DECAY) * self->throughput + THROUGHPUT_DECAY * sample : sample;
+		self->measured = true;
+		self->report.tasks++;
+		self->report.busy_ms += elapsed;
+		if (--remaining == 0) { finished.notify_all(); }
+		/* Idle workers reconsider stealing against the new estimates */
+		wake.notify_all();
+	}
+}
+
+bool pool::pick(worker* self, size_t& index) {
+	if (batch == nullptr) { return false; }
+	if (!self->queue.empty()) {
+		index = self->queue.front();
+		self->queue.pop_front();
+		self->queued_cost -= (*batch)[index].cost;
+		return true;
+	}
+	worker* victim = nullptr;
+	double longest = 0.0;
+	for (auto& other : workers) {
+		if (other.get() == self || other->queue.empty()) { continue; }
+		double drain = other->queued_cost / rate(other.get());
+		if (drain > longest) { longest = drain, victim = other.get(); }
+	}
+	if (victim == nullptr) { return false; }
+	/* Worth taking only if this device finishes it before the owner would */
+	size_t candidate = victim->queue.back();
+	if ((*batch)[candidate].cost / rate(self) > longest) { return false; }
+	victim->queue.pop_back();
+	victim->queued_cost -= (*batch)[candidate].cost;
+	self->report.stolen++;
+	index = candidate;
+	return true;
+}
+
+double pool::rate(const worker* target) const {
+	if (target->measured) { return std::max(target->throughput, 1e-9); }
+	double scale = 0.0; size_t known = 0;
+	for (auto& other : workers) {
+		if (!other->measured) { continue; }
+		scale += other->throughput / other->peak;
+		known++;
+	}
+	return std::max(known == 0 ? target->peak : target->peak * scale / known, 1e-9);
+}
+
+std::map<size_t, std::string> pool::run(std::vector<task>& tasks) {
+	std::unique_lock<std::mutex> guard(lock);
+	errors.clear();
+	for (auto& cur : workers) {
+		cur->report.tasks = cur->report.stolen = 0;
+		cur->report.busy_ms = 0.0;
+	}
+
+	/* Largest tasks first, each to the device expected to finish it earliest */
+	std::vector<size_t> order(tasks.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return tasks[a].cost > tasks[b].cost; });
+	for (size_t index : order) {
+		worker* best = nullptr;
+		double best_end = 0.0;
+		for (auto& cur : workers) {
+			double end = (cur->queued_cost + tasks[index].cost) / rate(cur.get());
+			if (best == nullptr || end < best_end) { best = cur.get(), best_end = end; }
+		}
+		best->queue.push_back(index);
+		best->queued_cost += tasks[index].cost;
+	}
+
+	batch = &tasks;
+	remaining = tasks.size();
+	wake.notify_all();
+	finished.wait(guard, [this] { return remaining == 0; });
+	batch = nullptr;
+	for (auto& cur : workers) { cur->report.throughput = cur->throughput; }
+	return std::move(errors);
+}
+
+std::vector<pool::device_report> pool::last_batch() const {
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<device_report> reports;
+	for (auto& cur : workers) { reports.push_back(cur->report); }
+	return reports;
+}
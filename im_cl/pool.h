@@ -0,0 +1,65 @@
+#pragma once
+
+#include"app.h"
+#include<condition_variable>
+#include<functional>
+#include<thread>
+#include<mutex>
+#include<deque>
+#include<map>
+
+/* One app per OpenCL device of the node, each owned by its own worker thread */
+struct pool {
+	/* Unit of work, cost in arbitrary units proportional to its run time, e.g. input bytes */
+	struct task {
+		std::function<void(app&)> work;
+		double cost;
+	};
+
+	/* What one device did during the last batch */
+	struct device_report {
+		std::string name;
+		size_t tasks, stolen;
+		double busy_ms, throughput;
+	};
+
+	/* Opens every device with image support on every platform, skips those failing to initialise */
+	pool();
+	~pool();
+
+	size_t size() const { return workers.size(); }
+
+	/* Runs all tasks to completion, returns error messages of failed ones by task index */
+	std::map<size_t, std::string> run(std::vector<task>& tasks);
+
+	std::vector<device_report> last_batch() const;
+private:
+	struct worker {
+		size_t platform_id, device_id;
+		device_report report;
+		/* Peak estimate from compute units and clock, used until throughput is measured */
+		double peak;
+		/* Cost units per ms, moving average over finished tasks */
+		double throughput = 0.0;
+		bool measured = false, alive = false;
+		std::deque<size_t> queue;
+		double queued_cost = 0.0;
+		std::thread thread;
+	};
+
+	std::vector<std::unique_ptr<worker>> workers;
+	mutable std::mutex lock;
+	std::condition_variable wake, finished;
+	std::vector<task>* batch = nullptr;
+	std::map<size_t, std::string> errors;
+	size_t remaining = 0, started = 0;
+	bool stopping = false;
+
+	void work(worker* self);
+
+	/* Own queue first, then the back of the queue that takes longest to drain */
+	bool pick(worker* self, size_t& index);
+
+	/* Expected cost units per ms of a device, measured or scaled from the peak of measured ones */
+	double rate(const worker* target) const;
+};
@@ -0,0 +1,78 @@
+#include"profiler.h"
+#include"util.h"
+#include<algorithm>
+#include<iomanip>
+
+void profiler::begin(hardware* env, const std::string& command) {
+	this->env = env;
+	current = command;
+	records.clear();
+	env->event_log = &records;
+	started = std::chrono::steady_clock::now();
+}
+
+void profiler::end() {
+	if (env == nullptr) { return; }
+	clFinish(env->queue());
+	double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+	env->event_log = nullptr;
+
+	command_profile cur = { current, wall_ms, 0.0, 0.0, 0.0, 0.0, 0, {} };
+	for (const hardware::record& rec : records) {
+		cl_ulong queued = 0, submit = 0, start = 0, end = 0;
+		cl_int ret_code = clGetEventProfilingInfo(rec.event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, nullptr);
+		ret_code |= clGetEventProfilingInfo(rec.event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &submit, nullptr);
+		ret_code |= clGetEventProfilingInfo(rec.event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, nullptr);
+		ret_code |= clGetEventProfilingInfo(rec.event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, nullptr);
+		clReleaseEvent(rec.event);
+		if (ret_code != CL_SUCCESS) { continue; }
+
+		double ms = (end - start) / 1e6;
+		(rec.transfer ? cur.transfer_ms : cur.kernel_ms) += ms;
+		cur.submit_ms += (submit - queued) / 1e6;
+		cur.launch_ms += (start - submit) / 1e6;
+		cur.bytes += rec.bytes;
+		auto same = std::find_if(cur.entries.begin(), cur.entries.end(),
+			[&rec](const entry& e) { return e.name == rec.name && e.transfer == rec.transfer; });
+		if (same == cur.entries.end()) { cur.entries.push_back({ rec.name, rec.transfer, 1, rec.bytes, ms }); }
+		else { same->count++; same->bytes += rec.bytes; same->ms += ms; }
+	}
+	records.clear();
+	std::sort(cur.entries.begin(), cur.entries.end(), [](const entry& a, const entry& b) { return a.ms > b.ms; });
+	history.push_back(std::move(cur));
+	env = nullptr;
+}
+
+void profiler::report(std::ostream& out) {
+	if (history.empty()) { out << "Nothing profiled" << std::endl; return; }
+	out << std::fixed << std::setprecision(3);
+	for (const command_profile& cur : history) {
+		double host_ms = std::max(0.0, cur.wall_ms - cur.kernel_ms - cur.transfer_ms);
+		out << cur.command << ": " << cur.wall_ms << " ms wall" << std::endl;
+		out << "  kernels   " << std::setw(10) << cur.kernel_ms << " ms" << std::endl;
+		out << "  transfers " << std::setw(10) << cur.transfer_ms << " ms, " << cur.bytes / 1048576.0 << " MiB";
+		if (cur.transfer_ms > 0.0) { out << " (" << cur.bytes / cur.transfer_ms / 1e6 << " GB/s)"; }
+		out << std::endl;
+		out << "  host      " << std::setw(10) << host_ms << " ms (queued to submitted " << cur.submit_ms
+			<< " ms, submitted to started " << cur.launch_ms << " ms)" << std::endl;
+		for (const entry& e : cur.entries) {
+			out << "    " << std::left << std::setw(24) << e.name << std::right << std::setw(6) << e.count << "x "
+				<< std::setw(10) << e.ms << " ms";
+			if (e.transfer) { out << "  " << e.bytes / 1048576.0 << " MiB"; }
+			out << std::endl;
+		}
+	}
+	history.clear();
+}
+
+void profiler::clear() {
+	if (env != nullptr) {
+		env->event_log = nullptr;
+		env = nullptr;
+	}
+	for (const hardware::record& rec : records) { clReleaseEvent(rec.event); }
+	records.clear();
+	history.clear();
+}
+
+profiler::~profiler() { clear(); }
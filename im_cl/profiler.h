@@ -0,0 +1,47 @@
+#pragma once
+#include"hardware.h"
+#include<chrono>
+#include<iostream>
+#include<string>
+#include<vector>
+
+/* Per-command breakdown of device activity recorded through hardware::event_log */
+struct profiler {
+	/* Commands of one kernel or transfer kind within a command */
+	struct entry {
+		std::string name;
+		bool transfer;
+		size_t count, bytes;
+		double ms;
+	};
+
+	struct command_profile {
+		std::string command;
+		/* Latencies: queued to submitted to device, submitted to started */
+		double wall_ms, kernel_ms, transfer_ms, submit_ms, launch_ms;
+		size_t bytes;
+		std::vector<entry> entries;
+	};
+
+	bool enabled = false;
+
+	/* Start recording commands enqueued to env */
+	void begin(hardware* env, const std::string& command);
+
+	/* Wait for recorded commands, fold their timings into history, release events */
+	void end();
+
+	/* Print breakdown of every command since last report and forget them */
+	void report(std::ostream& out);
+
+	void clear();
+
+	~profiler();
+
+private:
+	hardware* env = nullptr;
+	std::string current;
+	std::chrono::steady_clock::time_point started;
+	std::vector<hardware::record> records;
+	std::vector<command_profile> history;
+};
@@ -1,7 +1,9 @@
+#include "bounds.cl"
 
 __kernel void counter_clockwise(__read_only image2d_t src, 
 	sampler_t sampler, __write_only image2d_t dst, int2 sz) {
 	int2 out_cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, out_cd)) { return; }
 	int2 in_cd = (int2)(out_cd.y, sz.x - out_cd.x - 1);
 	write_imagef(dst, out_cd, read_imagef(src, sampler, in_cd));
 }
@@ -9,6 +11,7 @@ __kernel void counter_clockwise(__read_only image2d_t src,
 __kernel void clockwise(__read_only image2d_t src,
 	sampler_t sampler, __write_only image2d_t dst, int2 sz) {
 	int2 out_cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, out_cd)) { return; }
 	int2 in_cd = (int2)(sz.y - out_cd.y - 1, out_cd.x);
 	write_imagef(dst, out_cd, read_imagef(src, sampler, in_cd));
 }
@@ -18,6 +21,7 @@ __kernel void shear(__read_only image2d_t src, sampler_t sampler, __write_only i
 	int2 out_sz, float2 src_center, int2 dst_center, float2 angles) {
 
 	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
 	int2 cd_center = out_sz - cd - dst_center - (int2)(1);
 	float rot_x = cd_center.x + angles.x * cd_center.y;
 	float rot_y = cd_center.y + angles.y * rot_x;
@@ -31,6 +35,7 @@ __kernel void map(__read_only image2d_t src, sampler_t sampler, __write_only ima
 	int2 out_sz, float2 src_center, int2 dst_center, float2 angles) {
 	
 	int2 cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, cd)) { return; }
 	int2 cd_center = out_sz - cd - dst_center - (int2)(1);
 	float2 origin = (float2)(
 		cd_center.x * angles.y - cd_center.y * angles.x,
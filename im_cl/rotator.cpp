@@ -35,6 +35,7 @@ cl_int2 rotator::rotate_point(const cl_int2& point, const cl_int2& center, doubl
 
 
 im_ptr rotator::run(const std::string& algo, double theta, const cl_int2& center, im_ptr& src) {
+	src->make_image();
 	double rad_theta = theta / 180.0 * CL_M_PI;
 	cl_int2 rot_size = rotate_size(src, rad_theta);
 	float rad = static_cast<float>(rad_theta);
@@ -50,7 +51,7 @@ im_ptr rotator::run(const std::string& algo, double theta, const cl_int2& center
 	}
 	else { throw std::runtime_error("Unknown rotation: " + algo); }
 	cl_kernel kern = kernels->at(algo);
-	cl_mem dst = env->alloc_im(rot_size);
+	cl_mem dst = env->alloc_im(rot_size, nullptr, src->order, src->format);
 	cl_float2 src_center = { (cl_float)center.x, (cl_float)center.y };
 	cl_int2 dst_center = {
 		static_cast<cl_int>((src_center.x / src->size.x) * rot_size.x),
@@ -61,30 +62,31 @@ im_ptr rotator::run(const std::string& algo, double theta, const cl_int2& center
 	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_float2), &src_center);
 	ret_code |= clSetKernelArg(kern, 5, sizeof(cl_int2), &dst_center);
 	ret_code |= clSetKernelArg(kern, 6, sizeof(cl_float2), &angles);
-	cl_event q_event = run_with_event(kern, rot_size);
+	cl_event q_event = run_with_event(kern, rot_size, LAUNCH_PURE | LAUNCH_GUARDED);
 	auto corners = calc_corners(rot_size, src->size, dst_center, rad_theta);
 	cl_int2 reduced_size = { 
 		corners.second.x - corners.first.x,
 		corners.second.y - corners.first.y 
 	};
-	im_ptr result = std::make_shared<im_object>(reduced_size, env);
+	im_ptr result = src->blank(reduced_size);
 	size_t origin[3] = { (size_t)corners.first.x, (size_t)corners.first.y, 0 };
 	size_t zeros[3] = { 0, 0, 0 };
 	size_t region[3] = {(size_t) reduced_size.x, (size_t)reduced_size.y, 1 };
-	ret_code = clEnqueueCopyImage(env->queue, dst, result->cl_storage, origin,
+	ret_code = env->copy_image(dst, result->cl_storage, origin,
 		zeros, region, 1, &q_event, nullptr);
-	ret_code |= clFinish(env->queue);
+	ret_code |= clFinish(env->queue());
 	clReleaseMemObject(dst);
 	return std::move(result);
 }
 
 im_ptr rotator::simple_angle(const std::string& direction, im_ptr& src) {
+	src->make_image();
 	cl_kernel kern = kern = kernels->at(direction);
 	cl_int2 dst_size = { src->size.y, src->size.x };
 	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
-	im_ptr dst = std::make_shared<im_object>(dst_size, env);
+	im_ptr dst = src->blank(dst_size);
 	cl_int ret_code = set_common_args(kern, src->cl_storage, sampler, dst->cl_storage);
 	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int2), &dst_size);
-	run_blocking(kern, dst_size);
+	run_blocking(kern, dst_size, LAUNCH_PURE | LAUNCH_GUARDED);
 	return std::move(dst);
 }
\ No newline at end of file
@@ -0,0 +1,328 @@
+#include"server.h"
+#include<algorithm>
+#include<cstdio>
+
+#ifdef _WIN32
+#include<winsock2.h>
+#include<afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+#define close_socket closesocket
+#define SHUT_RDWR SD_BOTH
+#define MSG_NOSIGNAL 0
+using socket_t = SOCKET;
+#else
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<unistd.h>
+#define close_socket close
+using socket_t = int;
+#define INVALID_SOCKET (-1)
+#endif
+
+server::connection::~connection() { close_socket(static_cast<socket_t>(socket)); }
+
+server::server(const std::string& path, size_t capacity, runner run)
+	: path(path), capacity(capacity), run(run), stopped(false), closed(false) {
+#ifdef _WIN32
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) { throw std::runtime_error("Failed to start winsock"); }
+#endif
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) { throw std::runtime_error("Socket path is too long: " + path); }
+	path.copy(address.sun_path, path.size());
+
+	socket_t sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == INVALID_SOCKET) { throw std::runtime_error("Failed to create socket"); }
+	std::remove(path.c_str());
+	if (::bind(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(sock, 16) != 0) {
+		close_socket(sock);
+		throw std::runtime_error("Failed to listen on " + path);
+	}
+	listener = static_cast<intptr_t>(sock);
+	acceptor = std::thread(&server::accept_loop, this);
+}
+
+server::~server() {
+	shutdown();
+	if (acceptor.joinable()) { acceptor.join(); }
+	for (reader& cur : readers) { cur.thread.join(); }
+	close_socket(static_cast<socket_t>(listener));
+	std::remove(path.c_str());
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+void server::accept_loop() {
+	while (!stopped) {
+		socket_t sock = ::accept(static_cast<socket_t>(listener), nullptr, nullptr);
+		if (sock == INVALID_SOCKET) { continue; }
+		conn_ptr client = std::make_shared<connection>();
+		client->socket = static_cast<intptr_t>(sock);
+		std::lock_guard<std::mutex> guard(lock);
+		if (stopped) { break; }
+		reap();
+		clients.push_back(client);
+		readers.emplace_back();
+		reader& cur = readers.back();
+		cur.thread = std::thread([this, client, &cur] {
+			read_loop(client);
+			cur.done = true;
+		});
+	}
+}
+
+void server::reap() {
+	for (auto it = readers.begin(); it != readers.end();) {
+		if (it->done) { it->thread.join(); it = readers.erase(it); }
+		else { ++it; }
+	}
+	clients.erase(std::remove_if(clients.begin(), clients.end(),
+		[](const std::weak_ptr<connection>& weak) { return weak.expired(); }), clients.end());
+}
+
+void server::read_loop(conn_ptr client) {
+	std::string pending;
+	char chunk[4096];
+	while (true) {
+		int got = ::recv(static_cast<socket_t>(client->socket), chunk, sizeof(chunk), 0);
+		if (got <= 0) { return; }
+		pending.append(chunk, got);
+		size_t eol;
+		while ((eol = pending.find('\n')) != std::string::npos) {
+			std::string line = pending.substr(0, eol);
+			pending.erase(0, eol + 1);
+			if (!line.empty() && line.back() == '\r') { line.pop_back(); }
+			job next;
+			try { next = parse_job(line); }
+			catch (const std::runtime_error& e) {
+				reply(*client, "{\"id\":\"\",\"status\":\"error\",\"error\":\"" + escape(e.what()) + "\"}");
+				continue;
+			}
+			if (next.cmd.first.empty()) { continue; }
+			next.client = client;
+			if (!push(next)) {
+				reply(*client, "{\"id\":\"" + escape(next.id) + "\",\"status\":\"rejected\",\"error\":\"queue is full\"}");
+			}
+		}
+	}
+}
+
+bool server::push(job& next) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (stopped || interactive.size() + batch.size() >= capacity) { return false; }
+	next.queued = clock::now();
+	(next.level == priority::INTERACTIVE ? interactive : batch).push_back(std::move(next));
+	arrived.notify_one();
+	return true;
+}
+
+namespace {
+	/* Sends writes of a thread running a job to its output, other threads keep the console */
+	struct capture_buf : std::streambuf {
+		static thread_local std::string* target;
+		std::streambuf* console;
+
+		explicit capture_buf(std::streambuf* console) : console(console) {}
+
+		int overflow(int sym) override {
+			if (sym == EOF) { return 0; }
+			if (target != nullptr) { target->push_back(static_cast<char>(sym)); return sym; }
+			return console->sputc(static_cast<char>(sym));
+		}
+
+		std::streamsize xsputn(const char* str, std::streamsize count) override {
+			if (target != nullptr) { target->append(str, static_cast<size_t>(count)); return count; }
+			return console->sputn(str, count);
+		}
+
+		int sync() override { return target != nullptr ? 0 : console->pubsync(); }
+	};
+
+	thread_local std::string* capture_buf::target = nullptr;
+}
+
+void server::serve(size_t workers) {
+	capture_buf out(std::cout.rdbuf()), err(std::cerr.rdbuf());
+	std::cout.rdbuf(&out);
+	std::cerr.rdbuf(&err);
+	std::vector<std::thread> extra;
+	for (size_t worker = 1; worker < workers; ++worker) { extra.emplace_back(&server::drain, this); }
+	drain();
+	for (std::thread& worker : extra) { worker.join(); }
+	std::cout.rdbuf(out.console);
+	std::cerr.rdbuf(err.console);
+	shutdown();
+}
+
+void server::drain() {
+	while (true) {
+		job cur;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			arrived.wait(guard, [this] { return stopped || !interactive.empty() || !batch.empty(); });
+			if (stopped) { return; }
+			std::deque<job>& source = interactive.empty() ? batch : interactive;
+			cur = std::move(source.front());
+			source.pop_front();
+		}
+		clock::time_point started = clock::now();
+		std::string status = "ok", result;
+		bool last = cur.cmd.first == "shutdown";
+		if (cur.cmd.first == "quit") { status = "error", result = "Use shutdown to stop the server"; }
+		else if (!last) {
+			std::string captured;
+			capture_buf::target = &captured;
+			try { run(cur.cmd); }
+			catch (const std::runtime_error& e) { status = "error", result = e.what(); }
+			capture_buf::target = nullptr;
+			if (status == "ok") { result = captured; }
+		}
+		clock::time_point finished = clock::now();
+		using ms = std::chrono::duration<double, std::milli>;
+		std::ostringstream line;
+		line << "{\"id\":\"" << escape(cur.id) << "\",\"status\":\"" << status << "\",\""
+			<< (status == "ok" ? "output" : "error") << "\":\"" << escape(result) << "\",\"queue_ms\":"
+			<< ms(started - cur.queued).count() << ",\"run_ms\":" << ms(finished - started).count() << "}";
+		reply(*cur.client, line.str());
+		if (last) {
+			/* Jobs already running on other workers still get their replies */
+			std::lock_guard<std::mutex> guard(lock);
+			stopped = true;
+			arrived.notify_all();
+			return;
+		}
+	}
+}
+
+void server::shutdown() {
+	std::lock_guard<std::mutex> guard(lock);
+	if (closed) { return; }
+	stopped = closed = true;
+	for (job& dropped : interactive) {
+		reply(*dropped.client, "{\"id\":\"" + escape(dropped.id) + "\",\"status\":\"rejected\",\"error\":\"server stopped\"}");
+	}
+	for (job& dropped : batch) {
+		reply(*dropped.client, "{\"id\":\"" + escape(dropped.id) + "\",\"status\":\"rejected\",\"error\":\"server stopped\"}");
+	}
+	interactive.clear(), batch.clear();
+	::shutdown(static_cast<socket_t>(listener), SHUT_RDWR);
+	for (auto& weak : clients) {
+		conn_ptr client = weak.lock();
+		if (client) { ::shutdown(static_cast<socket_t>(client->socket), SHUT_RDWR); }
+	}
+	arrived.notify_all();
+}
+
+void server::reply(connection& client, const std::string& line) {
+	std::lock_guard<std::mutex> guard(client.writing);
+	std::string data = line + "\n";
+	for (size_t sent = 0; sent < data.size(); ) {
+		int put = ::send(static_cast<socket_t>(client.socket), data.data() + sent, static_cast<int>(data.size() - sent), MSG_NOSIGNAL);
+		if (put <= 0) { return; }
+		sent += put;
+	}
+}
+
+namespace {
+	void skip_space(const std::string& str, size_t& pos) {
+		while (pos < str.size() && isspace(static_cast<unsigned char>(str[pos]))) { ++pos; }
+	}
+
+	void expect(const std::string& str, size_t& pos, char sym) {
+		skip_space(str, pos);
+		if (pos >= str.size() || str[pos] != sym) {
+			throw std::runtime_error(std::string("Malformed job, expected '") + sym + "' at " + std::to_string(pos));
+		}
+		++pos;
+	}
+
+	/* String, number or literal as text; nested objects are handled by the caller */
+	std::string scalar(const std::string& str, size_t& pos) {
+		skip_space(str, pos);
+		if (pos < str.size() && str[pos] == '"') {
+			std::string val;
+			for (++pos; pos < str.size() && str[pos] != '"'; ++pos) {
+				if (str[pos] != '\\') { val.push_back(str[pos]); continue; }
+				if (++pos >= str.size()) { break; }
+				switch (str[pos]) {
+				case 'n': val.push_back('\n'); break;
+				case 't': val.push_back('\t'); break;
+				default: val.push_back(str[pos]);
+				}
+			}
+			expect(str, pos, '"');
+			return val;
+		}
+		size_t start = pos;
+		while (pos < str.size() && str[pos] != ',' && str[pos] != '}' && !isspace(static_cast<unsigned char>(str[pos]))) { ++pos; }
+		if (start == pos) { throw std::runtime_error("Malformed job, missing value at " + std::to_string(pos)); }
+		return str.substr(start, pos - start);
+	}
+
+	/* Calls visit(key, pos) for each member, visit consumes the value */
+	template<typename visitor>
+	void members(const std::string& str, size_t& pos, visitor visit) {
+		expect(str, pos, '{');
+		skip_space(str, pos);
+		if (pos < str.size() && str[pos] == '}') { ++pos; return; }
+		while (true) {
+			std::string key = scalar(str, pos);
+			expect(str, pos, ':');
+			visit(key, pos);
+			skip_space(str, pos);
+			if (pos < str.size() && str[pos] == ',') { ++pos; continue; }
+			expect(str, pos, '}');
+			return;
+		}
+	}
+}
+
+server::job server::parse_job(const std::string& line) {
+	job parsed = { "", priority::INTERACTIVE, command(), nullptr, clock::time_point() };
+	size_t pos = 0;
+	skip_space(line, pos);
+	if (pos >= line.size() || line[pos] != '{') {
+		parsed.cmd = util::parse_action(line);
+		return parsed;
+	}
+	keys args;
+	members(line, pos, [&](const std::string& key, size_t& at) {
+		if (key == "args") {
+			members(line, at, [&](const std::string& name, size_t& arg_at) {
+				bool keyed = name[0] == '-' || name.compare(0, 3, "arg") == 0;
+				args[keyed ? name : "-" + name] = scalar(line, arg_at);
+			});
+			return;
+		}
+		std::string val = scalar(line, at);
+		if (key == "id") { parsed.id = val; }
+		else if (key == "command") { parsed.cmd = util::parse_action(val); }
+		else if (key == "priority") {
+			if (val == "interactive") { parsed.level = priority::INTERACTIVE; }
+			else if (val == "batch") { parsed.level = priority::BATCH; }
+			else { throw std::runtime_error("Unknown priority: " + val); }
+		}
+	});
+	if (parsed.cmd.first.empty()) { throw std::runtime_error("Job " + parsed.id + " has no command"); }
+	for (auto& arg : args) { parsed.cmd.second[arg.first] = arg.second; }
+	return parsed;
+}
+
+std::string server::escape(const std::string& str) {
+	std::string escaped;
+	for (char sym : str) {
+		switch (sym) {
+		case '"': escaped.append("\\\""); break;
+		case '\\': escaped.append("\\\\"); break;
+		case '\n': escaped.append("\\n"); break;
+		case '\r': escaped.append("\\r"); break;
+		case '\t': escaped.append("\\t"); break;
+		default:
+			if (static_cast<unsigned char>(sym) < 0x20) { escaped.append(" "); }
+			else { escaped.push_back(sym); }
+		}
+	}
+	return escaped;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include"util.h"
+#include<condition_variable>
+#include<functional>
+#include<thread>
+#include<mutex>
+#include<deque>
+#include<atomic>
+#include<chrono>
+#include<vector>
+#include<list>
+#include<memory>
+
+/* Job server on a Unix domain socket, one command per line, replies one JSON line per job */
+struct server {
+	using runner = std::function<void(command&)>;
+
+	server(const std::string& path, size_t capacity, runner run);
+	~server();
+
+	/* Execute queued jobs on the calling thread and workers - 1 more until shutdown job arrives */
+	void serve(size_t workers = 1);
+private:
+	using clock = std::chrono::steady_clock;
+
+	/* Interactive jobs are taken before batch ones, FIFO within each class */
+	enum class priority { INTERACTIVE, BATCH };
+
+	/* Socket closes once reader and all queued jobs of the client let it go */
+	struct connection {
+		intptr_t socket;
+		std::mutex writing;
+		~connection();
+	};
+	using conn_ptr = std::shared_ptr<connection>;
+
+	/* Thread reading one connection, joined on next accept once the client is gone */
+	struct reader {
+		std::thread thread;
+		std::atomic<bool> done{ false };
+	};
+
+	struct job {
+		std::string id;
+		priority level;
+		command cmd;
+		conn_ptr client;
+		clock::time_point queued;
+	};
+
+	std::string path;
+	size_t capacity;
+	runner run;
+	intptr_t listener;
+	/* Stopped takes no more jobs, closed has also shut the sockets */
+	std::atomic<bool> stopped;
+	bool closed;
+
+	std::mutex lock;
+	std::condition_variable arrived;
+	std::deque<job> interactive, batch;
+	std::vector<std::weak_ptr<connection>> clients;
+	std::list<reader> readers;
+	std::thread acceptor;
+
+	void accept_loop();
+	void read_loop(conn_ptr client);
+
+	/* Join finished readers and forget closed clients, called under lock */
+	void reap();
+
+	/* Run jobs on calling thread until stopped */
+	void drain();
+
+	/* Plain command line or {"id", "priority", "command", "args"} object */
+	static job parse_job(const std::string& line);
+
+	bool push(job& next);
+	static void reply(connection& client, const std::string& line);
+	void shutdown();
+
+	static std::string escape(const std::string& str);
+};
@@ -0,0 +1,151 @@
+#include"tuner.h"
+#include"util.h"
+#include<algorithm>
+#include<chrono>
+#include<fstream>
+#include<limits>
+
+/* Timed launches per candidate after one warm-up, the fastest one counts */
+#define TUNING_REPEATS 3
+
+namespace {
+	/* Tuning files are shared by apps of all devices */
+	std::mutex db_lock;
+
+	int size_class(cl_int extent) {
+		int cls = 0;
+		while ((1 << cls) < extent) { ++cls; }
+		return cls;
+	}
+
+	size_t round_up(size_t val, size_t step) { return (val + step - 1) / step * step; }
+
+	std::string clean(std::string param) {
+		param.erase(std::remove_if(param.begin(), param.end(), [](char sym) {
+			return sym == '\0' || sym == '\t' || sym == '\n'; }), param.end());
+		return param;
+	}
+}
+
+tuner::tuner(hardware* env, const std::string& db_path) : env(env), db_path(db_path) {
+	device_key = clean(hardware::string_param(env->cur_device, CL_DEVICE_NAME)) + "|" +
+		clean(hardware::string_param(env->cur_device, CL_DRIVER_VERSION));
+	std::lock_guard<std::mutex> guard(db_lock);
+	std::ifstream db(db_path);
+	std::string line;
+	while (std::getline(db, line)) {
+		std::istringstream fields(line);
+		std::string device, name;
+		tuning_key key;
+		local_size local;
+		if (!std::getline(fields, device, '\t') || device != device_key) { continue; }
+		if (!std::getline(fields, name, '\t')) { continue; }
+		if (fields >> key.second.first >> key.second.second >> local[0] >> local[1]) {
+			key.first = name;
+			winners[key] = local;
+		}
+	}
+}
+
+tuner::local_size tuner::pick(cl_kernel kern, cl_int2 size, bool guarded, cl_uint wait_num, const cl_event* wait_list) {
+	if (!enabled) { return { 0, 0 }; }
+	tuning_key key;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto named = names.find(kern);
+		if (named == names.end()) { named = names.emplace(kern, hardware::kernel_name(kern)).first; }
+		key = { named->second, { size_class(size.x), size_class(size.y) } };
+		auto known = winners.find(key);
+		if (known != winners.end()) { return known->second; }
+	}
+
+	/* Caller marked kernel pure and its arguments are set, so repeated launches only cost time */
+	if (wait_num != 0) { clWaitForEvents(wait_num, wait_list); }
+	local_size best = { 0, 0 };
+	double best_ms = measure(kern, size, best);
+	for (const local_size& local : candidates(kern, size, guarded)) {
+		double ms = measure(kern, size, local);
+		if (ms < best_ms) { best = local, best_ms = ms; }
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		winners[key] = best;
+	}
+	save(key, best);
+	return best;
+}
+
+std::vector<tuner::local_size> tuner::candidates(cl_kernel kern, cl_int2 size, bool guarded) {
+	static const local_size shapes[] = {
+		{ 4, 4 }, { 8, 4 }, { 8, 8 }, { 16, 4 }, { 16, 8 }, { 16, 16 }, { 32, 2 }, { 32, 4 }, { 32, 8 },
+		{ 64, 1 }, { 64, 2 }, { 64, 4 }, { 128, 1 }, { 128, 2 }, { 256, 1 }
+	};
+	size_t kern_max = 0, item_max[3] = { 0, 0, 0 };
+	clGetKernelWorkGroupInfo(kern, env->cur_device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kern_max, NULL);
+	clGetDeviceInfo(env->cur_device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(item_max), item_max, NULL);
+
+	std::vector<local_size> allowed;
+	for (const local_size& shape : shapes) {
+		if (shape[0] * shape[1] > kern_max || shape[0] > item_max[0] || shape[1] > item_max[1]) { continue; }
+		bool exact = size.x % shape[0] == 0 && size.y % shape[1] == 0;
+		if (!exact && !guarded) { continue; }
+		allowed.push_back(shape);
+	}
+	return allowed;
+}
+
+double tuner::measure(cl_kernel kern, cl_int2 size, const local_size& local) {
+	size_t global_size[2] = { (size_t)size.x, (size_t)size.y };
+	if (local[0] != 0) {
+		global_size[0] = round_up(global_size[0], local[0]);
+		global_size[1] = round_up(global_size[1], local[1]);
+	}
+	cl_command_queue queue = env->queue();
+	double best = std::numeric_limits<double>::infinity();
+	for (int rep = 0; rep <= TUNING_REPEATS; ++rep) {
+		auto start = std::chrono::steady_clock::now();
+		cl_int ret_code = clEnqueueNDRangeKernel(queue, kern, 2, NULL, global_size,
+			(local[0] != 0) ? local.data() : NULL, 0, NULL, NULL);
+		ret_code |= clFinish(queue);
+		/* Runtime may refuse a shape, e.g. out of registers */
+		if (ret_code != CL_SUCCESS) { return std::numeric_limits<double>::infinity(); }
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (rep != 0) { best = std::min(best, elapsed); }
+	}
+	return best;
+}
+
+void tuner::save(const tuning_key& key, const local_size& local) {
+	std::lock_guard<std::mutex> guard(db_lock);
+	std::ofstream db(db_path, std::ios::app);
+	db << device_key << '\t' << key.first << '\t' << key.second.first << ' ' << key.second.second
+		<< ' ' << local[0] << ' ' << local[1] << std::endl;
+}
+
+void tuner::show(std::ostream& out) {
+	std::lock_guard<std::mutex> guard(lock);
+	out << "  " << device_key << (enabled ? "" : " (disabled)") << std::endl;
+	for (auto& winner : winners) {
+		out << "  " << winner.first.first << " up to " << (1 << winner.first.second.first) << "x"
+			<< (1 << winner.first.second.second) << ": ";
+		if (winner.second[0] == 0) { out << "driver default" << std::endl; }
+		else { out << winner.second[0] << "x" << winner.second[1] << std::endl; }
+	}
+}
+
+void tuner::clear() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		winners.clear();
+	}
+	std::lock_guard<std::mutex> guard(db_lock);
+	std::vector<std::string> kept;
+	std::ifstream db(db_path);
+	std::string line;
+	while (std::getline(db, line)) {
+		if (line.compare(0, device_key.size() + 1, device_key + "\t") != 0) { kept.push_back(line); }
+	}
+	db.close();
+	std::ofstream rewritten(db_path, std::ios::trunc);
+	for (const std::string& kept_line : kept) { rewritten << kept_line << std::endl; }
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include"hardware.h"
+#include<array>
+#include<map>
+#include<mutex>
+#include<string>
+
+/* --- Work-group sizes per kernel and image size class ---
+*  Measured on first launch of a class, kept in a tuning file under device name and driver version
+*/
+struct tuner {
+	using local_size = std::array<size_t, 2>;
+
+	/* Off until asked for: first launch of each class runs the kernel once per candidate */
+	bool enabled = false;
+
+	tuner(hardware* env, const std::string& db_path);
+
+	/*
+	*  Best local size for pure kernel with its arguments set, {0, 0} stands for driver default.
+	*  Candidates not dividing size are tried only for guarded kernels
+	*/
+	local_size pick(cl_kernel kern, cl_int2 size, bool guarded, cl_uint wait_num, const cl_event* wait_list);
+
+	/* Print known winners of this device */
+	void show(std::ostream& out);
+
+	/* Forget winners of this device, in memory and in file */
+	void clear();
+
+private:
+	/* Kernel name, width and height classes (ceil log2) */
+	using tuning_key = std::pair<std::string, std::pair<int, int>>;
+
+	hardware* env;
+	std::string db_path, device_key;
+	std::map<tuning_key, local_size> winners;
+	std::map<cl_kernel, std::string> names;
+	std::mutex lock;
+
+	/* Candidates allowed by device and kernel limits, padding only for guarded kernels */
+	std::vector<local_size> candidates(cl_kernel kern, cl_int2 size, bool guarded);
+
+	/* Best of several timed launches, ms */
+	double measure(cl_kernel kern, cl_int2 size, const local_size& local);
+
+	void save(const tuning_key& key, const local_size& local);
+};
@@ -1,6 +1,44 @@
 #include"util.h"
 
-functions* util::kernels = nullptr;
+std::mutex functions::lock;
+
+cl_kernel functions::at(const std::string& name) { return at(name, ""); }
+
+cl_kernel functions::at(const std::string& name, const std::string& defines) {
+	if (names.count(name) == 0) { throw std::runtime_error("Unknown kernel: " + name); }
+	std::unique_lock<std::mutex> guard(lock);
+	auto key = std::make_tuple(std::this_thread::get_id(), defines, name);
+	auto cached = instances.find(key);
+	if (cached != instances.end()) { return cached->second; }
+
+	cl_program variant = program;
+	if (!defines.empty()) {
+		auto built = variants.find(defines);
+		if (built == variants.end()) {
+			if (env == nullptr) { throw std::runtime_error("No source to specialise " + name); }
+			/* Build without holding the lock, other threads keep launching meanwhile */
+			guard.unlock();
+			cl_program fresh = env->build_program(source, "-I. " + defines);
+			guard.lock();
+			built = variants.find(defines);
+			if (built == variants.end()) { built = variants.emplace(defines, fresh).first; }
+			else { clReleaseProgram(fresh); }
+		}
+		variant = built->second;
+	}
+	cl_int ret_code;
+	cl_kernel kern = clCreateKernel(variant, name.c_str(), &ret_code);
+	util::assert_success(ret_code, "Failed to create kernel " + name);
+	return instances.emplace(key, kern).first->second;
+}
+
+void functions::release() {
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto& instance : instances) { clReleaseKernel(instance.second); }
+	instances.clear();
+	for (auto& variant : variants) { clReleaseProgram(variant.second); }
+	variants.clear();
+}
 
 void util::assert_success(cl_int ret_code, const std::string& message) {
 	if (ret_code == CL_SUCCESS) { return; }
@@ -35,31 +73,46 @@ std::string util::file_ext(std::string filename) {
 	return filename.substr(point, filename.length() - point);
 }
 
-command util::next_action() {
+command util::parse_action(const std::string& line) {
 	using is_it = std::istream_iterator<std::string>;
-	std::string cmd, arg("arg"); char free_arg = '0';
-	while (true) {
-		std::getline(std::cin, cmd);
-		std::istringstream iss(cmd);
-		std::vector<std::string> seq((is_it(iss)), is_it());
-		if (seq.empty()) { std::cout << "> "; continue; }
-		command spl_arg = std::make_pair(seq[0], keys());
-		for (size_t p = 1; p < seq.size(); ++p) {
-			if (seq[p][0] == '-') { spl_arg.second.emplace(seq[p], seq[p + 1]); p++; }
-			else { spl_arg.second.emplace(arg + free_arg++, seq[p]); }
-		}
+	std::string arg("arg"); char free_arg = '0';
+	std::istringstream iss(line);
+	std::vector<std::string> seq((is_it(iss)), is_it());
+	if (seq.empty()) { return command(); }
+	command spl_arg = std::make_pair(seq[0], keys());
+	for (size_t p = 1; p < seq.size(); ++p) {
+		if (seq[p][0] == '-' && p + 1 < seq.size()) { spl_arg.second.emplace(seq[p], seq[p + 1]); p++; }
+		else { spl_arg.second.emplace(arg + free_arg++, seq[p]); }
+	}
+	return spl_arg;
+}
+
+command util::next_action() {
+	std::string cmd;
+	while (std::getline(std::cin, cmd)) {
+		command spl_arg = parse_action(cmd);
+		if (spl_arg.first.empty()) { std::cout << "> "; continue; }
 		return spl_arg;
 	}
+	return std::make_pair(std::string("quit"), keys());
 }
 
 functions util::map_of(const std::vector<std::string>& funcs) {
 	functions kern_map;
 	for (auto name = funcs.begin(); name != funcs.end(); ++name) {
-		kern_map[*name] = NULL;
+		kern_map.names.insert(*name);
 	}
 	return kern_map;
 }
 
+std::string util::defines(const std::vector<std::pair<std::string, int>>& constants) {
+	std::string options;
+	for (const auto& constant : constants) {
+		options.append(options.empty() ? "" : " ").append("-D " + constant.first + "=" + std::to_string(constant.second));
+	}
+	return options;
+}
+
 int util::euclidean_gcd(size_t a, size_t b) {
 	while (a != 0 && b != 0) {
 		if (a > b) { a %= b; }
@@ -5,11 +5,42 @@
 #include<iostream>
 #include<string>
 #include<sstream>
+#include<thread>
+#include<mutex>
+#include<map>
+#include<set>
+#include<tuple>
 
 using keys = std::unordered_map<std::string, std::string>;
 using command = std::pair<std::string, keys>;
 
-using functions = std::unordered_map<std::string, cl_kernel>;
+/* Kernels of one program; each host thread gets its own instances, so concurrent executors never share arguments */
+struct functions {
+	cl_program program = nullptr;
+
+	/* Kernels the program is expected to export */
+	std::set<std::string> names;
+
+	/* Source and device to build specialised variants, none for generated programs */
+	std::string source;
+	hardware* env = nullptr;
+
+	/* Instance of calling thread, created on first use */
+	cl_kernel at(const std::string& name);
+
+	/* Same from the variant built with given -D constants, see util::defines */
+	cl_kernel at(const std::string& name, const std::string& defines);
+
+	/* Release instances of all threads and variant programs, main program stays with its owner */
+	void release();
+
+private:
+	/* Variant programs by their -D options, "" is the main program */
+	std::map<std::string, cl_program> variants;
+	std::map<std::tuple<std::thread::id, std::string, std::string>, cl_kernel> instances;
+	static std::mutex lock;
+};
+
 using programs = std::unordered_map<std::string, functions>;
 
 using im_ptr = std::shared_ptr<im_object>;
@@ -19,11 +50,17 @@ struct util {
 
 	static std::string file_ext(std::string filename);
 
+	/* Split line into command name, "-key value" pairs and positional arg0, arg1, ... */
+	static command parse_action(const std::string& line);
+
+	/* Next non-empty command from stdin, quit on end of input */
 	static command next_action();
 
 	static int euclidean_gcd(size_t a, size_t b);
 
 	static functions map_of(const std::vector<std::string>& func_names);
 
-	static functions* kernels;
+	/* Build options "-D NAME=value ..." in given order, used as the variant cache key */
+	static std::string defines(const std::vector<std::pair<std::string, int>>& constants);
+
 };
\ No newline at end of file
@@ -1,57 +1,281 @@
+#include "bounds.cl"
 
-#define INVERSE_BOARD 0.0031308f
-#define DIRECT_BOARD 0.04045f
+/*
+*	Transfer table of 8-bit depth: TRANSFER_DECODE_SIZE entries mapping byte to linear value,
+*	then TRANSFER_ENCODE_STEPS + 1 encoded values at square-spaced linear points
+*/
+#define TRANSFER_DECODE_SIZE 256
+#define TRANSFER_ENCODE_STEPS 4096
 
-#define LESS(x, y) ((x < y)? 1.0f : 0.0f)
+float3 decode_px(uchar3 byte_val, __constant float* table) {
+	return (float3)(table[byte_val.x], table[byte_val.y], table[byte_val.z]);
+}
+
+float encode_val(float val, __constant float* table) {
+	float pos = sqrt(clamp(val, 0.0f, 1.0f)) * TRANSFER_ENCODE_STEPS;
+	int node = min((int)pos, TRANSFER_ENCODE_STEPS - 1);
+	__constant float* enc = table + TRANSFER_DECODE_SIZE;
+	return mix(enc[node], enc[node + 1], pos - node);
+}
 
+uchar3 encode_px(float3 in_val, __constant float* table) {
+	float3 out_val = (float3)(encode_val(in_val.x, table),
+		encode_val(in_val.y, table), encode_val(in_val.z, table));
+	return convert_uchar3_sat(rint(out_val * 255.0f));
+}
 
+/*
+*	Each work item packs four pixels into three uchar4, row tail falls back to per-pixel stores.
+*	Buffer holds a band of rows starting at row_offset of the image
+*/
 __kernel void denormalise(__read_only image2d_t src, sampler_t sampler,
-	__global uchar* dst, int2 size, int gamma_correction) {
+	__global uchar* dst, int2 size, __constant float* table, int row_offset) {
 
-	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float3 in_val = read_imagef(src, sampler, coord).xyz;
-	if (gamma_correction == 1) {
-		float3 linear = (float3)(LESS(in_val.x, INVERSE_BOARD),
-			LESS(in_val.x, INVERSE_BOARD), LESS(in_val.x, INVERSE_BOARD));
-		float3 non_linear = (float3)(1.0f) - linear;
-		in_val = linear * 12.92f * in_val +
-			non_linear * (1.055f * pow(in_val, 1.0f / 2.40f) - 0.055f);
+	int2 coord = (int2)(get_global_id(0) * 4, get_global_id(1) + row_offset);
+	__global uchar* row = dst + 3 * (coord.x + size.x * (coord.y - row_offset));
+	if (coord.x + 4 <= size.x) {
+		uchar3 p0 = encode_px(read_imagef(src, sampler, coord).xyz, table);
+		uchar3 p1 = encode_px(read_imagef(src, sampler, coord + (int2)(1, 0)).xyz, table);
+		uchar3 p2 = encode_px(read_imagef(src, sampler, coord + (int2)(2, 0)).xyz, table);
+		uchar3 p3 = encode_px(read_imagef(src, sampler, coord + (int2)(3, 0)).xyz, table);
+		vstore4((uchar4)(p0, p1.x), 0, row);
+		vstore4((uchar4)(p1.yz, p2.xy), 0, row + 4);
+		vstore4((uchar4)(p2.z, p3), 0, row + 8);
+	}
+	else {
+		for (int px = 0; coord.x + px < size.x; ++px) {
+			float3 in_val = read_imagef(src, sampler, coord + (int2)(px, 0)).xyz;
+			vstore3(encode_px(in_val, table), px, row);
+		}
 	}
-	uchar3 out_val = convert_uchar3(rint(in_val * 255.0f));
-	vstore3(out_val, coord.x + size.x * coord.y, dst);
 }
 
 __kernel void normalise(__global uchar* src, int2 size,
-	__write_only image2d_t dst, int gamma_correction) {
+	__write_only image2d_t dst, __constant float* table, int row_offset) {
+
+	int2 coord = (int2)(get_global_id(0) * 4, get_global_id(1) + row_offset);
+	__global uchar* row = src + 3 * (coord.x + size.x * (coord.y - row_offset));
+	if (coord.x + 4 <= size.x) {
+		uchar4 b0 = vload4(0, row), b1 = vload4(0, row + 4), b2 = vload4(0, row + 8);
+		write_imagef(dst, coord, (float4)(decode_px(b0.xyz, table), 0.0f));
+		write_imagef(dst, coord + (int2)(1, 0), (float4)(decode_px((uchar3)(b0.w, b1.xy), table), 0.0f));
+		write_imagef(dst, coord + (int2)(2, 0), (float4)(decode_px((uchar3)(b1.zw, b2.x), table), 0.0f));
+		write_imagef(dst, coord + (int2)(3, 0), (float4)(decode_px(b2.yzw, table), 0.0f));
+	}
+	else {
+		for (int px = 0; coord.x + px < size.x; ++px) {
+			float3 out_val = decode_px(vload3(px, row), table);
+			write_imagef(dst, coord + (int2)(px, 0), (float4)(out_val, 0.0f));
+		}
+	}
+}
+
+/* Same as normalise/denormalise for buffer-backed images, rows of float4 pixels */
+__kernel void normalise_buf(__global uchar* src, int2 size,
+	__global float* dst, __constant float* table, int row_offset) {
+
+	int2 coord = (int2)(get_global_id(0) * 4, get_global_id(1) + row_offset);
+	__global uchar* row = src + 3 * (coord.x + size.x * (coord.y - row_offset));
+	if (coord.x + 4 <= size.x) {
+		uchar4 b0 = vload4(0, row), b1 = vload4(0, row + 4), b2 = vload4(0, row + 8);
+		store_px(dst, size, coord, (float4)(decode_px(b0.xyz, table), 0.0f));
+		store_px(dst, size, coord + (int2)(1, 0), (float4)(decode_px((uchar3)(b0.w, b1.xy), table), 0.0f));
+		store_px(dst, size, coord + (int2)(2, 0), (float4)(decode_px((uchar3)(b1.zw, b2.x), table), 0.0f));
+		store_px(dst, size, coord + (int2)(3, 0), (float4)(decode_px(b2.yzw, table), 0.0f));
+	}
+	else {
+		for (int px = 0; coord.x + px < size.x; ++px) {
+			float3 out_val = decode_px(vload3(px, row), table);
+			store_px(dst, size, coord + (int2)(px, 0), (float4)(out_val, 0.0f));
+		}
+	}
+}
+
+__kernel void denormalise_buf(__global const float* src, __global uchar* dst,
+	int2 size, __constant float* table, int row_offset) {
+
+	int2 coord = (int2)(get_global_id(0) * 4, get_global_id(1) + row_offset);
+	__global uchar* row = dst + 3 * (coord.x + size.x * (coord.y - row_offset));
+	if (coord.x + 4 <= size.x) {
+		uchar3 p0 = encode_px(load_px(src, size, coord).xyz, table);
+		uchar3 p1 = encode_px(load_px(src, size, coord + (int2)(1, 0)).xyz, table);
+		uchar3 p2 = encode_px(load_px(src, size, coord + (int2)(2, 0)).xyz, table);
+		uchar3 p3 = encode_px(load_px(src, size, coord + (int2)(3, 0)).xyz, table);
+		vstore4((uchar4)(p0, p1.x), 0, row);
+		vstore4((uchar4)(p1.yz, p2.xy), 0, row + 4);
+		vstore4((uchar4)(p2.z, p3), 0, row + 8);
+	}
+	else {
+		for (int px = 0; coord.x + px < size.x; ++px) {
+			float3 in_val = load_px(src, size, coord + (int2)(px, 0)).xyz;
+			vstore3(encode_px(in_val, table), px, row);
+		}
+	}
+}
+
+/*
+*	Any channel count (1 - grey, 2 - grey + alpha, 3 - rgb, 4 - rgba) and depth (1 or 2 bytes, big-endian).
+*	Table holds 2^(8 * depth) decode entries followed by encode nodes, alpha bypasses it
+*/
+/* Variants built with -D SAMPLE_CHANNELS=<n> -D SAMPLE_DEPTH=<d> fold the layout branches */
+#ifdef SAMPLE_CHANNELS
+#define CHANNELS SAMPLE_CHANNELS
+#define DEPTH SAMPLE_DEPTH
+#else
+#define CHANNELS channels
+#define DEPTH depth
+#endif
+
+uint load_sample(__global uchar* src, int index, int depth) {
+	return (depth == 2) ? ((uint)src[2 * index] << 8) | src[2 * index + 1] : src[index];
+}
+
+void store_sample(__global uchar* dst, int index, int depth, uint code) {
+	if (depth == 2) {
+		dst[2 * index] = (uchar)(code >> 8);
+		dst[2 * index + 1] = (uchar)code;
+	}
+	else { dst[index] = (uchar)code; }
+}
+
+float encode_val_any(float val, __global const float* table, int depth) {
+	float pos = sqrt(clamp(val, 0.0f, 1.0f)) * TRANSFER_ENCODE_STEPS;
+	int node = min((int)pos, TRANSFER_ENCODE_STEPS - 1);
+	__global const float* enc = table + (1 << (8 * depth));
+	return mix(enc[node], enc[node + 1], pos - node);
+}
+
+__kernel void normalise_any(__global uchar* src, int2 size, __write_only image2d_t dst,
+	__global const float* table, int channels, int depth, int row_offset) {
+
+	int2 coord = (int2)(get_global_id(0), get_global_id(1) + row_offset);
+	int base = CHANNELS * (coord.x + size.x * (coord.y - row_offset));
+	float max_code = (float)((1 << (8 * DEPTH)) - 1);
+	float4 out_val = (float4)(0.0f);
+	if (CHANNELS < 3) {
+		out_val.xyz = (float3)(table[load_sample(src, base, DEPTH)]);
+		if (CHANNELS == 2) { out_val.w = load_sample(src, base + 1, DEPTH) / max_code; }
+	}
+	else {
+		out_val.xyz = (float3)(table[load_sample(src, base, DEPTH)],
+			table[load_sample(src, base + 1, DEPTH)], table[load_sample(src, base + 2, DEPTH)]);
+		if (CHANNELS == 4) { out_val.w = load_sample(src, base + 3, DEPTH) / max_code; }
+	}
+	write_imagef(dst, coord, out_val);
+}
+
+__kernel void denormalise_any(__read_only image2d_t src, sampler_t sampler, __global uchar* dst,
+	int2 size, __global const float* table, int channels, int depth, int row_offset) {
+
+	int2 coord = (int2)(get_global_id(0), get_global_id(1) + row_offset);
+	int base = CHANNELS * (coord.x + size.x * (coord.y - row_offset));
+	float max_code = (float)((1 << (8 * DEPTH)) - 1);
+	float4 in_val = read_imagef(src, sampler, coord);
+	int colours = (CHANNELS < 3) ? 1 : 3;
+	for (int ch = 0; ch < colours; ++ch) {
+		float val = encode_val_any((ch == 0) ? in_val.x : (ch == 1) ? in_val.y : in_val.z, table, DEPTH);
+		store_sample(dst, base + ch, DEPTH, convert_uint_sat(rint(val * max_code)));
+	}
+	if (CHANNELS == 2 || CHANNELS == 4) {
+		store_sample(dst, base + colours, DEPTH, convert_uint_sat(rint(clamp(in_val.w, 0.0f, 1.0f) * max_code)));
+	}
+}
+
+__kernel void split_planes(__read_only image2d_t src, sampler_t sampler,
+	__write_only image2d_t dst_0, __write_only image2d_t dst_1, __write_only image2d_t dst_2) {
 
 	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	uchar3 byte_val = vload3(coord.x + size.x * coord.y, src);
-	float3 out_val = convert_float3(byte_val) / 255.0f;
-	if (gamma_correction == 1) {
-		float3 linear = (float3)(LESS(out_val.x, DIRECT_BOARD),
-			LESS(out_val.y, DIRECT_BOARD), LESS(out_val.z, DIRECT_BOARD));
-		float3 non_linear = (float3)(1.0f) - linear;
-		out_val = linear * out_val / 12.92f + 
-			non_linear * pow((out_val + 0.055f) / 1.055f, 2.4f);
+	if (OUTSIDE(dst_0, coord)) { return; }
+	float4 in_val = read_imagef(src, sampler, coord);
+	write_imagef(dst_0, coord, (float4)(in_val.x));
+	write_imagef(dst_1, coord, (float4)(in_val.y));
+	write_imagef(dst_2, coord, (float4)(in_val.z));
+}
+
+__kernel void merge_planes(__read_only image2d_t src_0, __read_only image2d_t src_1,
+	__read_only image2d_t src_2, sampler_t sampler, __write_only image2d_t dst) {
+
+	int2 coord = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, coord)) { return; }
+	float4 out_val = (float4)(read_imagef(src_0, sampler, coord).x,
+		read_imagef(src_1, sampler, coord).x, read_imagef(src_2, sampler, coord).x, 0.0f);
+	write_imagef(dst, coord, out_val);
+}
+
+
+/*
+*	Per-channel statistics by tree reductions in local memory.
+*	Records merge by Chan's formula: counts, means and sums of squared deviations,
+*	no sums of squares to cancel out. -D STAT_BUF takes buffer-backed images
+*/
+typedef struct {
+	float4 min_val, max_val, mean, m2;
+	uint pixels;
+} stat_rec;
+
+stat_rec stat_merge(stat_rec a, stat_rec b) {
+	if (b.pixels == 0) { return a; }
+	if (a.pixels == 0) { return b; }
+	float total = (float)a.pixels + (float)b.pixels;
+	float4 delta = b.mean - a.mean;
+	a.min_val = fmin(a.min_val, b.min_val);
+	a.max_val = fmax(a.max_val, b.max_val);
+	a.mean += delta * ((float)b.pixels / total);
+	a.m2 += b.m2 + delta * delta * ((float)a.pixels * (float)b.pixels / total);
+	a.pixels += b.pixels;
+	return a;
+}
+
+/* Merges records of the work-group into scratch[0] */
+void stat_tree(stat_rec rec, __local stat_rec* scratch) {
+	int lid = get_local_id(0);
+	scratch[lid] = rec;
+	for (int stride = get_local_size(0) / 2; stride > 0; stride >>= 1) {
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < stride) { scratch[lid] = stat_merge(scratch[lid], scratch[lid + stride]); }
 	}
-	write_imagef(dst, coord, (float4)(out_val, 0.0f));
+	barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+/* rect: x, y, width, height; work-items stride over its pixels, one record per work-group */
+#ifdef STAT_BUF
+__kernel void stat_partial(__global const float* src, int2 size, int4 rect,
+#else
+__kernel void stat_partial(__read_only image2d_t src, sampler_t sampler, int4 rect,
+#endif
+	__global stat_rec* partials, __local stat_rec* scratch) {
+
+	stat_rec rec = { (float4)(INFINITY), (float4)(-INFINITY), (float4)(0.0f), (float4)(0.0f), 0 };
+	uint area = (uint)rect.z * (uint)rect.w;
+	for (uint p = get_global_id(0); p < area; p += get_global_size(0)) {
+		int2 coord = (int2)(rect.x + p % rect.z, rect.y + p / rect.z);
+#ifdef STAT_BUF
+		float4 val = load_px(src, size, coord);
+#else
+		float4 val = read_imagef(src, sampler, coord);
+#endif
+		rec.pixels += 1;
+		float4 delta = val - rec.mean;
+		rec.mean += delta / (float)rec.pixels;
+		rec.m2 += delta * (val - rec.mean);
+		rec.min_val = fmin(rec.min_val, val);
+		rec.max_val = fmax(rec.max_val, val);
+	}
+	stat_tree(rec, scratch);
+	if (get_local_id(0) == 0) { partials[get_group_id(0)] = scratch[0]; }
+}
+
+/* Single work-group over records of stat_partial, result to partials[0] */
+__kernel void stat_final(__global stat_rec* partials, int groups, __local stat_rec* scratch) {
+	stat_rec rec = { (float4)(INFINITY), (float4)(-INFINITY), (float4)(0.0f), (float4)(0.0f), 0 };
+	for (int g = get_local_id(0); g < groups; g += get_local_size(0)) { rec = stat_merge(rec, partials[g]); }
+	stat_tree(rec, scratch);
+	if (get_local_id(0) == 0) { partials[0] = scratch[0]; }
 }
 
-__kernel void split_channels(__read_only image2d_t src, sampler_t sampler,
-	__global uchar* seq_channels, int2 size, int gamma_correction) {
 
+/* Dispatched with global offset over the pasted rectangle of dst, shift leads to the same pixel of src */
+__kernel void paste_region(__read_only image2d_t src, sampler_t sampler, __write_only image2d_t dst, int2 shift) {
 	int2 coord = (int2)(get_global_id(0), get_global_id(1));
-	float3 in_val = read_imagef(src, sampler, coord).xyz;
-	if (gamma_correction == 1) {
-		float3 linear = (float3)(LESS(in_val.x, INVERSE_BOARD),
-			LESS(in_val.x, INVERSE_BOARD), LESS(in_val.x, INVERSE_BOARD));
-		float3 non_linear = (float3)(1.0f) - linear;
-		in_val = linear * 12.92f * in_val +
-			non_linear * (1.055f * pow(in_val, 1.0f / 2.40f) - 0.055f);
-	}
-	uchar3 out_val = convert_uchar3(rint(in_val * 255.0f));
-	int linear_coord = coord.x + size.x * coord.y;
-	seq_channels[linear_coord] = out_val.x;
-	seq_channels[linear_coord + size.x * size.y] = out_val.y;
-	seq_channels[linear_coord + 2 * size.x * size.y] = out_val.z;
+	write_imagef(dst, coord, read_imagef(src, sampler, coord + shift));
 }
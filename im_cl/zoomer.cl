@@ -1,3 +1,4 @@
+#include "bounds.cl"
 
 /* 
 *	Bilinear Interpolation
@@ -7,16 +8,38 @@ __kernel void bilinear(__read_only image2d_t src,
 	sampler_t sampler, __write_only image2d_t dst, float2 factor) {
 
 	int2 out_cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, out_cd)) { return; }
 	float2 base_cd = (float2)(out_cd.x / factor.x, out_cd.y / factor.y);
 	float4 out_val = read_imagef(src, sampler, base_cd);
 	write_imagef(dst, out_cd, out_val);
 }
 
+/* Buffer-backed images, same texel-centre convention as the linear sampler */
+__kernel void bilinear_buf(__global const float* src, int2 src_size,
+	__global float* dst, int2 dst_size, float2 factor) {
+
+	int2 out_cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE_BUF(dst_size, out_cd)) { return; }
+	float2 pos = convert_float2(out_cd) / factor - 0.5f;
+	float2 base = floor(pos), w = pos - base;
+	int2 cd = convert_int2(base);
+	float4 top = mix(load_px(src, src_size, cd), load_px(src, src_size, cd + (int2)(1, 0)), w.x);
+	float4 bottom = mix(load_px(src, src_size, cd + (int2)(0, 1)), load_px(src, src_size, cd + (int2)(1, 1)), w.x);
+	store_px(dst, dst_size, out_cd, mix(top, bottom, w.y));
+}
+
 
 /* 
 *	Lanczos. Using sinc function
 */
 
+/* Variants built with -D LANCZOS_ORDER=<n> have constant loop bounds and unroll */
+#ifdef LANCZOS_ORDER
+#define ORDER LANCZOS_ORDER
+#else
+#define ORDER order
+#endif
+
 float sinc(float val, int order) {
 	float pi_val = val * M_PI;
 	float order_val = pi_val / (float)order;
@@ -27,18 +50,19 @@ __kernel void lanczos(__read_only image2d_t src, sampler_t sampler,
 	__write_only image2d_t dst, float2 factor, int order) {
 
 	int2 out_cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, out_cd)) { return; }
 	float2 base_cd_f;
 	float2 frac = modf(convert_float2(out_cd) / factor, &base_cd_f);
 	int2 base_cd = convert_int2(rint(base_cd_f));
 	
 	float kern_sum = 0.0f;
 	float4 output = 0.0f;
-	for (int y = -order; y <= order; ++y) {
-		for (int x = -order; x <= order; ++x) {
+	for (int y = -ORDER; y <= ORDER; ++y) {
+		for (int x = -ORDER; x <= ORDER; ++x) {
 			float2 off_val = ((float2)(x, y) - frac);
 			int2 cur_cd = (int2)(base_cd.x + x, base_cd.y + y);
 			float4 cur_val = read_imagef(src, sampler, cur_cd);
-			float cur_weight = sinc(off_val.x, order) * sinc(off_val.y, order);
+			float cur_weight = sinc(off_val.x, ORDER) * sinc(off_val.y, ORDER);
 			kern_sum += cur_weight;
 			output += cur_val * cur_weight;
 		}
@@ -47,6 +71,30 @@ __kernel void lanczos(__read_only image2d_t src, sampler_t sampler,
 	write_imagef(dst, out_cd, output);
 }
 
+__kernel void lanczos_buf(__global const float* src, int2 src_size,
+	__global float* dst, int2 dst_size, float2 factor, int order) {
+
+	int2 out_cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE_BUF(dst_size, out_cd)) { return; }
+	float2 base_cd_f;
+	float2 frac = modf(convert_float2(out_cd) / factor, &base_cd_f);
+	int2 base_cd = convert_int2(rint(base_cd_f));
+
+	float kern_sum = 0.0f;
+	float4 output = 0.0f;
+	for (int y = -ORDER; y <= ORDER; ++y) {
+		for (int x = -ORDER; x <= ORDER; ++x) {
+			float2 off_val = ((float2)(x, y) - frac);
+			float4 cur_val = load_px(src, src_size, base_cd + (int2)(x, y));
+			float cur_weight = sinc(off_val.x, ORDER) * sinc(off_val.y, ORDER);
+			kern_sum += cur_weight;
+			output += cur_val * cur_weight;
+		}
+	}
+	output = fmax((float4)0.0f, fmin(1.0f, output / kern_sum));
+	store_px(dst, dst_size, out_cd, output);
+}
+
 
 /*
 *	BC-Splines. Using polynomials
@@ -67,6 +115,7 @@ __kernel void splines(__read_only image2d_t src, sampler_t sampler, __write_only
 	float2 factor, __constant float* upper, __constant float* lower) {
 
 	int2 out_cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, out_cd)) { return; }
 	float2 base_cd_f;
 	float2 frac = modf(convert_float2(out_cd) / factor, &base_cd_f);
 	int2 base_cd = convert_int2(rint(base_cd_f));
@@ -95,6 +144,7 @@ __kernel void precise(__read_only image2d_t src, sampler_t sampler,
 	__write_only image2d_t dst, int2 split_out, int2 split_in, float area) {
 
 	int2 out_cd = (int2)(get_global_id(0), get_global_id(1));
+	if (OUTSIDE(dst, out_cd)) { return; }
 	int2 cur_pix = (out_cd * split_out) / split_in;
 	int2 in_pix = (out_cd * split_out) % split_in;
 	int2 start_pix = cur_pix;
@@ -57,9 +57,12 @@ im_ptr zoomer::run(const std::string& kernel_type, float factor, im_ptr& src) {
 	}
 	int params[3] = { -1, -1, -1 };
 	cl_kernel kern;
+	/* No buffer variant of splines */
+	if (kernel_type != "bilinear" && kernel_type.compare(0, 3, "lan") != 0) { src->make_image(); }
+	std::string suffix = src->buffered ? "_buf" : "";
 
 	if (kernel_type == "bilinear") { 
-		params[FUNC] = KERN_BILINEAR; kern = kernels->at("bilinear");
+		params[FUNC] = KERN_BILINEAR; kern = kernels->at("bilinear" + suffix);
 		goto end_switch;
 	}
 
@@ -67,7 +70,10 @@ im_ptr zoomer::run(const std::string& kernel_type, float factor, im_ptr& src) {
 	else if (kernel_type == "lan4") { params[FUNC] = KERN_LANCZOS; params[LAN_ORDER] = 2; }
 	else if (kernel_type == "lan5") { params[FUNC] = KERN_LANCZOS; params[LAN_ORDER] = 3; }
 
-	if (params[FUNC] == KERN_LANCZOS) { kern = kernels->at("lanczos"); goto end_switch; }
+	if (params[FUNC] == KERN_LANCZOS) {
+		kern = kernels->at("lanczos" + suffix, util::defines({ { "LANCZOS_ORDER", params[LAN_ORDER] } }));
+		goto end_switch;
+	}
 	else if (kernel_type == "mitchell") { params[FUNC] = KERN_SPLINE;  params[POL_INDEX] = MITCHELL; }
 	else if (kernel_type == "catmull") { params[FUNC] = KERN_SPLINE; params[POL_INDEX] = CATMULL; }
 	else if (kernel_type == "adobe") { params[FUNC] = KERN_SPLINE; params[POL_INDEX] = ADOBE; }
@@ -79,7 +85,7 @@ im_ptr zoomer::run(const std::string& kernel_type, float factor, im_ptr& src) {
 	end_switch:
 	bool upscale = factor >= 1.0f;
 	float step_factor = upscale ? 2.0f : 0.5f;
-	cl_int2 cur_size = src->size;
+	cl_int2 cur_size = src->size, prev_size = src->size;
 
 	cl_mem src_ptr = src->cl_storage;
 	clRetainMemObject(src_ptr);
@@ -92,19 +98,22 @@ im_ptr zoomer::run(const std::string& kernel_type, float factor, im_ptr& src) {
 	while ((upscale && factor > 2.0f) || (!upscale && factor < 0.5f)) {
 		cur_size.x = static_cast<cl_int>(cur_size.x * step_factor);
 		cur_size.y = static_cast<cl_int>(cur_size.y * step_factor);
-		dst_ptr = env->alloc_im(cur_size);
-		set_args(kern, src_ptr, dst_ptr, sampler, step_factor, params);
-		run_blocking(kern, cur_size); std::swap(src_ptr, dst_ptr);
+		dst_ptr = src->alloc_storage(cur_size);
+		if (src->buffered) { set_buf_args(kern, src_ptr, prev_size, dst_ptr, cur_size, step_factor, params); }
+		else { set_args(kern, src_ptr, dst_ptr, sampler, step_factor, params); }
+		run_blocking(kern, cur_size, LAUNCH_PURE | LAUNCH_GUARDED); std::swap(src_ptr, dst_ptr);
+		prev_size = cur_size;
 		clReleaseMemObject(dst_ptr);
 		factor /= step_factor;
 	}
 
 	cur_size.x = static_cast<cl_int>(cur_size.x * factor);
 	cur_size.y = static_cast<cl_int>(cur_size.y * factor);
-	dst_ptr = env->alloc_im(cur_size);
-	set_args(kern, src_ptr, dst_ptr, sampler, step_factor, params);
-	run_blocking(kern, cur_size); clReleaseMemObject(src_ptr);
-	return std::make_shared<im_object>(cur_size, env, dst_ptr);
+	dst_ptr = src->alloc_storage(cur_size);
+	if (src->buffered) { set_buf_args(kern, src_ptr, prev_size, dst_ptr, cur_size, step_factor, params); }
+	else { set_args(kern, src_ptr, dst_ptr, sampler, step_factor, params); }
+	run_blocking(kern, cur_size, LAUNCH_PURE | LAUNCH_GUARDED); clReleaseMemObject(src_ptr);
+	return src->blank(cur_size, dst_ptr);
 }
 
 void zoomer::set_args(cl_kernel kern, cl_mem src, cl_mem dst, 
@@ -129,9 +138,22 @@ void zoomer::set_args(cl_kernel kern, cl_mem src, cl_mem dst,
 
 }
 
+void zoomer::set_buf_args(cl_kernel kern, cl_mem src, cl_int2 src_size,
+	cl_mem dst, cl_int2 dst_size, float factor, int* params) {
+	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &src);
+	ret_code |= clSetKernelArg(kern, 1, sizeof(cl_int2), &src_size);
+	ret_code |= clSetKernelArg(kern, 2, sizeof(cl_mem), &dst);
+	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int2), &dst_size);
+	cl_float2 cl_fact = { factor, factor };
+	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_float2), &cl_fact);
+	if (params[FUNC] == KERN_LANCZOS) { ret_code |= clSetKernelArg(kern, 5, sizeof(int), &params[LAN_ORDER]); }
+	util::assert_success(ret_code, "Failed to set extra args");
+}
+
 im_ptr zoomer::precise(im_ptr& src, cl_int2 new_size) {
+	src->make_image();
 	cl_kernel kern = kernels->at("precise");
-	im_ptr result = std::make_shared<im_object>(new_size, env);
+	im_ptr result = src->blank(new_size);
 	cl_sampler sampler = env->samplers.at({ CL_ADDRESS_NONE, CL_FILTER_NEAREST });
 
 	cl_int ret_code = clSetKernelArg(kern, 0, sizeof(cl_mem), &src->cl_storage);
@@ -146,6 +168,6 @@ im_ptr zoomer::precise(im_ptr& src, cl_int2 new_size) {
 	ret_code |= clSetKernelArg(kern, 3, sizeof(cl_int2), &split_out);
 	ret_code |= clSetKernelArg(kern, 4, sizeof(cl_int2), &split_in);
 	ret_code |= clSetKernelArg(kern, 5, sizeof(cl_float), &area);
-	run_blocking(kern, new_size);
+	run_blocking(kern, new_size, LAUNCH_PURE | LAUNCH_GUARDED);
 	return std::move(result);
 }
\ No newline at end of file
@@ -0,0 +1,235 @@
+#include"../im_cl/app.h"
+#include<algorithm>
+#include<chrono>
+#include<cmath>
+#include<fstream>
+#include<functional>
+#include<iomanip>
+
+/*
+*  Benchmark of executors over synthetic images, prints JSON.
+*  Run from im_cl directory, kernels are loaded from working directory.
+*/
+
+struct bench_case {
+	std::string executor, variant;
+	int gamma;
+	std::function<im_ptr(app&, im_ptr&)> run;
+
+	/* Maps result back to source of given size, quality of the round trip is reported with -q on */
+	std::function<im_ptr(app&, im_ptr&, cl_int2)> restore = nullptr;
+};
+
+struct stats {
+	double median, p95;
+};
+
+std::string bench_syntax = "im_cl_bench [-p <platform_id>] [-d <device_id>] [-s <WxH,WxH,...>] "
+	"[-r <repetitions>] [-w <warmup>] [-f <filter_substring>] [-q on|off] [-o <output.json>]";
+
+stats summarise(std::vector<double> samples) {
+	std::sort(samples.begin(), samples.end());
+	size_t n = samples.size();
+	double median = (n % 2 == 1) ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2.0;
+	size_t p95_index = std::min(n - 1, static_cast<size_t>(0.95 * (n - 1) + 0.5));
+	return { median, samples[p95_index] };
+}
+
+char to_byte(int val) { return static_cast<char>(std::max(0, std::min(255, val))); }
+
+/* Smooth gradients with deterministic noise, so histogram and edge-dependent paths see realistic data */
+im_ptr synthetic(app& bench_app, cl_int2 size, int gamma) {
+	size_t pixels = static_cast<size_t>(size.x) * size.y;
+	char* host = new char[3 * pixels];
+	unsigned int seed = 0x9e3779b9u;
+	for (int y = 0; y < size.y; ++y) {
+		for (int x = 0; x < size.x; ++x) {
+			seed = seed * 1664525u + 1013904223u;
+			int noise = static_cast<int>(seed >> 28) - 8;
+			size_t pix = 3 * (static_cast<size_t>(y) * size.x + x);
+			host[pix] = to_byte(255 * x / size.x + noise);
+			host[pix + 1] = to_byte(255 * y / size.y + noise);
+			host[pix + 2] = to_byte(255 * (x + y) / (size.x + size.y) + noise);
+		}
+	}
+	return std::make_shared<im_object>(host, size.x, size.y, &bench_app.env,
+		gamma, bench_app.storage_for(gamma, 1));
+}
+
+std::vector<bench_case> all_cases() {
+	std::vector<bench_case> cases;
+	for (std::string type : { "bilinear", "lan3", "lan4", "lan5", "mitchell", "catmull", "adobe", "b-spline" }) {
+		cases.push_back({ "zoomer", type, GAMMA_CORRECTION_ON,
+			[type](app& a, im_ptr& src) { return a.zoomer_ptr->run(type, 2.0f, src); },
+			[type](app& a, im_ptr& result, cl_int2) { return a.zoomer_ptr->run(type, 0.5f, result); } });
+	}
+	cases.push_back({ "zoomer", "precise", GAMMA_CORRECTION_ON, [](app& a, im_ptr& src) {
+		return a.zoomer_ptr->precise(src, { src->size.x * 3 / 2, src->size.y * 3 / 2 });
+	}, [](app& a, im_ptr& result, cl_int2 size) { return a.zoomer_ptr->precise(result, size); } });
+
+	std::vector<converser::col_pair> pairs;
+	for (const auto& from : converser::conversions) {
+		for (const std::string& to : from.second) { pairs.push_back({ from.first, to }); }
+	}
+	std::sort(pairs.begin(), pairs.end());
+	for (const auto& colours : pairs) {
+		cases.push_back({ "converser", colours.first + "->" + colours.second, GAMMA_CORRECTION_OFF,
+			[colours](app& a, im_ptr& src) { return a.converser_ptr->run(colours, src); },
+			[colours](app& a, im_ptr& result, cl_int2) { return a.converser_ptr->run({ colours.second, colours.first }, result); } });
+	}
+
+	for (std::string algo : { "shear", "map" }) {
+		cases.push_back({ "rotator", algo, GAMMA_CORRECTION_ON, [algo](app& a, im_ptr& src) {
+			return a.rotator_ptr->run(algo, 30.0, { src->size.x / 2, src->size.y / 2 }, src);
+		} });
+	}
+	for (std::string direction : { "clockwise", "counter_clockwise" }) {
+		std::string back = (direction == "clockwise") ? "counter_clockwise" : "clockwise";
+		cases.push_back({ "rotator", direction, GAMMA_CORRECTION_ON,
+			[direction](app& a, im_ptr& src) { return a.rotator_ptr->simple_angle(direction, src); },
+			[back](app& a, im_ptr& result, cl_int2) { return a.rotator_ptr->simple_angle(back, result); } });
+	}
+
+	for (int window : { 3, 5, 9, 15, 25 }) {
+		cases.push_back({ "filter", "gauss_" + std::to_string(window), GAMMA_CORRECTION_ON,
+			[window](app& a, im_ptr& src) { return a.filter_ptr->gauss(window / 6.0f, window, src); } });
+	}
+
+	for (int mode : { contraster::all_channels, contraster::single_channel }) {
+		std::string suffix = (mode == contraster::all_channels) ? "_all" : "_single";
+		cases.push_back({ "contraster", "manual" + suffix, GAMMA_CORRECTION_OFF,
+			[mode](app& a, im_ptr& src) { return a.contraster_ptr->manual(src, 0.5f, mode); } });
+		cases.push_back({ "contraster", "exclusive" + suffix, GAMMA_CORRECTION_OFF,
+			[mode](app& a, im_ptr& src) { return a.contraster_ptr->exclusive_hist(src, 0.0039f, mode); } });
+		cases.push_back({ "contraster", "adaptive" + suffix, GAMMA_CORRECTION_OFF,
+			[mode](app& a, im_ptr& src) { return a.contraster_ptr->adaptive_hist(src, { 8, 8 }, 4, mode); } });
+	}
+	return cases;
+}
+
+/* Sum of kernel execution times recorded in log, releases events */
+double device_ms(std::vector<hardware::record>& log) {
+	cl_ulong total = 0;
+	for (const hardware::record& rec : log) {
+		cl_event ev = rec.event;
+		cl_ulong start = 0, end = 0;
+		clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, nullptr);
+		clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, nullptr);
+		total += end - start;
+		clReleaseEvent(ev);
+	}
+	log.clear();
+	return total / 1e6;
+}
+
+std::string escape(const std::string& str) {
+	std::string escaped;
+	for (char c : str) {
+		if (c == '"' || c == '\\') { escaped.push_back('\\'); }
+		if (c == '\n') { escaped.append("\\n"); continue; }
+		escaped.push_back(c);
+	}
+	return escaped;
+}
+
+std::vector<cl_int2> parse_sizes(const std::string& list) {
+	std::vector<cl_int2> sizes;
+	std::istringstream iss(list);
+	std::string item;
+	while (std::getline(iss, item, ',')) {
+		size_t sep = item.find('x');
+		if (sep == std::string::npos) { throw std::runtime_error("Wrong size: " + item); }
+		sizes.push_back({ atoi(item.substr(0, sep).c_str()), atoi(item.substr(sep + 1).c_str()) });
+	}
+	return sizes;
+}
+
+int main(int argc, char** argv) {
+	keys opts;
+	for (int arg = 1; arg + 1 < argc; arg += 2) { opts[argv[arg]] = argv[arg + 1]; }
+	if (argc % 2 == 0) {
+		std::cerr << "Usage: " << bench_syntax << std::endl;
+		return 1;
+	}
+	try {
+		size_t platform = opts["-p"].empty() ? 0 : atoi(opts["-p"].c_str());
+		size_t device = opts["-d"].empty() ? 0 : atoi(opts["-d"].c_str());
+		int repetitions = opts["-r"].empty() ? 15 : atoi(opts["-r"].c_str());
+		int warmup = opts["-w"].empty() ? 2 : atoi(opts["-w"].c_str());
+		bool quality = (opts["-q"] == "on");
+		std::vector<cl_int2> sizes = parse_sizes(opts["-s"].empty() ? "512x512,1920x1080,3840x2160" : opts["-s"]);
+		if (repetitions < 1) { throw std::runtime_error("At least one repetition required"); }
+
+		app bench_app(platform, device, 0, CL_QUEUE_PROFILING_ENABLE);
+		std::ostringstream json;
+		json << std::fixed << std::setprecision(4);
+		json << "{\n  \"device\": \"" << escape(hardware::string_param(bench_app.env.cur_device, CL_DEVICE_NAME)) << "\",\n";
+		json << "  \"driver\": \"" << escape(hardware::string_param(bench_app.env.cur_device, CL_DRIVER_VERSION)) << "\",\n";
+		json << "  \"repetitions\": " << repetitions << ",\n  \"warmup\": " << warmup << ",\n  \"results\": [";
+
+		bool first = true;
+		std::vector<hardware::record> log;
+		for (const bench_case& cur : all_cases()) {
+			std::string name = cur.executor + "/" + cur.variant;
+			if (!opts["-f"].empty() && name.find(opts["-f"]) == std::string::npos) { continue; }
+			for (cl_int2 size : sizes) {
+				json << (first ? "\n" : ",\n") << "    {\"executor\": \"" << cur.executor << "\", \"variant\": \""
+					<< escape(cur.variant) << "\", \"width\": " << size.x << ", \"height\": " << size.y;
+				first = false;
+				std::cerr << name << " " << size.x << "x" << size.y << std::endl;
+				try {
+					im_ptr src = synthetic(bench_app, size, cur.gamma);
+					std::vector<double> wall, device_time;
+					for (int iter = 0; iter < warmup + repetitions; ++iter) {
+						bench_app.env.event_log = &log;
+						auto start = std::chrono::steady_clock::now();
+						im_ptr result = cur.run(bench_app, src);
+						clFinish(bench_app.env.queue());
+						auto end = std::chrono::steady_clock::now();
+						bench_app.env.event_log = nullptr;
+						double kernels_ms = device_ms(log);
+						if (iter < warmup) { continue; }
+						wall.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+						device_time.push_back(kernels_ms);
+					}
+					stats wall_stats = summarise(wall), device_stats = summarise(device_time);
+					double mpix = static_cast<double>(size.x) * size.y / 1e6;
+					json << ", \"wall_ms\": {\"median\": " << wall_stats.median << ", \"p95\": " << wall_stats.p95 << "}"
+						<< ", \"device_ms\": {\"median\": " << device_stats.median << ", \"p95\": " << device_stats.p95 << "}"
+						<< ", \"mpix_per_s\": " << mpix / (wall_stats.median / 1000.0);
+					if (quality && cur.restore) {
+						im_ptr result = cur.run(bench_app, src);
+						im_ptr restored = cur.restore(bench_app, result, src->size);
+						assessor::quality metrics = bench_app.assessor_ptr->compare(restored, src);
+						double psnr = (metrics.psnr.s[0] + metrics.psnr.s[1] + metrics.psnr.s[2]) / 3.0;
+						double ssim = (metrics.ssim.s[0] + metrics.ssim.s[1] + metrics.ssim.s[2]) / 3.0;
+						double ms_ssim = (metrics.ms_ssim.s[0] + metrics.ms_ssim.s[1] + metrics.ms_ssim.s[2]) / 3.0;
+						json << ", \"round_trip\": {\"psnr\": ";
+						if (std::isfinite(psnr)) { json << psnr; }
+						else { json << "null"; }
+						json << ", \"ssim\": " << ssim << ", \"ms_ssim\": " << ms_ssim << "}";
+					}
+					json << "}";
+				}
+				catch (const std::runtime_error& e) {
+					bench_app.env.event_log = nullptr;
+					device_ms(log);
+					json << ", \"error\": \"" << escape(e.what()) << "\"}";
+				}
+			}
+		}
+		json << "\n  ]\n}\n";
+
+		if (opts["-o"].empty()) { std::cout << json.str(); }
+		else {
+			std::ofstream out(opts["-o"]);
+			if (!out.is_open()) { throw std::runtime_error("Failed to open " + opts["-o"]); }
+			out << json.str();
+		}
+	}
+	catch (const std::runtime_error& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}